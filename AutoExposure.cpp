@@ -0,0 +1,198 @@
+#include "AutoExposure.hpp"
+
+#include <algorithm>
+#include <cmath>
+#include <string.h>
+
+#define AUTOEXPOSURE_STEP       4       // histogram of every 4th pixel of every 4th row
+#define AUTOEXPOSURE_BACKOFF    0.7     // factor for a frame that is only slightly saturated
+#define AUTOEXPOSURE_HEAVY      10      // times the tolerated saturation that calls for a full step
+
+AutoExposure::AutoExposure()
+    : lTarget(192)
+    , lBrightFraction(0.01)
+    , lSaturation(0.001)
+    , lMaxStep(4.0)
+    , lDeadband(0.08)
+    , lMinExposure(5)
+    , lMaxExposure(38221)   // longest exposure that keeps the full frame rate
+    , lMinGain(400)         // the default analog gain
+    , lMaxGain(1023)
+{
+    Reset();
+}
+
+void AutoExposure::SetTarget(int level)
+{
+    lTarget = std::min(std::max(level, 1), 254);
+}
+
+void AutoExposure::SetBrightFraction(double fraction)
+{
+    lBrightFraction = std::min(std::max(fraction, 0.0), 1.0);
+}
+
+void AutoExposure::SetSaturation(double fraction)
+{
+    lSaturation = std::max(fraction, 0.0);
+}
+
+void AutoExposure::SetMaxStep(double factor)
+{
+    lMaxStep = std::max(factor, 1.01);
+}
+
+void AutoExposure::SetDeadband(double fraction)
+{
+    lDeadband = std::max(fraction, 0.0);
+}
+
+void AutoExposure::SetLimits(int minExposure, int maxExposure, int minGain, int maxGain)
+{
+    lMinExposure = std::max(minExposure, 1);
+    lMaxExposure = std::max(maxExposure, lMinExposure);
+    lMinGain = std::max(minGain, 1);
+    lMaxGain = std::max(maxGain, lMinGain);
+}
+
+void AutoExposure::Reset()
+{
+    memset(lHistogram, 0, sizeof(lHistogram));
+    lSamples = 0;
+    lBright = 0;
+    lSaturated = 0;
+    lExposure = 0;
+    lGain = 0;
+}
+
+int AutoExposure::Exposure() const
+{
+    return lExposure;
+}
+
+int AutoExposure::Gain() const
+{
+    return lGain;
+}
+
+int AutoExposure::BrightLevel() const
+{
+    return lBright;
+}
+
+double AutoExposure::SaturatedFraction() const
+{
+    return lSaturated;
+}
+
+void AutoExposure::Histogram(const FrameLease &frame)
+{
+    memset(lHistogram, 0, sizeof(lHistogram));
+    lSamples = 0;
+    const unsigned char *pixels = frame.data();
+    for (int y = 0; y < frame.height; y += AUTOEXPOSURE_STEP)
+    {
+        size_t row = (size_t)y * frame.width;
+        if (frame.format == MONO8)
+        {
+            const unsigned char *line = pixels + row;
+            for (int x = 0; x < frame.width; x += AUTOEXPOSURE_STEP)
+            {
+                lHistogram[line[x]]++;
+            }
+        }
+        else
+        {
+            for (int x = 0; x < frame.width; x += AUTOEXPOSURE_STEP)
+            {
+                lHistogram[PixelLevel(pixels, frame.format, row + x)]++;
+            }
+        }
+        lSamples += (frame.width + AUTOEXPOSURE_STEP - 1) / AUTOEXPOSURE_STEP;
+    }
+}
+
+bool AutoExposure::Update(const FrameLease &frame, int exposure, int gain)
+{
+    if (frame.empty() || exposure <= 0 || gain <= 0)
+    {
+        return false;
+    }
+    Histogram(frame);
+    return Decide(exposure, gain);
+}
+
+bool AutoExposure::Update(const FrameStats &stats, int exposure, int gain)
+{
+    if (exposure <= 0 || gain <= 0)
+    {
+        return false;
+    }
+    memcpy(lHistogram, stats.histogram, sizeof(lHistogram));
+    lSamples = stats.pixels;
+    return Decide(exposure, gain);
+}
+
+bool AutoExposure::Decide(int exposure, int gain)
+{
+    if (lSamples == 0)
+    {
+        return false;
+    }
+
+    // level that the brightest fraction of the samples reach
+    long wanted = std::max((long)(lSamples * lBrightFraction), 1L);
+    long count = 0;
+    lBright = 255;
+    while (lBright > 0 && (count += lHistogram[lBright]) < wanted)
+    {
+        lBright--;
+    }
+    lSaturated = (double)lHistogram[255] / lSamples;
+
+    // a saturated frame says nothing about how much too bright it is
+    double ratio;
+    if (lSaturated > lSaturation * AUTOEXPOSURE_HEAVY)
+    {
+        ratio = 1.0 / lMaxStep;
+    }
+    else if (lSaturated > lSaturation)
+    {
+        ratio = AUTOEXPOSURE_BACKOFF;
+    }
+    else
+    {
+        ratio = (double)lTarget / std::max(lBright, 1);
+        if (std::fabs(ratio - 1.0) <= lDeadband)
+        {
+            return false;
+        }
+        ratio = std::min(std::max(ratio, 1.0 / lMaxStep), lMaxStep);
+    }
+
+    // exposure takes the change, gain makes up what exposure can't, and
+    // comes down first so the noise goes with it
+    double newExposure = exposure;
+    double newGain = gain;
+    if (ratio > 1.0)
+    {
+        newExposure = exposure * ratio;
+        if (newExposure > lMaxExposure)
+        {
+            newGain = gain * newExposure / lMaxExposure;
+            newExposure = lMaxExposure;
+        }
+    }
+    else if (gain > lMinGain)
+    {
+        newGain = std::max(gain * ratio, (double)lMinGain);
+        newExposure = exposure * ratio * gain / newGain;
+    }
+    else
+    {
+        newExposure = exposure * ratio;
+    }
+    lExposure = std::min(std::max((int)lround(newExposure), lMinExposure), lMaxExposure);
+    lGain = std::min(std::max((int)lround(newGain), std::min(gain, lMinGain)), lMaxGain);
+    return lExposure != exposure || lGain != gain;
+}
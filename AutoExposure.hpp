@@ -0,0 +1,64 @@
+#ifndef _AUTOEXPOSURE_HPP_
+#define _AUTOEXPOSURE_HPP_
+
+#include "FrameSource.hpp"
+#include "FrameStats.hpp"
+
+/* Software exposure control, for when the Sun gets brighter or dimmer
+   than the configured exposure allows for. Update() builds a histogram
+   of a subsample of each frame, or takes the full one from FrameStats
+   when the frame has been measured anyway, and steers the level of its
+   brightest pixels (the disk center) to a target, backing off quickly
+   when too much of the frame is saturated. Exposure is changed first and analog
+   gain only once exposure is at a limit; brightness is taken to be
+   proportional to both. Each step is limited to a factor, and Update()
+   should only be given frames exposed with the current settings
+   (CameraControl::IsSettled), which limits the rate to one change per
+   round trip to the camera.
+*/
+class AutoExposure
+{
+public:
+    AutoExposure();
+
+    // target level of the brightest pixels, on the 0-255 scale
+    void SetTarget(int level);
+    // fraction of the samples that make up "the brightest pixels"
+    void SetBrightFraction(double fraction);
+    // fraction of saturated samples tolerated before backing off
+    void SetSaturation(double fraction);
+    // largest factor per change, and the relative error left alone
+    void SetMaxStep(double factor);
+    void SetDeadband(double fraction);
+    // exposure in usec, gain in analog gain counts
+    void SetLimits(int minExposure, int maxExposure, int minGain, int maxGain);
+
+    void Reset();
+    /* exposure and gain are the settings the frame was taken with,
+       returns true when they should change to Exposure() and Gain()
+    */
+    bool Update(const FrameLease &frame, int exposure, int gain);
+    bool Update(const FrameStats &stats, int exposure, int gain);
+    int Exposure() const;
+    int Gain() const;
+
+    // from the last Update()
+    int BrightLevel() const;
+    double SaturatedFraction() const;
+
+private:
+    void Histogram(const FrameLease &frame);
+    bool Decide(int exposure, int gain);
+
+    int lTarget;
+    double lBrightFraction, lSaturation, lMaxStep, lDeadband;
+    int lMinExposure, lMaxExposure, lMinGain, lMaxGain;
+
+    long lHistogram[256];
+    long lSamples;
+    int lBright;
+    double lSaturated;
+    int lExposure, lGain;
+};
+
+#endif
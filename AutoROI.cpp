@@ -0,0 +1,172 @@
+#include "AutoROI.hpp"
+
+#include <algorithm>
+
+#define AUTOROI_STEP            4       // disk search looks at every 4th pixel of every 4th row
+#define AUTOROI_MIN_CONTRAST    32      // DN between sky and disk
+#define AUTOROI_MIN_AREA        1250    // pixels, a disk of about 20 pixels radius
+#define AUTOROI_ALIGN           8       // the camera wants width and x offset in multiples of 8
+
+AutoROI::AutoROI(int sensorWidth, int sensorHeight)
+    : lSensorWidth(sensorWidth)
+    , lSensorHeight(sensorHeight)
+    , lMargin(40)
+    , lHysteresis(16)
+    , lLossFrames(10)
+{
+    Reset();
+}
+
+void AutoROI::SetMargin(int margin)
+{
+    lMargin = std::max(margin, 0);
+}
+
+void AutoROI::SetHysteresis(int hysteresis)
+{
+    lHysteresis = std::max(hysteresis, 0);
+}
+
+void AutoROI::SetLossFrames(int lossFrames)
+{
+    lLossFrames = std::max(lossFrames, 1);
+}
+
+void AutoROI::Reset()
+{
+    lWindow = cv::Rect(0, 0, lSensorWidth, lSensorHeight);
+    lLocked = false;
+    lMissing = 0;
+}
+
+cv::Rect AutoROI::Window() const
+{
+    return lWindow;
+}
+
+bool AutoROI::IsLocked() const
+{
+    return lLocked;
+}
+
+bool AutoROI::Update(const FrameLease &frame)
+{
+    cv::Rect disk;
+    if (!FindDisk(frame, disk))
+    {
+        // give the disk a few frames to come back before reading the whole sensor
+        if (lLocked && ++lMissing >= lLossFrames)
+        {
+            Reset();
+            return true;
+        }
+        return false;
+    }
+    lMissing = 0;
+
+    cv::Rect target = Around(disk);
+    if (!lLocked)
+    {
+        lLocked = true;
+        lWindow = target;
+        return true;
+    }
+
+    // Only move the window once the disk has drifted past the hysteresis,
+    // towards an edge or away from it, so it is not commanded every frame
+    int left = disk.x - lWindow.x;
+    int right = (lWindow.x + lWindow.width) - (disk.x + disk.width);
+    int top = disk.y - lWindow.y;
+    int bottom = (lWindow.y + lWindow.height) - (disk.y + disk.height);
+    int nearest = std::min(std::min(left, right), std::min(top, bottom));
+    int farthest = std::max(std::max(left, right), std::max(top, bottom));
+    if (nearest >= lMargin - lHysteresis && farthest <= lMargin + lHysteresis + AUTOROI_ALIGN)
+    {
+        return false;
+    }
+    // near the sensor edge the window can't be centered any better
+    if (target.x == lWindow.x && target.y == lWindow.y &&
+        target.width == lWindow.width && target.height == lWindow.height)
+    {
+        return false;
+    }
+    lWindow = target;
+    return true;
+}
+
+bool AutoROI::FindDisk(const FrameLease &frame, cv::Rect &disk)
+{
+    if (frame.empty())
+    {
+        return false;
+    }
+
+    // the disk is much brighter than the sky, halfway between the two
+    // separates them well enough for a bounding box; deeper formats are
+    // judged on their top 8 bits
+    const unsigned char *pixels = frame.data();
+    int low = 255, high = 0;
+    for (int y = 0; y < frame.height; y += AUTOROI_STEP)
+    {
+        size_t row = (size_t)y * frame.width;
+        for (int x = 0; x < frame.width; x += AUTOROI_STEP)
+        {
+            int level = PixelLevel(pixels, frame.format, row + x);
+            low = std::min(low, level);
+            high = std::max(high, level);
+        }
+    }
+    if (high - low < AUTOROI_MIN_CONTRAST)
+    {
+        return false;
+    }
+    int threshold = (low + high) / 2;
+
+    int x0 = frame.width, x1 = -1, y0 = frame.height, y1 = -1;
+    long count = 0;
+    for (int y = 0; y < frame.height; y += AUTOROI_STEP)
+    {
+        size_t row = (size_t)y * frame.width;
+        for (int x = 0; x < frame.width; x += AUTOROI_STEP)
+        {
+            if (PixelLevel(pixels, frame.format, row + x) > threshold)
+            {
+                x0 = std::min(x0, x);
+                x1 = std::max(x1, x);
+                y0 = std::min(y0, y);
+                y1 = std::max(y1, y);
+                count++;
+            }
+        }
+    }
+    if (count * AUTOROI_STEP * AUTOROI_STEP < AUTOROI_MIN_AREA)
+    {
+        return false;
+    }
+
+    // the limb can lie up to a step beyond the last sample
+    x0 = std::max(x0 - AUTOROI_STEP + 1, 0);
+    y0 = std::max(y0 - AUTOROI_STEP + 1, 0);
+    x1 = std::min(x1 + AUTOROI_STEP - 1, frame.width - 1);
+    y1 = std::min(y1 + AUTOROI_STEP - 1, frame.height - 1);
+    disk = cv::Rect(frame.offsetX + x0, frame.offsetY + y0, x1 - x0 + 1, y1 - y0 + 1);
+    return true;
+}
+
+cv::Rect AutoROI::Around(const cv::Rect &disk)
+{
+    int x0 = std::max(disk.x - lMargin, 0);
+    int y0 = std::max(disk.y - lMargin, 0);
+    int x1 = std::min(disk.x + disk.width + lMargin, lSensorWidth);
+    int y1 = std::min(disk.y + disk.height + lMargin, lSensorHeight);
+
+    // widen to the alignment rather than cut into the margin
+    x0 -= x0 % AUTOROI_ALIGN;
+    x1 += (AUTOROI_ALIGN - (x1 - x0) % AUTOROI_ALIGN) % AUTOROI_ALIGN;
+    if (x1 > lSensorWidth)
+    {
+        x0 = std::max(x0 - (x1 - lSensorWidth), 0);
+        x1 = lSensorWidth;
+    }
+    return cv::Rect(x0, y0, x1 - x0, y1 - y0);
+}
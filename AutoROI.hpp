@@ -0,0 +1,41 @@
+#ifndef _AUTOROI_HPP_
+#define _AUTOROI_HPP_
+
+#include "FrameSource.hpp"
+
+/* Keeps the readout window on the solar disk. Update() looks at each
+   frame: once the disk is found the window closes in to the disk plus a
+   margin, follows it when it drifts more than the hysteresis from its
+   place in the window, and opens back up to the full sensor when the
+   disk has been missing for a number of frames. All coordinates are in
+   sensor pixels, frames carry their own window offset.
+*/
+class AutoROI
+{
+public:
+    AutoROI(int sensorWidth, int sensorHeight);
+
+    // margin and hysteresis in pixels, lossFrames frames without a disk
+    void SetMargin(int margin);
+    void SetHysteresis(int hysteresis);
+    void SetLossFrames(int lossFrames);
+
+    // back to the full sensor, e.g. after a reconnect
+    void Reset();
+    // returns true when the readout window should change to Window()
+    bool Update(const FrameLease &frame);
+    cv::Rect Window() const;
+    bool IsLocked() const;
+
+private:
+    bool FindDisk(const FrameLease &frame, cv::Rect &disk);
+    cv::Rect Around(const cv::Rect &disk);
+
+    int lSensorWidth, lSensorHeight;
+    int lMargin, lHysteresis, lLossFrames;
+    cv::Rect lWindow;
+    bool lLocked;
+    int lMissing;
+};
+
+#endif
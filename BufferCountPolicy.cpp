@@ -0,0 +1,128 @@
+#include "BufferCountPolicy.hpp"
+
+#include <cmath>
+
+#define POLICY_WINDOW       1.0     // seconds of traffic per decision
+#define POLICY_IDLE_SHRINK  30.0    // quiet seconds before giving memory back
+#define POLICY_RATE_WEIGHT  0.25    // smoothing of the observed frame rate
+
+BufferCountPolicy::BufferCountPolicy()
+    : lMinCount(4)
+    , lMaxCount(64)
+    , lMemoryBudget(64LL * 1024 * 1024)
+    , lPayloadSize(1296 * 966)
+    , lLatencyBudget(0.5)
+    , lCount(16)
+    , lBaseCount(16)
+    , lFrameRate(0.0)
+    , lWindowStart(-1)
+    , lWindowFrames(0)
+    , lWindowLost(0)
+    , lWindowMissing(0)
+    , lWindowQueuePeak(0)
+    , lLastTrouble(0)
+{
+}
+
+void BufferCountPolicy::SetLimits(int minCount, int maxCount, long long memoryBudget)
+{
+    lMinCount = minCount > 1 ? minCount : 2;
+    lMaxCount = maxCount > lMinCount ? maxCount : lMinCount;
+    lMemoryBudget = memoryBudget;
+}
+
+void BufferCountPolicy::SetLatencyBudget(double seconds)
+{
+    lLatencyBudget = seconds;
+}
+
+int BufferCountPolicy::Clamp(int count) const
+{
+    int maxCount = lMaxCount;
+    if (lPayloadSize > 0 && lMemoryBudget / lPayloadSize < maxCount)
+    {
+        maxCount = (int)(lMemoryBudget / lPayloadSize);
+    }
+    if (count > maxCount) count = maxCount;
+    if (count < lMinCount) count = lMinCount;
+    return count;
+}
+
+int BufferCountPolicy::Initial(long long payloadSize, double frameRate)
+{
+    lPayloadSize = payloadSize;
+    lFrameRate = frameRate;
+    // one buffer being filled, one being processed, the rest ride out stalls
+    lBaseCount = Clamp((int)ceil(frameRate * lLatencyBudget) + 2);
+    lCount = lBaseCount;
+    lWindowStart = -1;
+    return lCount;
+}
+
+int BufferCountPolicy::Update(const timespec &now, int framesLost, int packetsMissing, int queued)
+{
+    double t = now.tv_sec + now.tv_nsec / 1e9;
+    if (lWindowStart < 0)
+    {
+        lWindowStart = t;
+        lLastTrouble = t;
+    }
+
+    lWindowFrames++;
+    lWindowLost += framesLost;
+    lWindowMissing += packetsMissing;
+    if (queued > lWindowQueuePeak) lWindowQueuePeak = queued;
+
+    double elapsed = t - lWindowStart;
+    if (elapsed < POLICY_WINDOW)
+    {
+        return lCount;
+    }
+
+    // follow the rate the camera is really delivering at
+    double rate = lWindowFrames / elapsed;
+    lFrameRate = (lFrameRate > 0) ? lFrameRate + POLICY_RATE_WEIGHT * (rate - lFrameRate) : rate;
+    lBaseCount = Clamp((int)ceil(lFrameRate * lLatencyBudget) + 2);
+
+    bool backedUp = lWindowQueuePeak >= lCount / 2;
+    if ((lWindowLost > 0 || lWindowMissing > 0) && (backedUp || lCount < lBaseCount))
+    {
+        // consumers fell behind: grow by half again
+        int grown = lCount + (lCount + 1) / 2;
+        lCount = Clamp(grown > lBaseCount ? grown : lBaseCount);
+        lLastTrouble = t;
+    }
+    else if (lWindowLost > 0 || lWindowMissing > 0)
+    {
+        // losses with an empty queue are on the link, more buffers won't help
+        lLastTrouble = t;
+    }
+    else if (t - lLastTrouble > POLICY_IDLE_SHRINK && lWindowQueuePeak < lCount / 4 && lCount > lBaseCount)
+    {
+        // quiet for a while, give back a quarter of the excess
+        int shrunk = lCount - (lCount - lBaseCount + 3) / 4;
+        lCount = Clamp(shrunk);
+        lLastTrouble = t;
+    }
+    else if (lCount < lBaseCount)
+    {
+        lCount = lBaseCount;
+    }
+
+    lWindowStart = t;
+    lWindowFrames = 0;
+    lWindowLost = 0;
+    lWindowMissing = 0;
+    lWindowQueuePeak = 0;
+    return lCount;
+}
+
+int BufferCountPolicy::Count() const
+{
+    return lCount;
+}
+
+double BufferCountPolicy::FrameRate() const
+{
+    return lFrameRate;
+}
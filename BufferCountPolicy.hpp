@@ -0,0 +1,52 @@
+#ifndef _BUFFERCOUNTPOLICY_HPP_
+#define _BUFFERCOUNTPOLICY_HPP_
+
+#include <ctime>
+
+/* Sizes the PvPipeline buffer count from what the stream is actually doing
+   instead of a fixed 16. The starting depth covers a latency budget at the
+   expected frame rate, capped by a memory budget for the payload size. Each
+   window of traffic is then checked: lost frames or missing packets while
+   the output queue is backing up grow the pipeline, and a long quiet spell
+   with a shallow queue shrinks it back toward the base depth.
+*/
+class BufferCountPolicy
+{
+public:
+    BufferCountPolicy();
+
+    // minCount/maxCount in buffers, memoryBudget in bytes for all buffers
+    void SetLimits(int minCount, int maxCount, long long memoryBudget);
+    // how long (s) the consumer may stall before frames are lost
+    void SetLatencyBudget(double seconds);
+
+    // depth to start the pipeline with
+    int Initial(long long payloadSize, double frameRate);
+
+    /* Account for one retrieval and return the depth the pipeline should
+       have now. framesLost counts BlockID gaps and failed buffers,
+       packetsMissing the missing packets reported for the buffer, queued
+       the pipeline output queue depth when the buffer was retrieved
+    */
+    int Update(const timespec &now, int framesLost, int packetsMissing, int queued);
+
+    int Count() const;
+    double FrameRate() const;
+
+private:
+    int Clamp(int count) const;
+
+    int lMinCount, lMaxCount;
+    long long lMemoryBudget, lPayloadSize;
+    double lLatencyBudget;
+    int lCount, lBaseCount;
+    double lFrameRate;
+
+    // current observation window
+    double lWindowStart;
+    int lWindowFrames, lWindowLost, lWindowMissing, lWindowQueuePeak;
+    // last time anything was lost or the pipeline grew
+    double lLastTrouble;
+};
+
+#endif
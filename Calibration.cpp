@@ -0,0 +1,290 @@
+#include "Calibration.hpp"
+
+#include <CCfits>
+#include <algorithm>
+#include <cmath>
+#include <iostream>
+#include <memory>
+
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+
+#define CALIBRATION_UNITY       4096    // gain of 1.0
+#define CALIBRATION_MAX_GAIN    32767   // just under 8.0, keeps 12-bit products signed
+#define CALIBRATION_DEAD_FLAT   0.1     // of the flat's mean, below this a pixel is bad
+
+using namespace CCfits;
+
+namespace
+{
+    /* (v - dark) * gain >> 12 as a high multiply: the difference is
+       moved up 4 bits and the top 16 bits of the product kept, rounded
+       by the top bit of the low half. At most 255 * 8, so packing back
+       saturates to 255
+    */
+#ifdef __SSE2__
+    inline __m128i Scale(__m128i v, __m128i gain)
+    {
+        v = _mm_slli_epi16(v, 4);
+        return _mm_add_epi16(_mm_mulhi_epu16(v, gain), _mm_srli_epi16(_mm_mullo_epi16(v, gain), 15));
+    }
+#endif
+
+    void CorrectRow8(unsigned char *row, const unsigned char *dark, const uint16_t *gain, int width)
+    {
+        int x = 0;
+#ifdef __SSE2__
+        const __m128i zero = _mm_setzero_si128();
+        for (; x + 16 <= width; x += 16)
+        {
+            __m128i v = _mm_subs_epu8(_mm_loadu_si128((const __m128i *)(row + x)),
+                                      _mm_loadu_si128((const __m128i *)(dark + x)));
+            __m128i lo = Scale(_mm_unpacklo_epi8(v, zero), _mm_loadu_si128((const __m128i *)(gain + x)));
+            __m128i hi = Scale(_mm_unpackhi_epi8(v, zero), _mm_loadu_si128((const __m128i *)(gain + x + 8)));
+            _mm_storeu_si128((__m128i *)(row + x), _mm_packus_epi16(lo, hi));
+        }
+#endif
+        for (; x < width; x++)
+        {
+            int v = std::max(row[x] - dark[x], 0);
+            row[x] = std::min(((v << 4) * gain[x] + 0x8000) >> 16, 255);
+        }
+    }
+
+    // the same on one word per pixel, the 12-bit dark shifted to the frame's depth
+    void CorrectRow16(uint16_t *row, const uint16_t *dark, const uint16_t *gain, int width, int bits)
+    {
+        int x = 0;
+        int shift = 12 - bits;
+        int top = (1 << bits) - 1;
+#ifdef __SSE2__
+        const __m128i limit = _mm_set1_epi16(top);
+        for (; x + 8 <= width; x += 8)
+        {
+            __m128i d = _mm_srli_epi16(_mm_loadu_si128((const __m128i *)(dark + x)), shift);
+            __m128i v = _mm_subs_epu16(_mm_loadu_si128((const __m128i *)(row + x)), d);
+            v = Scale(v, _mm_loadu_si128((const __m128i *)(gain + x)));
+            _mm_storeu_si128((__m128i *)(row + x), _mm_min_epi16(v, limit));
+        }
+#endif
+        for (; x < width; x++)
+        {
+            unsigned v = std::max(row[x] - (dark[x] >> shift), 0);
+            row[x] = std::min((int)(((v << 4) * gain[x] + 0x8000) >> 16), top);
+        }
+    }
+
+    template <class T>
+    void FixBadPixels(T *pixels, int width, int height, int offsetX, int offsetY,
+                      int sensorWidth, const std::vector<int> &bad)
+    {
+        for (int y = 0; y < height; y++)
+        {
+            int start = (offsetY + y) * sensorWidth + offsetX;
+            std::vector<int>::const_iterator it = std::lower_bound(bad.begin(), bad.end(), start);
+            T *row = pixels + (size_t)y * width;
+            for (; it != bad.end() && *it < start + width; ++it)
+            {
+                int x = *it - start;
+                if (x > 0 && x < width - 1)
+                {
+                    row[x] = (row[x - 1] + row[x + 1] + 1) / 2;
+                }
+                else if (width > 1)
+                {
+                    row[x] = row[x > 0 ? x - 1 : x + 1];
+                }
+            }
+        }
+    }
+}
+
+Calibration::Calibration(int width, int height)
+    : lWidth(width)
+    , lHeight(height)
+    , lHaveDark(false)
+    , lHaveFlat(false)
+    , lDark8((size_t)width * height, 0)
+    , lDark12((size_t)width * height, 0)
+    , lGain((size_t)width * height, CALIBRATION_UNITY)
+{
+}
+
+int Calibration::ReadImage(const std::string &fileName, std::vector<float> &values, int &bits)
+{
+    std::valarray<float> contents;
+    bits = 8;
+    try
+    {
+        std::unique_ptr<FITS> file(new FITS(fileName, Read, true));
+        PHDU &image = file->pHDU();
+        if (image.axes() != 2 || image.axis(0) != lWidth || image.axis(1) != lHeight)
+        {
+            std::cout << "Calibration::ReadImage " << fileName << " is not a "
+                      << lWidth << " x " << lHeight << " image" << std::endl;
+            return -1;
+        }
+        image.read(contents);
+        try
+        {
+            image.readKey("BITDEPTH", bits);
+        }
+        catch (HDU::NoSuchKeyword &)
+        {
+            bits = 8;
+        }
+    }
+    catch (FitsException &e)
+    {
+        std::cout << "Calibration::ReadImage Can't read " << fileName << ": " << e.message() << std::endl;
+        return -1;
+    }
+    if (contents.size() != lDark8.size() || bits < 8 || bits > 12)
+    {
+        std::cout << "Calibration::ReadImage " << fileName << " has the wrong size or depth" << std::endl;
+        return -1;
+    }
+    values.assign(&contents[0], &contents[0] + contents.size());
+    return 0;
+}
+
+void Calibration::SortBadPixels()
+{
+    std::sort(lBad.begin(), lBad.end());
+    lBad.erase(std::unique(lBad.begin(), lBad.end()), lBad.end());
+}
+
+int Calibration::LoadDark(const std::string &fileName)
+{
+    std::vector<float> dark;
+    int bits;
+    if (ReadImage(fileName, dark, bits) != 0)
+    {
+        return -1;
+    }
+    double to8 = std::ldexp(1.0, 8 - bits), to12 = std::ldexp(1.0, 12 - bits);
+    for (size_t i = 0; i < dark.size(); i++)
+    {
+        double level = std::max(dark[i], 0.0f);
+        lDark8[i] = (unsigned char)std::min(lround(level * to8), 255L);
+        lDark12[i] = (uint16_t)std::min(lround(level * to12), 4095L);
+    }
+    lHaveDark = true;
+    return 0;
+}
+
+int Calibration::LoadFlat(const std::string &fileName)
+{
+    std::vector<float> flat;
+    int bits;
+    if (ReadImage(fileName, flat, bits) != 0)
+    {
+        return -1;
+    }
+    double sum = 0;
+    long count = 0;
+    for (size_t i = 0; i < flat.size(); i++)
+    {
+        if (flat[i] > 0)
+        {
+            sum += flat[i];
+            count++;
+        }
+    }
+    if (count == 0)
+    {
+        std::cout << "Calibration::LoadFlat " << fileName << " is empty" << std::endl;
+        return -1;
+    }
+    double mean = sum / count;
+    for (size_t i = 0; i < flat.size(); i++)
+    {
+        if (flat[i] < CALIBRATION_DEAD_FLAT * mean)
+        {
+            lGain[i] = CALIBRATION_UNITY;
+            lBad.push_back(i);
+        }
+        else
+        {
+            lGain[i] = (uint16_t)std::min(lround(CALIBRATION_UNITY * mean / flat[i]), (long)CALIBRATION_MAX_GAIN);
+        }
+    }
+    SortBadPixels();
+    lHaveFlat = true;
+    return 0;
+}
+
+int Calibration::LoadBadPixels(const std::string &fileName)
+{
+    std::vector<float> mask;
+    int bits;
+    if (ReadImage(fileName, mask, bits) != 0)
+    {
+        return -1;
+    }
+    for (size_t i = 0; i < mask.size(); i++)
+    {
+        if (mask[i] != 0)
+        {
+            lBad.push_back(i);
+        }
+    }
+    SortBadPixels();
+    return 0;
+}
+
+bool Calibration::Ready() const
+{
+    return lHaveDark || lHaveFlat || !lBad.empty();
+}
+
+bool Calibration::HasDark() const
+{
+    return lHaveDark;
+}
+
+bool Calibration::HasFlat() const
+{
+    return lHaveFlat;
+}
+
+int Calibration::BadPixels() const
+{
+    return lBad.size();
+}
+
+void Calibration::Apply(unsigned char *pixels, int width, int height, int offsetX, int offsetY) const
+{
+    if (!Ready() || offsetX < 0 || offsetY < 0 || offsetX + width > lWidth || offsetY + height > lHeight)
+    {
+        return;
+    }
+    if (lHaveDark || lHaveFlat)
+    {
+        for (int y = 0; y < height; y++)
+        {
+            size_t table = (size_t)(offsetY + y) * lWidth + offsetX;
+            CorrectRow8(pixels + (size_t)y * width, &lDark8[table], &lGain[table], width);
+        }
+    }
+    FixBadPixels(pixels, width, height, offsetX, offsetY, lWidth, lBad);
+}
+
+void Calibration::Apply(uint16_t *pixels, int width, int height, int offsetX, int offsetY, int bits) const
+{
+    if (!Ready() || bits < 8 || bits > 12 ||
+        offsetX < 0 || offsetY < 0 || offsetX + width > lWidth || offsetY + height > lHeight)
+    {
+        return;
+    }
+    if (lHaveDark || lHaveFlat)
+    {
+        for (int y = 0; y < height; y++)
+        {
+            size_t table = (size_t)(offsetY + y) * lWidth + offsetX;
+            CorrectRow16(pixels + (size_t)y * width, &lDark12[table], &lGain[table], width, bits);
+        }
+    }
+    FixBadPixels(pixels, width, height, offsetX, offsetY, lWidth, lBad);
+}
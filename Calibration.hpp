@@ -0,0 +1,58 @@
+#ifndef _CALIBRATION_HPP_
+#define _CALIBRATION_HPP_
+
+#include <string>
+#include <vector>
+#include <stdint.h>
+
+/* Dark, flat and bad-pixel correction of each frame as it arrives
+     out = (raw - dark) * gain
+   with the gain the flat's mean over the flat, and bad pixels replaced
+   by the mean of their neighbours in the row. Tables cover the whole
+   sensor, so a readout window is corrected from its own part of them,
+   and are made once when loaded: the dark at 8 and at 12 bits, the gain
+   in 3.12 fixed point (1.0 = 4096, less than 8), the bad pixels as a
+   sorted list of sensor indices. The correction is 16 pixels at a time
+   with SSE2 when built with it.
+
+   Calibration files are 2-d FITS images the size of the sensor. The
+   dark is in camera values at the BITDEPTH of its header (8 without
+   one), as in a master dark averaged from saved frames. The flat only
+   needs to be proportional to the response, dark already removed.
+   Nonzero pixels of the mask are bad, and so are pixels with a flat
+   under a tenth of its mean.
+*/
+class Calibration
+{
+public:
+    Calibration(int width, int height);
+
+    // each returns 0 when loaded, -1 if the file can't be used
+    int LoadDark(const std::string &fileName);
+    int LoadFlat(const std::string &fileName);
+    int LoadBadPixels(const std::string &fileName);
+
+    // anything to correct
+    bool Ready() const;
+    bool HasDark() const;
+    bool HasFlat() const;
+    int BadPixels() const;
+
+    // in place, for a frame read out at offsetX, offsetY on the sensor
+    void Apply(unsigned char *pixels, int width, int height, int offsetX, int offsetY) const;
+    // frames of 10 or 12 bits, one word per pixel
+    void Apply(uint16_t *pixels, int width, int height, int offsetX, int offsetY, int bits) const;
+
+private:
+    int ReadImage(const std::string &fileName, std::vector<float> &values, int &bits);
+    void SortBadPixels();
+
+    int lWidth, lHeight;
+    bool lHaveDark, lHaveFlat;
+    std::vector<unsigned char> lDark8;
+    std::vector<uint16_t> lDark12;
+    std::vector<uint16_t> lGain;
+    std::vector<int> lBad;
+};
+
+#endif
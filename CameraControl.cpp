@@ -0,0 +1,457 @@
+#include "CameraControl.hpp"
+
+#include <iostream>
+#include <errno.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <sys/resource.h>
+#include <sys/syscall.h>
+
+#define POLL_NICE 10    // the poller yields to acquisition and saving
+#define EXPOSURE_TOLERANCE 100  // usec, long exposures land near, not on, the request
+
+ParameterChange::ParameterChange(Parameter parameter, int value)
+    : lParameter(parameter)
+    , lRequested(value)
+    , lState(PENDING)
+    , lApplied(0)
+{
+    pthread_mutex_init(&lMutex, NULL);
+    pthread_cond_init(&lDone, NULL);
+}
+
+ParameterChange::ParameterChange(const cv::Rect &window)
+    : lParameter(READOUT_WINDOW)
+    , lRequested(0)
+    , lRequestedWindow(window)
+    , lState(PENDING)
+    , lApplied(0)
+{
+    pthread_mutex_init(&lMutex, NULL);
+    pthread_cond_init(&lDone, NULL);
+}
+
+ParameterChange::~ParameterChange()
+{
+    pthread_cond_destroy(&lDone);
+    pthread_mutex_destroy(&lMutex);
+}
+
+ParameterChange::State ParameterChange::GetState()
+{
+    pthread_mutex_lock(&lMutex);
+    State state = lState;
+    pthread_mutex_unlock(&lMutex);
+    return state;
+}
+
+bool ParameterChange::IsDone()
+{
+    return GetState() != PENDING;
+}
+
+int ParameterChange::Applied()
+{
+    pthread_mutex_lock(&lMutex);
+    int applied = lApplied;
+    pthread_mutex_unlock(&lMutex);
+    return applied;
+}
+
+cv::Rect ParameterChange::AppliedWindow()
+{
+    pthread_mutex_lock(&lMutex);
+    cv::Rect window = lAppliedWindow;
+    pthread_mutex_unlock(&lMutex);
+    return window;
+}
+
+int ParameterChange::Wait(int timeout)
+{
+    timespec deadline;
+    clock_gettime(CLOCK_REALTIME, &deadline);
+    deadline.tv_sec += timeout / 1000;
+    deadline.tv_nsec += (timeout % 1000) * 1000000L;
+    if (deadline.tv_nsec >= 1000000000L)
+    {
+        deadline.tv_sec++;
+        deadline.tv_nsec -= 1000000000L;
+    }
+
+    pthread_mutex_lock(&lMutex);
+    while (lState == PENDING)
+    {
+        if (pthread_cond_timedwait(&lDone, &lMutex, &deadline) == ETIMEDOUT)
+        {
+            break;
+        }
+    }
+    State state = lState;
+    pthread_mutex_unlock(&lMutex);
+    return (state == APPLIED) ? 0 : -1;
+}
+
+void ParameterChange::Complete(State state, int applied, const cv::Rect &window)
+{
+    pthread_mutex_lock(&lMutex);
+    lState = state;
+    lApplied = applied;
+    lAppliedWindow = window;
+    pthread_cond_broadcast(&lDone);
+    pthread_mutex_unlock(&lMutex);
+}
+
+CameraControl::CameraControl(FrameSource *source)
+    : lSource(source)
+    , lPeriod(1000)
+    , lRunning(false)
+    , lOutstanding(0)
+{
+    lSettled.tv_sec = lSettled.tv_nsec = 0;
+    pthread_mutex_init(&lMutex, NULL);
+    pthread_mutex_init(&lSourceMutex, NULL);
+    pthread_cond_init(&lWake, NULL);
+}
+
+CameraControl::~CameraControl()
+{
+    Stop();
+    pthread_cond_destroy(&lWake);
+    pthread_mutex_destroy(&lSourceMutex);
+    pthread_mutex_destroy(&lMutex);
+}
+
+int CameraControl::Start(int period, const pthread_attr_t *attr)
+{
+    SetPeriod(period);
+    // have something valid before the first frame comes in
+    Refresh();
+
+    pthread_mutex_lock(&lMutex);
+    if (lRunning)
+    {
+        pthread_mutex_unlock(&lMutex);
+        return 0;
+    }
+    lRunning = true;
+    pthread_mutex_unlock(&lMutex);
+
+    int rc = pthread_create(&lThread, attr, PollThread, this);
+    if (rc != 0 && attr != NULL)
+    {
+        // e.g. no permission for real-time scheduling, poll anyway
+        std::cerr << "CameraControl::Start thread attributes refused (" << rc << "), using defaults" << std::endl;
+        rc = pthread_create(&lThread, NULL, PollThread, this);
+    }
+    if (rc != 0)
+    {
+        std::cerr << "CameraControl::Start pthread_create returned " << rc << std::endl;
+        pthread_mutex_lock(&lMutex);
+        lRunning = false;
+        pthread_mutex_unlock(&lMutex);
+        return -1;
+    }
+    return 0;
+}
+
+void CameraControl::Stop()
+{
+    pthread_mutex_lock(&lMutex);
+    if (!lRunning)
+    {
+        pthread_mutex_unlock(&lMutex);
+        return;
+    }
+    lRunning = false;
+    pthread_cond_signal(&lWake);
+    pthread_mutex_unlock(&lMutex);
+    pthread_join(lThread, NULL);
+
+    // nothing will apply what is still queued
+    pthread_mutex_lock(&lMutex);
+    while (!lChanges.empty())
+    {
+        lChanges.front()->Complete(ParameterChange::FAILED, 0);
+        lChanges.pop_front();
+        lOutstanding--;
+    }
+    if (lWindow)
+    {
+        lWindow->Complete(ParameterChange::FAILED, 0);
+        lWindow.reset();
+        lOutstanding--;
+    }
+    pthread_mutex_unlock(&lMutex);
+}
+
+void CameraControl::SetPeriod(int period)
+{
+    pthread_mutex_lock(&lMutex);
+    lPeriod = period > 10 ? period : 10;
+    pthread_cond_signal(&lWake);
+    pthread_mutex_unlock(&lMutex);
+}
+
+CameraSnapshot CameraControl::Get()
+{
+    pthread_mutex_lock(&lMutex);
+    CameraSnapshot snapshot = lSnapshot;
+    pthread_mutex_unlock(&lMutex);
+    return snapshot;
+}
+
+void CameraControl::Refresh()
+{
+    // talk to the camera without holding the snapshot lock
+    CameraSnapshot fresh;
+    pthread_mutex_lock(&lSourceMutex);
+    // first, while the link is quiet, for the fit of frame times
+    lSource->SyncClock();
+    fresh.exposure = lSource->GetExposure();
+    fresh.analogGain = lSource->GetAnalogGain();
+    fresh.preampGain = lSource->GetPreAmpGain();
+    fresh.blackLevel = lSource->GetBlackLevel();
+    fresh.temperature = lSource->getTemperature();
+    pthread_mutex_unlock(&lSourceMutex);
+    clock_gettime(CLOCK_MONOTONIC, &fresh.updated);
+
+    pthread_mutex_lock(&lMutex);
+    fresh.polls = lSnapshot.polls + 1;
+    lSnapshot = fresh;
+    pthread_mutex_unlock(&lMutex);
+}
+
+void *CameraControl::PollThread(void *arg)
+{
+    CameraControl *control = (CameraControl *)arg;
+    // nice value of this thread only (Linux threads have their own)
+    setpriority(PRIO_PROCESS, syscall(SYS_gettid), POLL_NICE);
+    control->Poll();
+    return NULL;
+}
+
+void CameraControl::Poll()
+{
+    pthread_mutex_lock(&lMutex);
+    timespec deadline;
+    bool refresh = true;
+    while (lRunning)
+    {
+        // changes go ahead of the periodic refresh
+        if (!lChanges.empty())
+        {
+            ParameterChangeHandle change = lChanges.front();
+            lChanges.pop_front();
+            pthread_mutex_unlock(&lMutex);
+            Apply(change);
+            pthread_mutex_lock(&lMutex);
+            continue;
+        }
+
+        if (refresh)
+        {
+            clock_gettime(CLOCK_REALTIME, &deadline);
+            deadline.tv_sec += lPeriod / 1000;
+            deadline.tv_nsec += (lPeriod % 1000) * 1000000L;
+            if (deadline.tv_nsec >= 1000000000L)
+            {
+                deadline.tv_sec++;
+                deadline.tv_nsec -= 1000000000L;
+            }
+            refresh = false;
+        }
+        int rc = pthread_cond_timedwait(&lWake, &lMutex, &deadline);
+        if (!lRunning)
+        {
+            break;
+        }
+        if (rc == ETIMEDOUT)
+        {
+            pthread_mutex_unlock(&lMutex);
+            Refresh();
+            pthread_mutex_lock(&lMutex);
+            refresh = true;
+        }
+    }
+    pthread_mutex_unlock(&lMutex);
+}
+
+ParameterChangeHandle CameraControl::Request(ParameterChange::Parameter parameter, int value)
+{
+    return Queue(std::make_shared<ParameterChange>(parameter, value));
+}
+
+ParameterChangeHandle CameraControl::Queue(ParameterChangeHandle change)
+{
+    pthread_mutex_lock(&lMutex);
+    // only the newest request for a parameter is worth applying
+    for (std::deque<ParameterChangeHandle>::iterator it = lChanges.begin(); it != lChanges.end(); )
+    {
+        if ((*it)->GetParameter() == change->GetParameter())
+        {
+            (*it)->Complete(ParameterChange::SUPERSEDED, 0);
+            it = lChanges.erase(it);
+            lOutstanding--;
+        }
+        else
+        {
+            ++it;
+        }
+    }
+    lOutstanding++;
+    bool running = lRunning;
+    if (running)
+    {
+        lChanges.push_back(change);
+        pthread_cond_signal(&lWake);
+    }
+    pthread_mutex_unlock(&lMutex);
+
+    // without the control thread the caller has to do the work
+    if (!running)
+    {
+        Apply(change);
+    }
+    return change;
+}
+
+ParameterChangeHandle CameraControl::SetExposure(int exposureTime)
+{
+    return Request(ParameterChange::EXPOSURE, exposureTime);
+}
+
+ParameterChangeHandle CameraControl::SetAnalogGain(int gain)
+{
+    return Request(ParameterChange::ANALOG_GAIN, gain);
+}
+
+ParameterChangeHandle CameraControl::SetPreAmpGain(int gain)
+{
+    return Request(ParameterChange::PREAMP_GAIN, gain);
+}
+
+ParameterChangeHandle CameraControl::SetBlackLevel(int black)
+{
+    return Request(ParameterChange::BLACK_LEVEL, black);
+}
+
+ParameterChangeHandle CameraControl::SetROI(const cv::Rect &roi)
+{
+    ParameterChangeHandle change = std::make_shared<ParameterChange>(roi);
+    pthread_mutex_lock(&lMutex);
+    if (lWindow)
+    {
+        lWindow->Complete(ParameterChange::SUPERSEDED, 0);
+        lOutstanding--;
+    }
+    lWindow = change;
+    lOutstanding++;
+    pthread_mutex_unlock(&lMutex);
+    return change;
+}
+
+bool CameraControl::ApplyWindow()
+{
+    pthread_mutex_lock(&lMutex);
+    ParameterChangeHandle change = lWindow;
+    lWindow.reset();
+    pthread_mutex_unlock(&lMutex);
+    if (!change)
+    {
+        return false;
+    }
+    Apply(change);
+    return true;
+}
+
+void CameraControl::Apply(ParameterChangeHandle change)
+{
+    int value = change->Requested();
+    int result = -1, readBack = 0;
+    cv::Rect window;
+    bool verified = false;
+
+    // set, then read back to verify, in one control transaction
+    pthread_mutex_lock(&lSourceMutex);
+    switch (change->GetParameter())
+    {
+    case ParameterChange::EXPOSURE:
+        result = lSource->SetExposure(value);
+        readBack = lSource->GetExposure();
+        verified = abs(readBack - value) <= EXPOSURE_TOLERANCE;
+        break;
+    case ParameterChange::ANALOG_GAIN:
+        result = lSource->SetAnalogGain(value);
+        readBack = lSource->GetAnalogGain();
+        verified = readBack == value;
+        break;
+    case ParameterChange::PREAMP_GAIN:
+        result = lSource->SetPreAmpGain(value);
+        readBack = lSource->GetPreAmpGain();
+        verified = readBack == value;
+        break;
+    case ParameterChange::BLACK_LEVEL:
+        result = lSource->SetBlackLevel(value);
+        readBack = lSource->GetBlackLevel();
+        verified = readBack == value;
+        break;
+    case ParameterChange::READOUT_WINDOW:
+        result = lSource->SetROI(change->RequestedWindow());
+        window = lSource->GetROI();
+        verified = window == change->RequestedWindow();
+        break;
+    }
+    pthread_mutex_unlock(&lSourceMutex);
+
+    timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    bool applied = (result == 0) && verified;
+
+    pthread_mutex_lock(&lMutex);
+    lOutstanding--;
+    // even a failed set may have changed something, so frames up to
+    // now are suspect either way
+    lSettled = now;
+    switch (change->GetParameter())
+    {
+    case ParameterChange::EXPOSURE:
+        lSnapshot.exposure = readBack;
+        break;
+    case ParameterChange::ANALOG_GAIN:
+        lSnapshot.analogGain = readBack;
+        break;
+    case ParameterChange::PREAMP_GAIN:
+        lSnapshot.preampGain = readBack;
+        break;
+    case ParameterChange::BLACK_LEVEL:
+        lSnapshot.blackLevel = readBack;
+        break;
+    case ParameterChange::READOUT_WINDOW:
+        break;
+    }
+    pthread_mutex_unlock(&lMutex);
+
+    if (!applied && change->GetParameter() == ParameterChange::READOUT_WINDOW)
+    {
+        const cv::Rect &requested = change->RequestedWindow();
+        std::cerr << "CameraControl::Apply readout window requested " << requested.width << "x" << requested.height
+                  << "+" << requested.x << "+" << requested.y << ", camera reports " << window.width << "x"
+                  << window.height << "+" << window.x << "+" << window.y << std::endl;
+    }
+    else if (!applied)
+    {
+        std::cerr << "CameraControl::Apply parameter " << change->GetParameter() << " requested "
+                  << value << ", camera reports " << readBack << std::endl;
+    }
+    change->Complete(applied ? ParameterChange::APPLIED : ParameterChange::FAILED, readBack, window);
+}
+
+bool CameraControl::IsSettled(const timespec &captureTimeMono)
+{
+    pthread_mutex_lock(&lMutex);
+    bool settled = (lOutstanding == 0) &&
+        (captureTimeMono.tv_sec > lSettled.tv_sec ||
+         (captureTimeMono.tv_sec == lSettled.tv_sec && captureTimeMono.tv_nsec > lSettled.tv_nsec));
+    pthread_mutex_unlock(&lMutex);
+    return settled;
+}
@@ -0,0 +1,148 @@
+#ifndef _CAMERACONTROL_HPP_
+#define _CAMERACONTROL_HPP_
+
+#include "FrameSource.hpp"
+
+#include <pthread.h>
+#include <ctime>
+#include <deque>
+#include <memory>
+
+// Last known camera parameters, as read back from the camera
+struct CameraSnapshot
+{
+    CameraSnapshot(): exposure(0),
+                      analogGain(0),
+                      preampGain(0),
+                      blackLevel(0),
+                      temperature(0),
+                      polls(0)
+    {
+        updated.tv_sec = updated.tv_nsec = 0;
+    };
+    int exposure;
+    int analogGain;
+    int preampGain;
+    int blackLevel;
+    float temperature;
+    long polls;
+    timespec updated;   // CLOCK_MONOTONIC of the last refresh
+};
+
+/* Completion handle for a parameter change queued on CameraControl.
+   The change is applied and read back on the control thread; the caller
+   can poll the state or wait for it with a timeout.
+*/
+class ParameterChange
+{
+public:
+    enum Parameter { EXPOSURE, ANALOG_GAIN, PREAMP_GAIN, BLACK_LEVEL, READOUT_WINDOW };
+    enum State { PENDING, APPLIED, FAILED, SUPERSEDED };
+
+    ParameterChange(Parameter parameter, int value);
+    // a READOUT_WINDOW change
+    ParameterChange(const cv::Rect &window);
+    ~ParameterChange();
+
+    Parameter GetParameter() const { return lParameter; }
+    int Requested() const { return lRequested; }
+    const cv::Rect &RequestedWindow() const { return lRequestedWindow; }
+    State GetState();
+    bool IsDone();
+    // value read back from the camera once applied
+    int Applied();
+    cv::Rect AppliedWindow();
+    // wait up to timeout ms, returns 0 once applied, -1 otherwise
+    int Wait(int timeout);
+
+private:
+    friend class CameraControl;
+    void Complete(State state, int applied, const cv::Rect &window = cv::Rect());
+
+    Parameter lParameter;
+    int lRequested;
+    cv::Rect lRequestedWindow;
+    State lState;
+    int lApplied;
+    cv::Rect lAppliedWindow;
+    pthread_mutex_t lMutex;
+    pthread_cond_t lDone;
+};
+
+typedef std::shared_ptr<ParameterChange> ParameterChangeHandle;
+
+/* Owns the slow control-channel traffic to a camera. A low-priority
+   thread re-reads the parameters at a configurable period, so the
+   acquisition loop and the header fill only copy a local snapshot
+   instead of doing a GenICam round trip per frame. Each poll also takes
+   a sample of the device clock (SyncClock) for the source's frame times.
+   The same thread applies parameter changes: Set*() queue the change and
+   return a handle straight away, and frames exposed before the change has
+   been verified can be recognized with IsSettled().
+*/
+class CameraControl
+{
+public:
+    CameraControl(FrameSource *source);
+    ~CameraControl();
+
+    /* period in milliseconds, attr for the thread or NULL for the defaults
+       returns 0 on success, -1 otherwise
+    */
+    int Start(int period, const pthread_attr_t *attr = NULL);
+    void Stop();
+    void SetPeriod(int period);
+
+    CameraSnapshot Get();
+    // synchronous poll, from the calling thread
+    void Refresh();
+
+    /* Asynchronous changes, a newer request for the same parameter
+       supersedes one that has not been applied yet
+    */
+    ParameterChangeHandle Request(ParameterChange::Parameter parameter, int value);
+    ParameterChangeHandle SetExposure(int exposureTime);
+    ParameterChangeHandle SetAnalogGain(int gain);
+    ParameterChangeHandle SetPreAmpGain(int gain);
+    ParameterChangeHandle SetBlackLevel(int black);
+
+    // false while a change is outstanding, or for frames exposed (CLOCK_MONOTONIC)
+    // before the last change was verified
+    bool IsSettled(const timespec &captureTimeMono);
+
+    /* Readout window change. The camera restarts acquisition with the new
+       window and may resize the pipeline, which can't happen under a
+       Retrieve() or a held lease, so the control thread never applies it:
+       it waits here until the acquisition thread calls ApplyWindow()
+       between frames, with every lease dropped
+    */
+    ParameterChangeHandle SetROI(const cv::Rect &roi);
+    // applies a waiting window change, returns true if there was one
+    bool ApplyWindow();
+
+private:
+    CameraControl(const CameraControl &);
+    CameraControl &operator=(const CameraControl &);
+
+    ParameterChangeHandle Queue(ParameterChangeHandle change);
+
+    static void *PollThread(void *arg);
+    void Poll();
+    void Apply(ParameterChangeHandle change);
+
+    FrameSource *lSource;
+    CameraSnapshot lSnapshot;
+    int lPeriod;
+    bool lRunning;
+    pthread_t lThread;
+    pthread_mutex_t lMutex;     // guards the snapshot and the flags
+    pthread_mutex_t lSourceMutex;   // one control transaction at a time
+    pthread_cond_t lWake;
+
+    std::deque<ParameterChangeHandle> lChanges;
+    ParameterChangeHandle lWindow;  // waiting for ApplyWindow()
+    int lOutstanding;           // queued or being applied
+    timespec lSettled;          // CLOCK_MONOTONIC when the last change was verified
+};
+
+#endif
@@ -0,0 +1,162 @@
+#include "CameraManager.hpp"
+#include "ImperxStream.hpp"
+
+#include <iostream>
+#include <fstream>
+#include <sstream>
+
+#define CAMERA_MAX_WIDTH    1296    // display buffers are sized for full frames
+#define CAMERA_MAX_HEIGHT   966
+#define SAVE_PREFIX "FOXSI_SAAS"
+
+CameraContext::CameraContext(int id, const std::string &name, const std::string &address,
+                             const CameraSettings &settings)
+    : id(id)
+    , name(name)
+    , address(address)
+    , settings(settings)
+    , source(NULL)
+    , control(NULL)
+    , display(CAMERA_MAX_WIDTH, CAMERA_MAX_HEIGHT)
+    , saveRequested(false)
+    , serialNumber(0)
+    , frameCount(0)
+    , saveCount(0)
+    , temperature(0)
+    , reconnects(0)
+    , timeToFirstFrame(0)
+{
+    pthread_mutex_init(&healthMutex, NULL);
+    pthread_mutex_init(&controlMutex, NULL);
+    savePrefix = name.empty() ? SAVE_PREFIX : SAVE_PREFIX "_" + name;
+    captureTime.tv_sec = captureTime.tv_nsec = 0;
+    captureTimeMono.tv_sec = captureTimeMono.tv_nsec = 0;
+}
+
+CameraContext::~CameraContext()
+{
+    pthread_mutex_destroy(&controlMutex);
+    pthread_mutex_destroy(&healthMutex);
+}
+
+CameraManager::CameraManager()
+{
+}
+
+CameraManager::~CameraManager()
+{
+    for (size_t i = 0; i < lCameras.size(); i++)
+    {
+        delete lCameras[i];
+    }
+}
+
+int CameraManager::LoadBindings(const char *fileName, const CameraSettings &defaults)
+{
+    std::ifstream file(fileName);
+    if (!file.is_open())
+    {
+        return -1;
+    }
+
+    int bound = 0;
+    std::string line;
+    while (std::getline(file, line))
+    {
+        line = line.substr(0, line.find('#'));
+        std::istringstream fields(line);
+        std::string name, address;
+        if (!(fields >> name >> address))
+        {
+            continue;
+        }
+
+        CameraSettings settings = defaults;
+        int exposure, analogGain, preampGain, blackLevel;
+        if (fields >> exposure >> analogGain >> preampGain >> blackLevel)
+        {
+            settings.exposure = exposure;
+            settings.analogGain = analogGain;
+            settings.preampGain = preampGain;
+            settings.blackLevel = blackLevel;
+        }
+        AddCamera(name, address, settings);
+        bound++;
+    }
+    return bound;
+}
+
+int CameraManager::AddCamera(const std::string &name, const std::string &address,
+                             const CameraSettings &settings)
+{
+    int id = lCameras.size();
+    lCameras.push_back(new CameraContext(id, name, address, settings));
+    std::cout << "CameraManager::AddCamera camera " << id << " " << name
+              << " bound to " << (address.empty() ? "any" : address) << std::endl;
+    return id;
+}
+
+int CameraManager::Discover(const CameraSettings &defaults)
+{
+    std::vector<DeviceIdentity> devices;
+    int found = ImperxStream::Discover(devices);
+    if (found < 0)
+    {
+        return -1;
+    }
+
+    for (size_t i = 0; i < devices.size(); i++)
+    {
+        std::cout << "CameraManager::Discover found " << devices[i].serial
+                  << " at " << devices[i].ip << " (" << devices[i].mac << ")" << std::endl;
+    }
+
+    if (lCameras.empty())
+    {
+        for (size_t i = 0; i < devices.size(); i++)
+        {
+            std::ostringstream name;
+            name << "CAM" << i;
+            AddCamera(name.str(), devices[i].serial, defaults);
+        }
+        return found;
+    }
+
+    // a missing camera is not fatal, its thread keeps looking for it
+    for (size_t c = 0; c < lCameras.size(); c++)
+    {
+        const std::string &address = lCameras[c]->address;
+        if (address.empty() || address == SYNTHETIC_ADDRESS)
+        {
+            continue;
+        }
+        bool present = false;
+        for (size_t i = 0; i < devices.size(); i++)
+        {
+            if (address == devices[i].ip || address == devices[i].mac || address == devices[i].serial)
+            {
+                present = true;
+            }
+        }
+        if (!present)
+        {
+            std::cout << "CameraManager::Discover no camera at " << address
+                      << " for " << lCameras[c]->name << std::endl;
+        }
+    }
+    return found;
+}
+
+int CameraManager::Count() const
+{
+    return lCameras.size();
+}
+
+CameraContext *CameraManager::Get(int id)
+{
+    if (id < 0 || id >= (int)lCameras.size())
+    {
+        return NULL;
+    }
+    return lCameras[id];
+}
@@ -0,0 +1,94 @@
+#ifndef _CAMERAMANAGER_HPP_
+#define _CAMERAMANAGER_HPP_
+
+#include "FrameSource.hpp"
+#include "FrameExchange.hpp"
+#include "CameraControl.hpp"
+#include "Centroid.hpp"
+#include "LimbFit.hpp"
+
+#include <pthread.h>
+#include <atomic>
+#include <ctime>
+#include <string>
+#include <vector>
+
+#define SYNTHETIC_ADDRESS "synthetic"   // binding address for a generated camera
+
+/* Everything that belongs to one camera: its binding, settings, the
+   source and control thread while it is running, the display handoff,
+   what to save and the counters that go into headers.
+   Written by that camera's acquisition thread, read by everyone else.
+*/
+struct CameraContext
+{
+    CameraContext(int id, const std::string &name, const std::string &address,
+                  const CameraSettings &settings);
+    ~CameraContext();
+
+    int id;
+    std::string name;           // e.g. PYAS or RAS, empty for an unnamed camera
+    std::string address;        // IP, MAC, serial number, SYNTHETIC_ADDRESS or empty for any
+    CameraSettings settings;
+
+    FrameSource *source;        // NULL while the camera thread is not running
+    CameraControl *control;     // NULL until the camera is streaming, under controlMutex
+    pthread_mutex_t controlMutex;   // held by other threads while they use control
+
+    FrameExchange display;      // newest frame for the display
+
+    // frames are copied into a writer pool job by the acquisition thread
+    std::atomic<bool> saveRequested;    // save the next frame regardless of mod_save, set by the display
+    std::string savePrefix;     // file names start with this
+
+    int serialNumber;
+    long frameCount;
+    long saveCount;             // frames handed to the writers
+    timespec captureTime, captureTimeMono;
+    float temperature;
+    StreamHealthReport health; // refreshed once a second, under healthMutex
+    CentroidResult centroid;    // where the Sun is in the newest frame, under healthMutex
+    LimbFitResult limb;         // the same from its limb, under healthMutex
+    pthread_mutex_t healthMutex;
+    int reconnects;
+    double timeToFirstFrame;    // ms from the last frame before the camera was lost (or starting) to the next frame
+
+private:
+    CameraContext(const CameraContext &);
+    CameraContext &operator=(const CameraContext &);
+};
+
+/* Owns one CameraContext per camera. Cameras are bound by name to an
+   address from a bindings file, or, without one, every camera found on
+   the network is bound by its serial number. Each context is then run
+   by its own acquisition thread.
+*/
+class CameraManager
+{
+public:
+    CameraManager();
+    ~CameraManager();
+
+    /* Bindings file, one camera per line, # starts a comment
+         name address [exposure analogGain preampGain blackLevel]
+       the settings default to the given ones
+       returns the number of cameras bound, -1 if the file can't be read
+    */
+    int LoadBindings(const char *fileName, const CameraSettings &defaults);
+    int AddCamera(const std::string &name, const std::string &address,
+                  const CameraSettings &settings);
+
+    /* Looks for GigE cameras and reports bindings with no camera behind
+       them; with no bindings yet, binds every camera found
+       returns the number of cameras found, -1 on error
+    */
+    int Discover(const CameraSettings &defaults);
+
+    int Count() const;
+    CameraContext *Get(int id);
+
+private:
+    std::vector<CameraContext *> lCameras;
+};
+
+#endif
@@ -0,0 +1,159 @@
+#include "Centroid.hpp"
+
+#include <algorithm>
+#include <stdint.h>
+
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+
+#define CENTROID_STEP           4       // rows looked at for the sky and peak levels
+#define CENTROID_MIN_CONTRAST   32      // DN between sky and disk
+
+namespace
+{
+    /* Sums of w and x*w over one row, w = max(v - threshold, 0)
+       16 pixels at a time: the saturating subtract gives w, SAD adds
+       the bytes and madd the products against the x coordinates. A row
+       of 1296 pixels can't overflow the 32-bit lanes (255 * 1295 * 1296)
+    */
+    void RowSums(const unsigned char *row, int width, int threshold,
+                 long long &mass, long long &moment, long &count)
+    {
+        int x = 0;
+        long long rowMass = 0, rowMoment = 0;
+        long rowCount = 0;
+#ifdef __SSE2__
+        const __m128i zero = _mm_setzero_si128();
+        const __m128i level = _mm_set1_epi8((char)threshold);
+        const __m128i eight = _mm_set1_epi16(8);
+        const __m128i sixteen = _mm_set1_epi16(16);
+        __m128i index = _mm_setr_epi16(0, 1, 2, 3, 4, 5, 6, 7);
+        __m128i masses = zero, moments = zero, counts = zero;
+        for (; x + 16 <= width; x += 16)
+        {
+            __m128i w = _mm_subs_epu8(_mm_loadu_si128((const __m128i *)(row + x)), level);
+            masses = _mm_add_epi64(masses, _mm_sad_epu8(w, zero));
+            __m128i above = _mm_andnot_si128(_mm_cmpeq_epi8(w, zero), _mm_set1_epi8(1));
+            counts = _mm_add_epi64(counts, _mm_sad_epu8(above, zero));
+            moments = _mm_add_epi32(moments, _mm_madd_epi16(_mm_unpacklo_epi8(w, zero), index));
+            moments = _mm_add_epi32(moments, _mm_madd_epi16(_mm_unpackhi_epi8(w, zero),
+                                                            _mm_add_epi16(index, eight)));
+            index = _mm_add_epi16(index, sixteen);
+        }
+        int32_t m[4];
+        int64_t s[2], c[2];
+        _mm_storeu_si128((__m128i *)m, moments);
+        _mm_storeu_si128((__m128i *)s, masses);
+        _mm_storeu_si128((__m128i *)c, counts);
+        rowMoment = (long long)m[0] + m[1] + m[2] + m[3];
+        rowMass = s[0] + s[1];
+        rowCount = c[0] + c[1];
+#endif
+        for (; x < width; x++)
+        {
+            int w = row[x] - threshold;
+            if (w > 0)
+            {
+                rowMass += w;
+                rowMoment += (long long)w * x;
+                rowCount++;
+            }
+        }
+        mass = rowMass;
+        moment = rowMoment;
+        count = rowCount;
+    }
+}
+
+Centroid::Centroid()
+    : lThresholdFraction(0.25)
+    , lMinPixels(1250)      // a disk of about 20 pixels radius
+{
+}
+
+void Centroid::SetThresholdFraction(double fraction)
+{
+    lThresholdFraction = std::min(std::max(fraction, 0.0), 1.0);
+}
+
+void Centroid::SetMinPixels(long pixels)
+{
+    lMinPixels = std::max(pixels, 1L);
+}
+
+int Centroid::Threshold(const unsigned char *pixels, int width, int height)
+{
+    // the sky is the darkest and the disk center the brightest of every
+    // 4th row, whole rows so the vector min/max does the work
+    int low = 255, high = 0;
+    for (int y = 0; y < height; y += CENTROID_STEP)
+    {
+        const unsigned char *row = pixels + (size_t)y * width;
+        int x = 0;
+#ifdef __SSE2__
+        __m128i rowLow = _mm_set1_epi8((char)0xff), rowHigh = _mm_setzero_si128();
+        for (; x + 16 <= width; x += 16)
+        {
+            __m128i v = _mm_loadu_si128((const __m128i *)(row + x));
+            rowLow = _mm_min_epu8(rowLow, v);
+            rowHigh = _mm_max_epu8(rowHigh, v);
+        }
+        unsigned char lows[16], highs[16];
+        _mm_storeu_si128((__m128i *)lows, rowLow);
+        _mm_storeu_si128((__m128i *)highs, rowHigh);
+        low = std::min(low, (int)*std::min_element(lows, lows + 16));
+        high = std::max(high, (int)*std::max_element(highs, highs + 16));
+#endif
+        for (; x < width; x++)
+        {
+            low = std::min(low, (int)row[x]);
+            high = std::max(high, (int)row[x]);
+        }
+    }
+    if (high - low < CENTROID_MIN_CONTRAST)
+    {
+        return -1;
+    }
+    return low + (int)(lThresholdFraction * (high - low));
+}
+
+bool Centroid::Measure(const unsigned char *pixels, int width, int height,
+                       int offsetX, int offsetY, CentroidResult &result)
+{
+    result = CentroidResult();
+    if (pixels == NULL || width <= 0 || height <= 0)
+    {
+        return false;
+    }
+    int threshold = Threshold(pixels, width, height);
+    if (threshold < 0)
+    {
+        return false;
+    }
+    result.threshold = threshold;
+
+    long long mass = 0, momentX = 0, momentY = 0;
+    long count = 0;
+    for (int y = 0; y < height; y++)
+    {
+        long long rowMass, rowMoment;
+        long rowCount;
+        RowSums(pixels + (size_t)y * width, width, threshold, rowMass, rowMoment, rowCount);
+        mass += rowMass;
+        momentX += rowMoment;
+        momentY += rowMass * y;
+        count += rowCount;
+    }
+    result.pixels = count;
+    result.mass = (double)mass;
+    if (count < lMinPixels || mass == 0)
+    {
+        return false;
+    }
+
+    result.x = offsetX + (double)momentX / mass;
+    result.y = offsetY + (double)momentY / mass;
+    result.found = true;
+    return true;
+}
@@ -0,0 +1,49 @@
+#ifndef _CENTROID_HPP_
+#define _CENTROID_HPP_
+
+#include <stddef.h>
+
+// Where the disk is on the sensor, from one frame
+struct CentroidResult
+{
+    CentroidResult(): found(false),
+                      x(0),
+                      y(0),
+                      pixels(0),
+                      mass(0),
+                      threshold(0) {};
+    bool found;
+    double x, y;        // sensor pixels, readout window offset included
+    long pixels;        // above the threshold
+    double mass;        // summed weight, DN above the threshold
+    int threshold;      // DN on the 0-255 scale
+};
+
+/* Intensity-weighted centroid of the solar disk. Pixels count with
+   their level above a threshold, placed a fraction of the way from the
+   sky to the brightest pixels, so the sky adds nothing and the limb
+   fades in instead of clipping. Row sums use SSE2 when built with it.
+   Works on 8-bit frames, e.g. the display copy of a deeper frame.
+*/
+class Centroid
+{
+public:
+    Centroid();
+
+    // threshold between sky (0) and the brightest pixels (1)
+    void SetThresholdFraction(double fraction);
+    // fewer pixels above the threshold than this is no disk
+    void SetMinPixels(long pixels);
+
+    // returns true and fills result when a disk is found
+    bool Measure(const unsigned char *pixels, int width, int height,
+                 int offsetX, int offsetY, CentroidResult &result);
+
+private:
+    int Threshold(const unsigned char *pixels, int width, int height);
+
+    double lThresholdFraction;
+    long lMinPixels;
+};
+
+#endif
@@ -0,0 +1,149 @@
+#include "ClockFit.hpp"
+
+#define CLOCKFIT_MIN_SAMPLES 16
+#define CLOCKFIT_ENVELOPE    0.2     // fraction of the delay spread kept for the refit
+
+ClockFit::ClockFit(int window)
+    : lWindow(window)
+    , lNominal(1e9)
+{
+    Reset();
+}
+
+void ClockFit::Reset()
+{
+    lHaveReference = false;
+    lTicks.assign(lWindow, 0.0);
+    lHost.assign(lWindow, 0.0);
+    lNext = 0;
+    lCount = 0;
+    lLastTicks = 0;
+    lSlope = 1e9 / lNominal;
+    lOffset = 0.0;
+    lSpread = 0.0;
+}
+
+void ClockFit::SetTickFrequency(double frequency)
+{
+    if (frequency > 0)
+    {
+        lNominal = frequency;
+        if (lCount < CLOCKFIT_MIN_SAMPLES)
+        {
+            lSlope = 1e9 / lNominal;
+        }
+    }
+}
+
+void ClockFit::AddSample(uint64_t ticks, const timespec &host)
+{
+    // a counter that went backwards was reset, start over
+    if (lHaveReference && ticks < lLastTicks)
+    {
+        Reset();
+    }
+    if (!lHaveReference)
+    {
+        lTicks0 = ticks;
+        lHost0 = host;
+        lHaveReference = true;
+    }
+    lLastTicks = ticks;
+
+    lTicks[lNext] = (double)(ticks - lTicks0);
+    lHost[lNext] = (host.tv_sec - lHost0.tv_sec) * 1e9 + (host.tv_nsec - lHost0.tv_nsec);
+    lNext = (lNext + 1) % lWindow;
+    if (lCount < lWindow) lCount++;
+
+    Fit();
+}
+
+void ClockFit::Fit()
+{
+    double slope = lSlope;
+    if (lCount >= CLOCKFIT_MIN_SAMPLES)
+    {
+        // First pass over every sample, then refit using only the fastest
+        // deliveries so the slope follows the envelope, not the mean delay
+        slope = LeastSquares(slope, -1.0);
+        double low = 0, high = 0;
+        Envelope(slope, low, high);
+        slope = LeastSquares(slope, low + CLOCKFIT_ENVELOPE * (high - low));
+    }
+
+    // lower envelope: the least-delayed sample sits on the line
+    double low = 0, high = 0;
+    Envelope(slope, low, high);
+    lSlope = slope;
+    lOffset = low;
+    lSpread = high - low;
+}
+
+double ClockFit::LeastSquares(double slope, double cutoff) const
+{
+    // least squares about the means to keep the sums well conditioned,
+    // a cutoff >= 0 skips samples delayed more than that past the line
+    double meanT = 0, meanH = 0;
+    int n = 0;
+    for (int i = 0; i < lCount; i++)
+    {
+        if (cutoff >= 0 && lHost[i] - slope * lTicks[i] > cutoff) continue;
+        meanT += lTicks[i];
+        meanH += lHost[i];
+        n++;
+    }
+    if (n < 2)
+    {
+        return slope;
+    }
+    meanT /= n;
+    meanH /= n;
+    double stt = 0, sth = 0;
+    for (int i = 0; i < lCount; i++)
+    {
+        if (cutoff >= 0 && lHost[i] - slope * lTicks[i] > cutoff) continue;
+        double dt = lTicks[i] - meanT;
+        stt += dt * dt;
+        sth += dt * (lHost[i] - meanH);
+    }
+    return (stt > 0) ? sth / stt : slope;
+}
+
+void ClockFit::Envelope(double slope, double &low, double &high) const
+{
+    for (int i = 0; i < lCount; i++)
+    {
+        double residual = lHost[i] - slope * lTicks[i];
+        if (i == 0 || residual < low) low = residual;
+        if (i == 0 || residual > high) high = residual;
+    }
+}
+
+timespec ClockFit::ToHost(uint64_t ticks) const
+{
+    timespec host = {0, 0};
+    if (!lHaveReference)
+    {
+        return host;
+    }
+    double ns = lOffset + lSlope * ((double)ticks - (double)lTicks0);
+    long long total = (long long)lHost0.tv_sec * 1000000000LL + lHost0.tv_nsec + (long long)ns;
+    host.tv_sec = total / 1000000000LL;
+    host.tv_nsec = total % 1000000000LL;
+    return host;
+}
+
+bool ClockFit::IsFitted() const
+{
+    return lCount >= CLOCKFIT_MIN_SAMPLES;
+}
+
+double ClockFit::TickFrequency() const
+{
+    return lSlope > 0 ? 1e9 / lSlope : 0.0;
+}
+
+double ClockFit::Spread() const
+{
+    return lSpread;
+}
@@ -0,0 +1,51 @@
+#ifndef _CLOCKFIT_HPP_
+#define _CLOCKFIT_HPP_
+
+#include <ctime>
+#include <vector>
+#include <stdint.h>
+
+/* Running linear fit of a device tick counter to one host clock
+   (CLOCK_REALTIME or CLOCK_MONOTONIC). Each sample pairs a device tick
+   count with the host time at which it was seen, a latched read of the
+   device clock or the delivery of a frame; the host side is always late
+   by a variable latency, so after the least-squares slope is found the
+   line is moved down to the lower envelope of the samples, i.e. the
+   least-delayed ones.
+*/
+class ClockFit
+{
+public:
+    ClockFit(int window = 1024);
+
+    void Reset();
+    // nominal tick rate (Hz), used until there are enough samples to fit
+    void SetTickFrequency(double frequency);
+
+    void AddSample(uint64_t ticks, const timespec &host);
+    timespec ToHost(uint64_t ticks) const;
+
+    bool IsFitted() const;
+    // fitted tick rate (Hz) and spread of delivery delays (ns) in the window
+    double TickFrequency() const;
+    double Spread() const;
+
+private:
+    void Fit();
+    double LeastSquares(double slope, double cutoff) const;
+    void Envelope(double slope, double &low, double &high) const;
+
+    int lWindow;
+    double lNominal;
+    // reference point, samples are stored relative to it to keep precision
+    bool lHaveReference;
+    uint64_t lTicks0;
+    timespec lHost0;
+    std::vector<double> lTicks, lHost;
+    int lNext, lCount;
+    uint64_t lLastTicks;
+    // host = lOffset + lSlope * ticks, in ns relative to the reference
+    double lSlope, lOffset, lSpread;
+};
+
+#endif
@@ -0,0 +1,190 @@
+#include "CoAdd.hpp"
+
+#include <algorithm>
+#include <cmath>
+#include <cstdlib>
+#include <string.h>
+
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+
+#define COADD_MAX_FRAMES    256     // 255 * 256 fits in 16 bits
+
+namespace
+{
+    void AddRow(uint16_t *sum, const unsigned char *row, int width)
+    {
+        int x = 0;
+#ifdef __SSE2__
+        const __m128i zero = _mm_setzero_si128();
+        for (; x + 16 <= width; x += 16)
+        {
+            __m128i v = _mm_loadu_si128((const __m128i *)(row + x));
+            __m128i lo = _mm_loadu_si128((const __m128i *)(sum + x));
+            __m128i hi = _mm_loadu_si128((const __m128i *)(sum + x + 8));
+            _mm_storeu_si128((__m128i *)(sum + x), _mm_add_epi16(lo, _mm_unpacklo_epi8(v, zero)));
+            _mm_storeu_si128((__m128i *)(sum + x + 8), _mm_add_epi16(hi, _mm_unpackhi_epi8(v, zero)));
+        }
+#endif
+        for (; x < width; x++)
+        {
+            sum[x] += row[x];
+        }
+    }
+}
+
+CoAdd::CoAdd(int width, int height)
+    : lFrames(8)
+    , lRegister(true)
+    , lSum((size_t)width * height, 0)
+    , lCount(0)
+    , lWidth(0)
+    , lHeight(0)
+    , lOffsetX(0)
+    , lOffsetY(0)
+    , lHaveReference(false)
+    , lReferenceX(0)
+    , lReferenceY(0)
+    , lMaxShift(0)
+{
+}
+
+void CoAdd::SetFrames(int frames)
+{
+    lFrames = std::min(std::max(frames, 1), COADD_MAX_FRAMES);
+    Reset();
+}
+
+void CoAdd::SetRegistration(bool on)
+{
+    lRegister = on;
+    Reset();
+}
+
+void CoAdd::Reset()
+{
+    lCount = 0;
+}
+
+bool CoAdd::Add(const unsigned char *pixels, int width, int height, int offsetX, int offsetY,
+                const CentroidResult &center)
+{
+    if ((size_t)width * height > lSum.size())
+    {
+        return false;
+    }
+    // a finished run, or a different window, starts again
+    if (lCount >= lFrames || width != lWidth || height != lHeight ||
+        offsetX != lOffsetX || offsetY != lOffsetY)
+    {
+        lCount = 0;
+    }
+    if (lCount == 0)
+    {
+        memset(&lSum[0], 0, (size_t)width * height * sizeof(uint16_t));
+        lWidth = width;
+        lHeight = height;
+        lOffsetX = offsetX;
+        lOffsetY = offsetY;
+        lHaveReference = center.found;
+        lReferenceX = center.x;
+        lReferenceY = center.y;
+        lMaxShift = 0;
+    }
+
+    // sum(x, y) += frame(x + dx, y + dy), a frame without a disk unshifted
+    int dx = 0, dy = 0;
+    if (lRegister && center.found)
+    {
+        if (!lHaveReference)
+        {
+            lHaveReference = true;
+            lReferenceX = center.x;
+            lReferenceY = center.y;
+        }
+        dx = std::min(std::max((int)lround(center.x - lReferenceX), -width), width);
+        dy = std::min(std::max((int)lround(center.y - lReferenceY), -height), height);
+        lMaxShift = std::max(lMaxShift, std::max(abs(dx), abs(dy)));
+    }
+    int firstX = std::max(-dx, 0), lastX = std::min(width, width - dx);
+    int firstY = std::max(-dy, 0), lastY = std::min(height, height - dy);
+    for (int y = firstY; y < lastY; y++)
+    {
+        AddRow(&lSum[(size_t)y * width + firstX], pixels + (size_t)(y + dy) * width + firstX + dx, lastX - firstX);
+    }
+    lCount++;
+    return lCount == lFrames;
+}
+
+int CoAdd::Count() const
+{
+    return lCount;
+}
+
+int CoAdd::Frames() const
+{
+    return lFrames;
+}
+
+const uint16_t *CoAdd::Sum() const
+{
+    return &lSum[0];
+}
+
+int CoAdd::Width() const
+{
+    return lWidth;
+}
+
+int CoAdd::Height() const
+{
+    return lHeight;
+}
+
+int CoAdd::OffsetX() const
+{
+    return lOffsetX;
+}
+
+int CoAdd::OffsetY() const
+{
+    return lOffsetY;
+}
+
+int CoAdd::MaxShift() const
+{
+    return lMaxShift;
+}
+
+void CoAdd::Mean(unsigned char *dst) const
+{
+    size_t count = (size_t)lWidth * lHeight;
+    int frames = std::max(lCount, 1);
+    size_t i = 0;
+#ifdef __SSE2__
+    // n = sum + frames/2, q = n * floor(65536 / frames) >> 16 is the
+    // quotient or one short of it, and the remainder n - q * frames says
+    // which; the same result as the division below
+    const __m128i half = _mm_set1_epi16(frames / 2);
+    const __m128i divisor = _mm_set1_epi16(frames);
+    const __m128i scale = _mm_set1_epi16((short)(65536 / std::max(frames, 2)));
+    for (; frames > 1 && i + 16 <= count; i += 16)
+    {
+        __m128i lo = _mm_adds_epu16(_mm_loadu_si128((const __m128i *)&lSum[i]), half);
+        __m128i hi = _mm_adds_epu16(_mm_loadu_si128((const __m128i *)&lSum[i + 8]), half);
+        __m128i qlo = _mm_mulhi_epu16(lo, scale);
+        __m128i qhi = _mm_mulhi_epu16(hi, scale);
+        // remainders are below 2 * frames, small enough for a signed compare
+        __m128i rlo = _mm_sub_epi16(lo, _mm_mullo_epi16(qlo, divisor));
+        __m128i rhi = _mm_sub_epi16(hi, _mm_mullo_epi16(qhi, divisor));
+        qlo = _mm_sub_epi16(qlo, _mm_cmpgt_epi16(rlo, _mm_sub_epi16(divisor, _mm_set1_epi16(1))));
+        qhi = _mm_sub_epi16(qhi, _mm_cmpgt_epi16(rhi, _mm_sub_epi16(divisor, _mm_set1_epi16(1))));
+        _mm_storeu_si128((__m128i *)(dst + i), _mm_packus_epi16(qlo, qhi));
+    }
+#endif
+    for (; i < count; i++)
+    {
+        dst[i] = std::min((lSum[i] + frames / 2) / frames, 255);
+    }
+}
@@ -0,0 +1,118 @@
+#include "FrameExchange.hpp"
+
+#define FRESH      0x4
+#define INDEX_MASK 0x3
+
+namespace
+{
+    // each level starts on a cache line
+    size_t LevelBytes(int width, int height, int level)
+    {
+        size_t bytes = (size_t)(width >> level) * (height >> level);
+        return (bytes + FRAMEPOOL_ALIGN - 1) / FRAMEPOOL_ALIGN * FRAMEPOOL_ALIGN;
+    }
+}
+
+FrameExchange::FrameExchange(int width, int height)
+    : lWrite(0)
+    , lRead(1)
+    , lMiddle(2)
+{
+    // the previews follow the frame in the same buffer
+    lLevelOffset[0] = 0;
+    for (int level = 1; level < LEVELS; level++)
+    {
+        lLevelOffset[level] = lLevelOffset[level - 1] + LevelBytes(width, height, level - 1);
+    }
+    for (int i = 0; i < 3; i++)
+    {
+        lSlots[i].width = 0;
+        lSlots[i].height = 0;
+        lSlots[i].offsetX = 0;
+        lSlots[i].offsetY = 0;
+        lSlots[i].frameNumber = 0;
+    }
+}
+
+size_t FrameExchange::Bytes(int width, int height)
+{
+    size_t bytes = 0;
+    for (int level = 0; level < LEVELS; level++)
+    {
+        bytes += LevelBytes(width, height, level);
+    }
+    return bytes;
+}
+
+void FrameExchange::SetWriteFrame(const FrameRef &frame)
+{
+    lSlots[lWrite].frame = frame;
+}
+
+const FrameRef &FrameExchange::WriteFrame() const
+{
+    return lSlots[lWrite].frame;
+}
+
+unsigned char *FrameExchange::WriteBuffer(int level)
+{
+    unsigned char *pixels = lSlots[lWrite].frame.data();
+    return pixels != NULL ? pixels + lLevelOffset[level] : NULL;
+}
+
+void FrameExchange::Publish(int width, int height, uint64_t frameNumber, int offsetX, int offsetY)
+{
+    lSlots[lWrite].width = width;
+    lSlots[lWrite].height = height;
+    lSlots[lWrite].offsetX = offsetX;
+    lSlots[lWrite].offsetY = offsetY;
+    lSlots[lWrite].frameNumber = frameNumber;
+    // release makes the pixels visible before the index; whatever was in
+    // the middle (read or not) becomes the next slot to write, and its
+    // buffer goes back to the pool unless someone else still holds it
+    int previous = lMiddle.exchange(lWrite | FRESH, std::memory_order_acq_rel);
+    lWrite = previous & INDEX_MASK;
+    lSlots[lWrite].frame.reset();
+}
+
+bool FrameExchange::Update()
+{
+    if (!(lMiddle.load(std::memory_order_acquire) & FRESH))
+    {
+        return false;
+    }
+    int previous = lMiddle.exchange(lRead, std::memory_order_acq_rel);
+    lRead = previous & INDEX_MASK;
+    return true;
+}
+
+const unsigned char *FrameExchange::ReadBuffer(int level) const
+{
+    const unsigned char *pixels = lSlots[lRead].frame.data();
+    return pixels != NULL ? pixels + lLevelOffset[level] : NULL;
+}
+
+int FrameExchange::ReadWidth(int level) const
+{
+    return lSlots[lRead].width >> level;
+}
+
+int FrameExchange::ReadHeight(int level) const
+{
+    return lSlots[lRead].height >> level;
+}
+
+int FrameExchange::ReadOffsetX() const
+{
+    return lSlots[lRead].offsetX;
+}
+
+int FrameExchange::ReadOffsetY() const
+{
+    return lSlots[lRead].offsetY;
+}
+
+uint64_t FrameExchange::ReadFrameNumber() const
+{
+    return lSlots[lRead].frameNumber;
+}
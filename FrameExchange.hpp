@@ -0,0 +1,71 @@
+#ifndef _FRAMEEXCHANGE_HPP_
+#define _FRAMEEXCHANGE_HPP_
+
+#include "FramePool.hpp"
+
+#include <atomic>
+#include <stdint.h>
+
+/* Latest-frame handoff between one producer (the camera thread) and one
+   consumer (the display), built as a triple buffer of FramePool references.
+   The producer gives each frame a buffer of at least Bytes() with
+   SetWriteFrame(), fills WriteBuffer() and calls Publish(); the consumer
+   calls Update() and then reads ReadBuffer(). Both sides only ever swap an
+   index, so neither can block the other, the consumer always sees the
+   newest complete frame, and the buffer it reads is never written until it
+   moves on. The producer can share the published buffer with others
+   (e.g. the writers), it goes back to the pool when the last one is done.
+   Each buffer also holds previews of the frame at half and quarter size,
+   levels 1 and 2, filled by the producer before publishing, so the
+   display can take the level that suits its window.
+*/
+class FrameExchange
+{
+public:
+    enum { LEVELS = 3 };
+
+    // the largest frame
+    FrameExchange(int width, int height);
+    // buffer size for a frame and its previews
+    static size_t Bytes(int width, int height);
+
+    // producer side, level n is 1/2^n the size of the frame, NULL without a write frame
+    void SetWriteFrame(const FrameRef &frame);
+    const FrameRef &WriteFrame() const;
+    unsigned char *WriteBuffer(int level = 0);
+    // offsets place a readout window on the sensor
+    void Publish(int width, int height, uint64_t frameNumber, int offsetX = 0, int offsetY = 0);
+
+    // consumer side, Update() returns true if a newer frame was swapped in
+    bool Update();
+    // NULL until the first frame is published
+    const unsigned char *ReadBuffer(int level = 0) const;
+    int ReadWidth(int level = 0) const;
+    int ReadHeight(int level = 0) const;
+    int ReadOffsetX() const;
+    int ReadOffsetY() const;
+    uint64_t ReadFrameNumber() const;
+
+private:
+    FrameExchange(const FrameExchange &);
+    FrameExchange &operator=(const FrameExchange &);
+
+    struct Slot
+    {
+        FrameRef frame;
+        int width;
+        int height;
+        int offsetX;
+        int offsetY;
+        uint64_t frameNumber;
+    };
+
+    size_t lLevelOffset[LEVELS];    // of each level in a buffer
+    Slot lSlots[3];
+    int lWrite;     // owned by the producer
+    int lRead;      // owned by the consumer
+    // index of the spare slot, with FRESH set when it holds an unread frame
+    std::atomic<int> lMiddle;
+};
+
+#endif
@@ -0,0 +1,138 @@
+#include "FramePool.hpp"
+
+#include <cassert>
+#include <iostream>
+#include <stdlib.h>
+#include <string.h>
+
+FrameRef::FrameRef(const FrameRef &other)
+    : lBuffer(other.lBuffer)
+{
+    if (lBuffer != NULL)
+    {
+        lBuffer->references.fetch_add(1, std::memory_order_relaxed);
+    }
+}
+
+FrameRef &FrameRef::operator=(const FrameRef &other)
+{
+    // taken before letting go, in case both refer to the same buffer
+    if (other.lBuffer != NULL)
+    {
+        other.lBuffer->references.fetch_add(1, std::memory_order_relaxed);
+    }
+    reset();
+    lBuffer = other.lBuffer;
+    return *this;
+}
+
+FrameRef::~FrameRef()
+{
+    reset();
+}
+
+void FrameRef::reset()
+{
+    // the last holder's reads happen before the buffer is handed out again
+    if (lBuffer != NULL && lBuffer->references.fetch_sub(1, std::memory_order_acq_rel) == 1)
+    {
+        lBuffer->pool->Return(lBuffer);
+    }
+    lBuffer = NULL;
+}
+
+FramePool::FramePool()
+    : lBytes(0)
+    , lMisses(0)
+{
+    pthread_mutex_init(&lMutex, NULL);
+}
+
+FramePool::~FramePool()
+{
+    // a FrameRef still out would give its buffer back to freed memory
+    assert(lFree.size() == lBuffers.size());
+    for (size_t i = 0; i < lBuffers.size(); i++)
+    {
+        free(lBuffers[i]->pixels);
+        delete lBuffers[i];
+    }
+    pthread_mutex_destroy(&lMutex);
+}
+
+int FramePool::Allocate(int count, size_t bytes)
+{
+    if (!lBuffers.empty() || count < 1)
+    {
+        return -1;
+    }
+    // whole cache lines, so no two buffers share one
+    lBytes = (bytes + FRAMEPOOL_ALIGN - 1) / FRAMEPOOL_ALIGN * FRAMEPOOL_ALIGN;
+    for (int i = 0; i < count; i++)
+    {
+        void *pixels;
+        if (posix_memalign(&pixels, FRAMEPOOL_ALIGN, lBytes) != 0)
+        {
+            std::cout << "FramePool::Allocate Can't allocate " << count << " buffers of "
+                      << lBytes << " bytes" << std::endl;
+            break;
+        }
+        memset(pixels, 0, lBytes);
+        FrameBuffer *buffer = new FrameBuffer();
+        buffer->pixels = (unsigned char *)pixels;
+        buffer->references = 0;
+        buffer->pool = this;
+        lBuffers.push_back(buffer);
+    }
+    lFree = lBuffers;
+    return (int)lBuffers.size() == count ? 0 : -1;
+}
+
+FrameRef FramePool::Acquire()
+{
+    pthread_mutex_lock(&lMutex);
+    if (lFree.empty())
+    {
+        lMisses++;
+        pthread_mutex_unlock(&lMutex);
+        return FrameRef();
+    }
+    FrameBuffer *buffer = lFree.back();
+    lFree.pop_back();
+    pthread_mutex_unlock(&lMutex);
+    buffer->references.store(1, std::memory_order_relaxed);
+    return FrameRef(buffer);
+}
+
+void FramePool::Return(FrameBuffer *buffer)
+{
+    pthread_mutex_lock(&lMutex);
+    lFree.push_back(buffer);
+    pthread_mutex_unlock(&lMutex);
+}
+
+size_t FramePool::Bytes() const
+{
+    return lBytes;
+}
+
+int FramePool::Count() const
+{
+    return lBuffers.size();
+}
+
+int FramePool::Available()
+{
+    pthread_mutex_lock(&lMutex);
+    int available = lFree.size();
+    pthread_mutex_unlock(&lMutex);
+    return available;
+}
+
+long FramePool::Misses()
+{
+    pthread_mutex_lock(&lMutex);
+    long misses = lMisses;
+    pthread_mutex_unlock(&lMutex);
+    return misses;
+}
@@ -0,0 +1,81 @@
+#ifndef _FRAMEPOOL_HPP_
+#define _FRAMEPOOL_HPP_
+
+#include <pthread.h>
+#include <atomic>
+#include <vector>
+#include <stddef.h>
+
+#define FRAMEPOOL_ALIGN 64      // buffers start on a cache line
+
+class FramePool;
+
+struct FrameBuffer
+{
+    unsigned char *pixels;
+    std::atomic<int> references;
+    FramePool *pool;
+};
+
+/* Reference to a buffer from a FramePool. Copies share the buffer, which
+   goes back to the pool when the last one is dropped; counting is atomic,
+   so references can be handed between threads. Whoever acquired the
+   buffer fills it before sharing it, after that every holder only reads.
+*/
+class FrameRef
+{
+public:
+    FrameRef(): lBuffer(NULL) {};
+    FrameRef(const FrameRef &other);
+    FrameRef &operator=(const FrameRef &other);
+    ~FrameRef();
+
+    bool empty() const { return lBuffer == NULL; }
+    unsigned char *data() const { return lBuffer != NULL ? lBuffer->pixels : NULL; }
+    void reset();
+
+private:
+    friend class FramePool;
+    explicit FrameRef(FrameBuffer *buffer): lBuffer(buffer) {};
+
+    FrameBuffer *lBuffer;
+};
+
+/* Fixed set of equally sized frame buffers, allocated (and touched, so
+   they are resident and locked with the rest of memory) before streaming
+   starts. Acquire() hands out a free one or nothing; there is no
+   allocation per frame. The pool must outlive every reference to it.
+*/
+class FramePool
+{
+public:
+    FramePool();
+    ~FramePool();
+
+    // returns 0, -1 if already allocated or out of memory
+    int Allocate(int count, size_t bytes);
+
+    // an empty reference when every buffer is in use
+    FrameRef Acquire();
+
+    size_t Bytes() const;
+    int Count() const;
+    int Available();
+    // Acquire()s that found no free buffer
+    long Misses();
+
+private:
+    FramePool(const FramePool &);
+    FramePool &operator=(const FramePool &);
+
+    friend class FrameRef;
+    void Return(FrameBuffer *buffer);
+
+    pthread_mutex_t lMutex;
+    size_t lBytes;
+    std::vector<FrameBuffer *> lBuffers;
+    std::vector<FrameBuffer *> lFree;
+    long lMisses;
+};
+
+#endif
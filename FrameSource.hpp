@@ -0,0 +1,142 @@
+#ifndef _FRAMESOURCE_HPP_
+#define _FRAMESOURCE_HPP_
+
+#include <string>
+#include <memory>
+#include <ctime>
+#include <opencv.hpp>
+
+#include "StreamHealth.hpp"
+#include "PixelFormat.hpp"
+
+#include <stdint.h>
+
+struct CameraSettings
+{
+    CameraSettings(): exposure(10000),
+                      size(1296, 966),
+                      offset(0,0),
+                      analogGain(400),
+                      preampGain(-3),
+                      blackLevel(0),
+                      pixelFormat(MONO8) {};
+    uint16_t exposure;
+    cv::Size size;
+    cv::Point offset;
+    uint16_t analogGain;
+    int16_t preampGain;
+    int blackLevel;
+    PixelFormat pixelFormat;
+};
+
+/* A read-only view of a frame that still lives in the buffer of the
+   source that produced it (a PvBuffer for ImperxStream). Copies of a
+   lease share the buffer, which goes back to the source when the last
+   copy is dropped. Leases must not outlive the source that issued them,
+   and should be dropped before Stop().
+*/
+struct FrameLease
+{
+    FrameLease(): width(0),
+                  height(0),
+                  offsetX(0),
+                  offsetY(0),
+                  format(MONO8),
+                  blockID(0),
+                  timestamp(0),
+                  clockLatched(false)
+    {
+        captureTime.tv_sec = captureTime.tv_nsec = 0;
+        captureTimeMono.tv_sec = captureTimeMono.tv_nsec = 0;
+    };
+    bool empty() const { return !pixels; }
+    const unsigned char *data() const { return pixels.get(); }
+    size_t bytes() const { return PixelBytes(format, (size_t)width * height); }
+    /* wraps the buffer without copying, only valid while the lease is held:
+       CV_8UC1 for Mono8 and CV_16UC1 for unpacked Mono10/Mono12; packed
+       pixels have no Mat type, so those give an empty Mat (UnpackPixels them)
+    */
+    const cv::Mat mat() const
+    {
+        if (IsPacked(format))
+        {
+            return cv::Mat();
+        }
+        return cv::Mat(height, width, (format == MONO8) ? CV_8UC1 : CV_16UC1,
+                       const_cast<unsigned char *>(pixels.get()), cv::Mat::AUTO_STEP);
+    }
+    void release() { pixels.reset(); }
+
+    std::shared_ptr<const unsigned char> pixels;
+    int width;
+    int height;
+    int offsetX;                // readout window position on the sensor
+    int offsetY;
+    PixelFormat format;         // layout of the pixels, see PixelFormat.hpp
+    uint64_t blockID;
+    uint64_t timestamp;         // device ticks
+    // device timestamp mapped onto the host clocks, not the time of delivery
+    timespec captureTime;       // CLOCK_REALTIME
+    timespec captureTimeMono;   // CLOCK_MONOTONIC
+    // mapped with latched samples of the device clock; false while the
+    // source falls back on delivery times, which are late by the readout
+    bool clockLatched;
+};
+
+/* Anything frames can come from: the Imperx GigE camera, or a synthetic
+   generator for running the display/save pipeline without hardware.
+   Calling sequence is the same as for ImperxStream:
+   Connect(), Configure*(), Set*(), Initialize(), then Snap() or
+   StartAcquisition() and Retrieve(), and finally Stop() and Disconnect().
+   Set-functions return 0 for a successful set, -1 otherwise
+*/
+class FrameSource
+{
+public:
+    virtual ~FrameSource() {};
+
+    virtual int Connect() = 0;
+    virtual int Initialize() = 0;
+    virtual void ConfigureSnap() = 0;
+    virtual void ConfigureStream() = 0;
+    virtual int Snap(FrameLease &lease, int timeout) = 0;
+
+    // Retrieve returns 0 for a frame, 1 for a failed frame, -1 on timeout
+    virtual int StartAcquisition() = 0;
+    virtual int Retrieve(FrameLease &lease, int timeout) = 0;
+    virtual void StopAcquisition() = 0;
+    virtual bool IsStreaming() = 0;
+
+    virtual void Stop() = 0;
+    virtual void Disconnect() = 0;
+
+    virtual int SetExposure(int exposureTime) = 0;
+    virtual int SetAnalogGain(int gain) = 0;
+    virtual int SetBlackLevel(int black) = 0;
+    virtual int SetPreAmpGain(int gain) = 0;
+
+    virtual int GetExposure() = 0;
+    virtual int GetAnalogGain() = 0;
+    virtual int GetBlackLevel() = 0;
+    virtual int GetPreAmpGain() = 0;
+
+    /* Readout window in sensor pixels. Changing it while streaming stops
+       and restarts acquisition, so all leases must be dropped first
+    */
+    virtual int SetROI(const cv::Rect &roi) = 0;
+    virtual cv::Rect GetROI() = 0;
+
+    // set before Initialize(), the payload size depends on it
+    virtual int SetPixelFormat(PixelFormat format) = 0;
+    virtual PixelFormat GetPixelFormat() = 0;
+
+    virtual float getTemperature( void ) = 0;
+    virtual std::string GetSerialNumber() = 0;
+    virtual int GetStreamStatistics(long long &imageCount, double &frameRate, double &bandwidth) = 0;
+    // gaps, failures, timeouts and frame intervals over the last few seconds
+    virtual StreamHealthReport GetStreamHealth() = 0;
+    // samples the device clock against the host clocks, from the control thread
+    virtual int SyncClock() = 0;
+};
+
+#endif
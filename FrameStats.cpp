@@ -0,0 +1,240 @@
+#include "FrameStats.hpp"
+
+#include <algorithm>
+#include <cmath>
+#include <string.h>
+
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+
+// pixels per block, 4 kB of 8-bit pixels and 8 kB of words
+#define FRAMESTATS_BLOCK        4096
+
+namespace
+{
+    void Accumulate(const unsigned char *pixels, size_t count, FrameStats &stats, uint32_t tables[4][256])
+    {
+        size_t i = 0;
+        // levels taken from words held in registers, the byte loads
+        // would be reloaded after every table store (char aliases)
+        for (; i + 8 <= count; i += 8)
+        {
+            uint64_t w;
+            memcpy(&w, pixels + i, sizeof(w));
+            tables[0][w & 0xff]++;
+            tables[1][(w >> 8) & 0xff]++;
+            tables[2][(w >> 16) & 0xff]++;
+            tables[3][(w >> 24) & 0xff]++;
+            tables[0][(w >> 32) & 0xff]++;
+            tables[1][(w >> 40) & 0xff]++;
+            tables[2][(w >> 48) & 0xff]++;
+            tables[3][w >> 56]++;
+        }
+        for (; i < count; i++)
+        {
+            tables[i & 3][pixels[i]]++;
+        }
+        stats.pixels += count;
+    }
+
+    // everything else follows from the histogram, 256 levels instead of
+    // a second look at every pixel
+    void Finish(FrameStats &stats, uint32_t tables[4][256])
+    {
+        for (int level = 0; level < 256; level++)
+        {
+            long count = (long)tables[0][level] + tables[1][level] + tables[2][level] + tables[3][level];
+            stats.histogram[level] = count;
+            if (count > 0)
+            {
+                stats.min = std::min(stats.min, level);
+                stats.max = level;
+                stats.sum += (uint64_t)count * level;
+                stats.sumSquares += (uint64_t)count * level * level;
+            }
+        }
+        stats.saturated = stats.histogram[255];
+        if (stats.pixels == 0)
+        {
+            stats.min = stats.max = 0;
+        }
+    }
+
+    void Range(const uint16_t *pixels, size_t count, int &min, int &max)
+    {
+        size_t i = 0;
+        int low = min, high = max;
+#ifdef __SSE2__
+        // values are at most 12 bits, so the signed compares will do
+        __m128i lows = _mm_set1_epi16(0x7fff), highs = _mm_setzero_si128();
+        for (; i + 8 <= count; i += 8)
+        {
+            __m128i v = _mm_loadu_si128((const __m128i *)(pixels + i));
+            lows = _mm_min_epi16(lows, v);
+            highs = _mm_max_epi16(highs, v);
+        }
+        int16_t l[8], h[8];
+        _mm_storeu_si128((__m128i *)l, lows);
+        _mm_storeu_si128((__m128i *)h, highs);
+        if (i > 0)
+        {
+            low = std::min(low, (int)*std::min_element(l, l + 8));
+            high = std::max(high, (int)*std::max_element(h, h + 8));
+        }
+#endif
+        for (; i < count; i++)
+        {
+            low = std::min(low, (int)pixels[i]);
+            high = std::max(high, (int)pixels[i]);
+        }
+        min = low;
+        max = high;
+    }
+}
+
+void FrameStats::Reset()
+{
+    pixels = 0;
+    min = 255;
+    max = 0;
+    sum = 0;
+    sumSquares = 0;
+    saturated = 0;
+    memset(histogram, 0, sizeof(histogram));
+}
+
+double FrameStats::Mean() const
+{
+    return pixels > 0 ? (double)sum / pixels : 0;
+}
+
+double FrameStats::StdDev() const
+{
+    if (pixels == 0)
+    {
+        return 0;
+    }
+    double mean = Mean();
+    return std::sqrt(std::max((double)sumSquares / pixels - mean * mean, 0.0));
+}
+
+double FrameStats::SaturatedFraction() const
+{
+    return pixels > 0 ? (double)saturated / pixels : 0;
+}
+
+int FrameStats::Percentile(double fraction) const
+{
+    long wanted = std::max((long)(pixels * fraction), 1L);
+    long count = 0;
+    int level = 255;
+    while (level > 0 && (count += histogram[level]) < wanted)
+    {
+        level--;
+    }
+    return level;
+}
+
+void MeasureStats(const unsigned char *pixels, size_t count, FrameStats &stats)
+{
+    stats.Reset();
+    uint32_t tables[4][256];
+    memset(tables, 0, sizeof(tables));
+    for (size_t done = 0; done < count; done += FRAMESTATS_BLOCK)
+    {
+        Accumulate(pixels + done, std::min((size_t)FRAMESTATS_BLOCK, count - done), stats, tables);
+    }
+    Finish(stats, tables);
+}
+
+void ReducePixelsStats(const unsigned char *src, PixelFormat format, unsigned char *dst,
+                       size_t pixels, FrameStats &stats)
+{
+    stats.Reset();
+    uint32_t tables[4][256];
+    memset(tables, 0, sizeof(tables));
+    // blocks are even, so packed pixel pairs are never split
+    for (size_t done = 0; done < pixels; done += FRAMESTATS_BLOCK)
+    {
+        size_t count = std::min((size_t)FRAMESTATS_BLOCK, pixels - done);
+        ReducePixels(src + PixelBytes(format, done), format, dst + done, count);
+        Accumulate(dst + done, count, stats, tables);
+    }
+    Finish(stats, tables);
+}
+
+void UnpackPixelsRange(const unsigned char *src, PixelFormat format, uint16_t *dst,
+                       size_t pixels, int &min, int &max)
+{
+    min = 0xffff;
+    max = 0;
+    for (size_t done = 0; done < pixels; done += FRAMESTATS_BLOCK)
+    {
+        size_t count = std::min((size_t)FRAMESTATS_BLOCK, pixels - done);
+        UnpackPixels(src + PixelBytes(format, done), format, dst + done, count);
+        Range(dst + done, count, min, max);
+    }
+    if (pixels == 0)
+    {
+        min = 0;
+    }
+}
+
+void UnpackReducePixelsStats(const unsigned char *src, PixelFormat format, uint16_t *words,
+                             unsigned char *dst, size_t pixels, FrameStats &stats, int &min, int &max)
+{
+    // the 8-bit copy is cut from the words while they are still in L1,
+    // so the camera's buffer is read once for both
+    const PixelFormat wordFormat = PixelFormatFor(PixelBits(format), false);
+    stats.Reset();
+    min = 0xffff;
+    max = 0;
+    uint32_t tables[4][256];
+    memset(tables, 0, sizeof(tables));
+    for (size_t done = 0; done < pixels; done += FRAMESTATS_BLOCK)
+    {
+        size_t count = std::min((size_t)FRAMESTATS_BLOCK, pixels - done);
+        UnpackPixels(src + PixelBytes(format, done), format, words + done, count);
+        if (format == MONO8)
+        {
+            ReducePixels(src + done, format, dst + done, count);
+        }
+        else
+        {
+            ReducePixels((const unsigned char *)(words + done), wordFormat, dst + done, count);
+        }
+        Accumulate(dst + done, count, stats, tables);
+        Range(words + done, count, min, max);
+    }
+    Finish(stats, tables);
+    if (pixels == 0)
+    {
+        min = 0;
+    }
+}
+
+void PixelRange(const unsigned char *pixels, size_t count, int &min, int &max)
+{
+    FrameStats stats;
+    uint32_t tables[4][256];
+    memset(tables, 0, sizeof(tables));
+    for (size_t done = 0; done < count; done += FRAMESTATS_BLOCK)
+    {
+        Accumulate(pixels + done, std::min((size_t)FRAMESTATS_BLOCK, count - done), stats, tables);
+    }
+    Finish(stats, tables);
+    min = stats.min;
+    max = stats.max;
+}
+
+void PixelRange(const uint16_t *pixels, size_t count, int &min, int &max)
+{
+    min = 0xffff;
+    max = 0;
+    Range(pixels, count, min, max);
+    if (count == 0)
+    {
+        min = 0;
+    }
+}
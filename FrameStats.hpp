@@ -0,0 +1,51 @@
+#ifndef _FRAMESTATS_HPP_
+#define _FRAMESTATS_HPP_
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include "PixelFormat.hpp"
+
+// Levels of one frame, on the 0-255 scale of the display copy
+struct FrameStats
+{
+    FrameStats() { Reset(); };
+    void Reset();
+
+    long pixels;
+    int min, max;
+    uint64_t sum, sumSquares;
+    long saturated;         // pixels at 255
+    long histogram[256];
+
+    double Mean() const;
+    double StdDev() const;
+    double SaturatedFraction() const;
+    // level reached by all but the given fraction of the brightest pixels
+    int Percentile(double fraction) const;
+};
+
+/* One pass for the statistics of a frame instead of one per statistic.
+   The frame is worked through in blocks small enough to stay in L1, so
+   each block is converted (ReducePixels, or UnpackPixels for saving)
+   and the statistics taken from the converted block before the next is
+   read. Only the histogram is taken per pixel, spread over four tables
+   so repeated levels don't wait on each other; min, max, sum and sum of
+   squares are worked out from its 256 levels.
+*/
+// statistics of an 8-bit frame
+void MeasureStats(const unsigned char *pixels, size_t count, FrameStats &stats);
+// ReducePixels, with the statistics of the 8-bit result
+void ReducePixelsStats(const unsigned char *src, PixelFormat format, unsigned char *dst,
+                       size_t pixels, FrameStats &stats);
+// range of a frame changed after it was measured, e.g. by calibration
+void PixelRange(const unsigned char *pixels, size_t count, int &min, int &max);
+void PixelRange(const uint16_t *pixels, size_t count, int &min, int &max);
+// UnpackPixels, with the range of the camera's own values
+void UnpackPixelsRange(const unsigned char *src, PixelFormat format, uint16_t *dst,
+                       size_t pixels, int &min, int &max);
+// both at once, for a frame that is displayed and saved at full depth
+void UnpackReducePixelsStats(const unsigned char *src, PixelFormat format, uint16_t *words,
+                             unsigned char *dst, size_t pixels, FrameStats &stats, int &min, int &max);
+
+#endif
@@ -1,5 +1,18 @@
 #include "ImperxStream.hpp"
 #include <iostream>
+#include <algorithm>
+#include <time.h>
+
+#define DEFAULT_FRAME_RATE 30.0 // used to size the pipeline until a rate is observed
+#define EXPOSURE_POLL_START_NS      1000000L    // first wait for MaxExposure to follow
+#define EXPOSURE_POLL_MAX_NS        50000000L   // longest wait between polls
+#define EXPOSURE_SETTLE_TIMEOUT_NS  2000000000L // give up on MaxExposure after this
+#define DEFAULT_LINK_SPEED  1000    // Mb/s, when the device doesn't report GevLinkSpeed
+#define DEFAULT_PACKET_SIZE 1500    // bytes, when none was negotiated
+#define GVSP_HEADERS        36      // IP, UDP and GVSP headers in each streaming packet
+#define ETHERNET_FRAMING    38      // Ethernet header, FCS, preamble and inter-frame gap per packet
+#define CLOCK_LATCH_MAX_NS  5000000L  // latch round trips slower than this aren't used for the clock fit
+#define BLOCKID_WRAP_WINDOW 1024    // BlockIDs this close to either end of 16 bits count as a wrap
 
 ImperxStream::ImperxStream()
     : lStream()
@@ -8,12 +21,18 @@ ImperxStream::ImperxStream()
     lDeviceInfo = NULL;
     lDeviceParams = NULL;
     lStreamParams = NULL;
+    lStreaming = false;
+    lLastBlockID = 0;
+    lPixelFormat = MONO8;
+    lWireNsPerByte = 0.0;
+    pthread_mutex_init(&lClockMutex, NULL);
 }
 
 ImperxStream::~ImperxStream()
 {
     Stop();
     Disconnect();
+    pthread_mutex_destroy(&lClockMutex);
 }
 
 int ImperxStream::Connect()
@@ -21,6 +40,12 @@ int ImperxStream::Connect()
     std::cout << "ImperxStream::Connect starting" << std::endl;
     PvResult lResult;   
 
+    if (ConnectDirect() == 0)
+    {
+        return 0;
+    }
+    lDeviceInfo = NULL;
+
     // Find all GEV Devices on the network.
     lSystem.SetDetectionTimeout( 2000 );
     lResult = lSystem.Find();
@@ -77,6 +102,7 @@ int ImperxStream::Connect()
         {
             printf( "ImpexStream::Connect Successfully connected to %s\n", 
                     lDeviceInfo->GetMACAddress().GetAscii() );
+            RememberDevice();
         }
     }
     else
@@ -92,9 +118,48 @@ int ImperxStream::Connect()
     return 0;
 }
 
-int ImperxStream::Connect(const std::string &IP)
+int ImperxStream::Discover(std::vector<DeviceIdentity> &devices)
+{
+    PvSystem tSystem;
+    tSystem.SetDetectionTimeout( 2000 );
+    PvResult lResult = tSystem.Find();
+    if( !lResult.IsOK() )
+    {
+        printf( "PvSystem::Find Error: %s", lResult.GetCodeString().GetAscii() );
+        return -1;
+    }
+
+    devices.clear();
+    for( PvUInt32 x = 0; x < tSystem.GetInterfaceCount(); x++ )
+    {
+        PvInterface * lInterface = tSystem.GetInterface( x );
+        for( PvUInt32 y = 0; y < lInterface->GetDeviceCount() ; y++ )
+        {
+            PvDeviceInfo *tDeviceInfo = lInterface->GetDeviceInfo( y );
+            DeviceIdentity identity;
+            identity.mac = tDeviceInfo->GetMACAddress().GetAscii();
+            identity.ip = tDeviceInfo->GetIPAddress().GetAscii();
+            identity.serial = tDeviceInfo->GetSerialNumber().GetAscii();
+            devices.push_back(identity);
+        }
+    }
+    return devices.size();
+}
+
+int ImperxStream::Connect(const std::string &address)
 {
     PvResult lResult;
+
+    if (address == lIdentity.ip || address == lIdentity.mac || address == lIdentity.serial)
+    {
+        if (ConnectDirect() == 0)
+        {
+            return 0;
+        }
+    }
+
+    // a previous Find() may have left a stale pointer behind
+    lDeviceInfo = NULL;
     
     // Find all GEV Devices on the network.
     lSystem.SetDetectionTimeout( 2000 );
@@ -110,7 +175,7 @@ int ImperxStream::Connect(const std::string &IP)
     PvUInt32 lInterfaceCount = lSystem.GetInterfaceCount();
 
     // Search through interfaces for any devices
-    // Check devices for correct target IP
+    // Check devices for the target IP, MAC or serial number
     for( PvUInt32 x = 0; x < lInterfaceCount; x++ )
     {
         // get pointer to each of interface
@@ -122,8 +187,9 @@ int ImperxStream::Connect(const std::string &IP)
         for( PvUInt32 y = 0; y < lDeviceCount ; y++ )
         {
             PvDeviceInfo *tDeviceInfo = lInterface->GetDeviceInfo( y );
-            std::string laddress(tDeviceInfo->GetIPAddress().GetAscii());
-            if (!laddress.compare(IP))
+            if (address == tDeviceInfo->GetIPAddress().GetAscii() ||
+                address == tDeviceInfo->GetMACAddress().GetAscii() ||
+                address == tDeviceInfo->GetSerialNumber().GetAscii())
             {
                 lDeviceInfo = tDeviceInfo;
                 printf( "Interface %i\nMAC Address: %s\nIP Address: %s\nSubnet Mask: %s\n\n",
@@ -157,6 +223,7 @@ int ImperxStream::Connect(const std::string &IP)
         {
             printf( "Successfully connected to %s\n", 
                     lDeviceInfo->GetMACAddress().GetAscii() );
+            RememberDevice();
         }
     }
     else
@@ -170,21 +237,85 @@ int ImperxStream::Connect(const std::string &IP)
     return 0;
 }
 
+int ImperxStream::ConnectDirect()
+{
+    if (lIdentity.ip.empty())
+    {
+        return -1;
+    }
+
+    timespec start, end;
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    printf( "ImperxStream::ConnectDirect Connecting to %s at %s\n",
+            lIdentity.serial.c_str(), lIdentity.ip.c_str() );
+    PvResult lResult = lDevice.Connect( PvString( lIdentity.ip.c_str() ) );
+    if ( !lResult.IsOK() )
+    {
+        printf( "ImperxStream::ConnectDirect Unable to connect, scanning instead\n" );
+        return -1;
+    }
+    lDeviceParams = lDevice.GetGenParameters();
+
+    // DHCP may have handed the address to another camera
+    PvString lSerial;
+    if ( lDeviceParams->GetStringValue( "DeviceID", lSerial ).IsOK() &&
+         lIdentity.serial.compare( lSerial.GetAscii() ) != 0 )
+    {
+        printf( "ImperxStream::ConnectDirect Found %s instead, scanning instead\n", lSerial.GetAscii() );
+        lDevice.Disconnect();
+        lDeviceParams = NULL;
+        return -1;
+    }
+
+    clock_gettime(CLOCK_MONOTONIC, &end);
+    printf( "ImperxStream::ConnectDirect Connected in %.1f ms\n",
+            (end.tv_sec - start.tv_sec) * 1e3 + (end.tv_nsec - start.tv_nsec) / 1e6 );
+    return 0;
+}
+
+void ImperxStream::RememberDevice()
+{
+    // keep what is needed to reconnect without a scan; lDeviceInfo
+    // belongs to lSystem and goes stale with the next Find()
+    std::string lSerial = lDeviceInfo->GetSerialNumber().GetAscii();
+    if (lSerial != lIdentity.serial)
+    {
+        lIdentity.packetSize = 0;
+    }
+    lIdentity.mac = lDeviceInfo->GetMACAddress().GetAscii();
+    lIdentity.ip = lDeviceInfo->GetIPAddress().GetAscii();
+    lIdentity.serial = lSerial;
+}
+
+const DeviceIdentity &ImperxStream::GetIdentity()
+{
+    return lIdentity;
+}
+
 int ImperxStream::Initialize()
 {
     std::cout << "ImperxStream::Initialize starting" << std::endl;
-    if(lDeviceInfo == NULL)
+    if(!lDevice.IsConnected() || lIdentity.ip.empty())
     {
         std::cout << "ImperxStream::Initialize No device connected!" << std::endl;
         return -1;
     }
 
-    // Negotiate streaming packet size
-    lDevice.NegotiatePacketSize();
+    // Negotiate streaming packet size once per device, negotiation probes
+    // with test packets and takes a while, reuse the result after that
+    if (lIdentity.packetSize <= 0 ||
+        !lDeviceParams->SetIntegerValue( "GevSCPSPacketSize", lIdentity.packetSize ).IsOK())
+    {
+        lDevice.NegotiatePacketSize();
+        PvInt64 lPacketSize = 0;
+        lDeviceParams->GetIntegerValue( "GevSCPSPacketSize", lPacketSize );
+        lIdentity.packetSize = (int) lPacketSize;
+    }
+    std::cout << "ImperxStream::Initialize Packet size " << lIdentity.packetSize << std::endl;
 
     // Open stream - have the PvDevice do it for us
     std::cout << "ImperxStream::Initialize Opening Stream to Device" << std::endl;
-    PvResult lResult = lStream.Open( lDeviceInfo->GetIPAddress() );
+    PvResult lResult = lStream.Open( PvString( lIdentity.ip.c_str() ) );
     if(!lResult.IsOK()) {
         std::cout << "ImperxStream::Initialize error on opening stream: " << lResult << std::endl;
         return -1;
@@ -194,10 +325,21 @@ int ImperxStream::Initialize()
     PvInt64 lSize = 0;
     lDeviceParams->GetIntegerValue( "PayloadSize", lSize );
 
+    // Start from the frame rate the camera is set up for, the buffer
+    // policy follows the observed rate from there
+    double lRate = 0.0;
+    if ( !lDeviceParams->GetFloatValue( "AcquisitionFrameRate", lRate ).IsOK() || lRate <= 0 )
+    {
+        lRate = DEFAULT_FRAME_RATE;
+    }
+
     // Set the Buffer size and the Buffer count
     std::cout << "ImperxStream::Initialize Setting Buffer Size" << std::endl;
     lPipeline.SetBufferSize( static_cast<PvUInt32>( lSize ) );
-    lPipeline.SetBufferCount( 16 ); // Increase for high frame rate without missing block IDs
+    lPipeline.SetBufferCount( lBufferPolicy.Initial( lSize, lRate ) );
+    std::cout << "ImperxStream::Initialize Buffer count " << lBufferPolicy.Count() << std::endl;
+    lLastBlockID = 0;
+    lHealth.Reset();
 
     // Have to set the Device IP destination to the Stream
     lDevice.SetStreamDestination( lStream.GetLocalIPAddress(), lStream.GetLocalPort() ); 
@@ -218,6 +360,33 @@ int ImperxStream::Initialize()
     
     std::cout << "ImperxStream::Initialize Resetting timestamp counter..." << std::endl;
     lDeviceParams->ExecuteCommand( "GevTimestampControlReset" );
+
+    // Frame times come from the device timestamps, fitted against the
+    // host clocks by SyncClock(), or as frames arrive until that has enough
+    PvInt64 lTickFrequency = 0;
+    lDeviceParams->GetIntegerValue( "GevTimestampTickFrequency", lTickFrequency );
+    pthread_mutex_lock(&lClockMutex);
+    lRealtimeFit.Reset();
+    lMonotonicFit.Reset();
+    lRealtimeFit.SetTickFrequency( (double) lTickFrequency );
+    lMonotonicFit.SetTickFrequency( (double) lTickFrequency );
+    pthread_mutex_unlock(&lClockMutex);
+    lDeliveryRealtimeFit.Reset();
+    lDeliveryMonotonicFit.Reset();
+    lDeliveryRealtimeFit.SetTickFrequency( (double) lTickFrequency );
+    lDeliveryMonotonicFit.SetTickFrequency( (double) lTickFrequency );
+
+    // Time a payload takes on the wire, packet headers and framing included,
+    // to take the host samples back to when the frame started to arrive
+    PvInt64 lLinkSpeed = 0;
+    if ( !lDeviceParams->GetIntegerValue( "GevLinkSpeed", lLinkSpeed ).IsOK() || lLinkSpeed <= 0 )
+    {
+        lLinkSpeed = DEFAULT_LINK_SPEED;
+    }
+    double lPacket = (lIdentity.packetSize > GVSP_HEADERS) ? lIdentity.packetSize : DEFAULT_PACKET_SIZE;
+    lWireNsPerByte = 8e3 / lLinkSpeed * (lPacket + ETHERNET_FRAMING) / (lPacket - GVSP_HEADERS);
+    std::cout << "ImperxStream::Initialize Link speed " << lLinkSpeed << " Mb/s, "
+              << lSize * lWireNsPerByte / 1e6 << " ms per frame on the wire" << std::endl;
     std::cout << "ImperxStream::Initialize Exiting" << std::endl;
     return 0;
 }
@@ -233,65 +402,255 @@ int ImperxStream::Snap(cv::Mat &frame, timespec timeout)
 }
 int ImperxStream::Snap(cv::Mat &frame, int timeout)
 {
-//  std::cout << "ImperxStream::Snap starting" << std::endl;
+    FrameLease lease;
+    int result = Snap(lease, timeout);
+    if (result == 0 && IsPacked(lease.format))
+    {
+        // one word per pixel, like the unpacked formats
+        frame.create(lease.height, lease.width, CV_16UC1);
+        UnpackPixels(lease.data(), lease.format, frame.ptr<uint16_t>(), (size_t)lease.width * lease.height);
+    }
+    else if (result == 0)
+    {
+        lease.mat().copyTo(frame);
+    }
+    return result;
+}
+
+namespace
+{
+    timespec Earlier(const timespec &time, long ns)
+    {
+        long long total = (long long) time.tv_sec * 1000000000LL + time.tv_nsec - ns;
+        timespec earlier;
+        earlier.tv_sec = total / 1000000000LL;
+        earlier.tv_nsec = total % 1000000000LL;
+        return earlier;
+    }
+
+    // Deleter for leased buffers: hands the PvBuffer back to its pipeline
+    struct PipelineRelease
+    {
+        PvPipeline *pipeline;
+        void operator()(PvBuffer *buffer) const
+        {
+            pipeline->ReleaseBuffer(buffer);
+        }
+    };
+}
+
+int ImperxStream::Snap(FrameLease &lease, int timeout)
+{
+    // Drop any frame still held so a single lease never pins two buffers
+    lease.release();
+
     // The pipeline is already "armed", we just have to tell the device
-    // to start sending us images
-    lDeviceParams->ExecuteCommand( "AcquisitionStart" );
-    int lWidth, lHeight, result = 0;
-    PvUInt32 dropCount;
+    // to start sending us images. A free-running camera is already sending.
+    if (!lStreaming)
+    {
+        lDeviceParams->ExecuteCommand( "AcquisitionStart" );
+    }
+    return (Retrieve(lease, timeout) == 0) ? 0 : 1;
+}
+
+int ImperxStream::StartAcquisition()
+{
+    if (lDeviceParams == NULL || !lPipeline.IsStarted())
+    {
+        std::cout << "ImperxStream::StartAcquisition Stream not initialized!" << std::endl;
+        return -1;
+    }
+    if (lStreaming)
+    {
+        return 0;
+    }
+
+    std::cout << "ImperxStream::StartAcquisition Sending AcquisitionStart" << std::endl;
+    PvResult lResult = lDeviceParams->ExecuteCommand( "AcquisitionStart" );
+    if (!lResult.IsOK())
+    {
+        std::cout << "ImperxStream::StartAcquisition error: " << lResult << std::endl;
+        return -1;
+    }
+    lStreaming = true;
+    return 0;
+}
+
+void ImperxStream::StopAcquisition()
+{
+    if (lDeviceParams != NULL && lStreaming)
+    {
+        std::cout << "ImperxStream::StopAcquisition Sending AcquisitionStop" << std::endl;
+        lDeviceParams->ExecuteCommand( "AcquisitionStop" );
+    }
+    lStreaming = false;
+}
+
+bool ImperxStream::IsStreaming()
+{
+    return lStreaming;
+}
+
+int ImperxStream::Retrieve(FrameLease &lease, int timeout)
+{
+    lease.release();
+
+    int result = 0;
+    PvUInt32 dropCount = 0;
+    int failure = 0;
     // Retrieve next buffer             
     PvBuffer *lBuffer = NULL;
     PvResult lOperationResult;
     PvResult lResult = lPipeline.RetrieveNextBuffer( &lBuffer, timeout, &lOperationResult );
+
+    // Host clocks as close to delivery as possible, for the clock fit
+    timespec lRealtime, lMonotonic;
+    clock_gettime(CLOCK_REALTIME, &lRealtime);
+    clock_gettime(CLOCK_MONOTONIC, &lMonotonic);
         
     if ( lResult.IsOK() )
     {
+        // From here on the buffer is owned by the shared pointer, which
+        // releases it back to the pipeline when the last holder lets go
+        PipelineRelease release = { &lPipeline };
+        std::shared_ptr<PvBuffer> owner(lBuffer, release);
+
         if ( lOperationResult.IsOK() )
         {
-            // Process Buffer
-            
             if ( lBuffer->GetPayloadType() == PvPayloadTypeImage )
             {
-//              std::cout << "ImperxStream::Snap Copying frame" << std::endl;
                 // Get image specific buffer interface
                 PvImage *lImage = lBuffer->GetImage();
               
-                // Read width, height
-                lWidth = (int) lImage->GetWidth();
-                lHeight = (int) lImage->GetHeight();
-                unsigned char *img = lImage->GetDataPointer();
-                cv::Mat lframe(lHeight,lWidth,CV_8UC1,img, cv::Mat::AUTO_STEP);
-                lframe.copyTo(frame);
+                // Hand out the pixels in place, no copy
+                lease.width = (int) lImage->GetWidth();
+                lease.height = (int) lImage->GetHeight();
+                lease.offsetX = (int) lImage->GetOffsetX();
+                lease.offsetY = (int) lImage->GetOffsetY();
+                lease.format = lPixelFormat;
+                lease.blockID = lBuffer->GetBlockID();
+                lease.timestamp = lBuffer->GetTimestamp();
+                // The last packet is in when the buffer comes back, the
+                // fallback fit pairs the timestamp with when the first one
+                // went out, which still has the exposure and readout in it
+                long lTransfer = (long) (lBuffer->GetAcquiredSize() * lWireNsPerByte);
+                lDeliveryRealtimeFit.AddSample(lease.timestamp, Earlier(lRealtime, lTransfer));
+                lDeliveryMonotonicFit.AddSample(lease.timestamp, Earlier(lMonotonic, lTransfer));
+                pthread_mutex_lock(&lClockMutex);
+                lease.clockLatched = lRealtimeFit.IsFitted() && lMonotonicFit.IsFitted();
+                if (lease.clockLatched)
+                {
+                    lease.captureTime = lRealtimeFit.ToHost(lease.timestamp);
+                    lease.captureTimeMono = lMonotonicFit.ToHost(lease.timestamp);
+                }
+                pthread_mutex_unlock(&lClockMutex);
+                if (!lease.clockLatched)
+                {
+                    lease.captureTime = lDeliveryRealtimeFit.ToHost(lease.timestamp);
+                    lease.captureTimeMono = lDeliveryMonotonicFit.ToHost(lease.timestamp);
+                }
+                lease.pixels = std::shared_ptr<const unsigned char>(owner, lImage->GetDataPointer());
                 result = 0;
             }
             else
             {
-                std::cout << "ImperxStream::Snap No image in buffer" << std::endl;
+                failure = StreamHealthReport::FAILURE_NOT_IMAGE;
                 result = 1;
             }
         }
         else
         {
-            std::cout << "ImperxStream::Snap Operation result: " << lOperationResult << std::endl;
+            // counted in the stream health with the missing and resent
+            // packets, there can be one of these per frame on a bad link
+            failure = (int) lOperationResult.GetCode();
             lBuffer->GetMissingPacketIdsCount(dropCount);
-                std::cout << "ImperxStream::Snap Dropped " << (int) dropCount << " packets!" << std::endl;
             result = 1;
         }
-        // We have an image - do some processing (...) and VERY IMPORTANT,
-        // release the buffer back to the pipeline
+
+        // Block IDs are 16 bit on the wire and skip 0 when they wrap. One
+        // at or behind the last that isn't a wrap is a repeat or came out
+        // of order: nothing was lost, and it doesn't move the last ID back
+        int lGap = 0;
+        bool lReordered = false;
+        uint64_t lBlockID = lBuffer->GetBlockID();
+        uint64_t lLast = lLastBlockID;
+        if (lLast != 0 && lBlockID != lLast + 1)
+        {
+            if (lBlockID > lLast)
+            {
+                lGap = (int)(lBlockID - lLast - 1);
+            }
+            else if (lLast > 65535 - BLOCKID_WRAP_WINDOW && lBlockID <= BLOCKID_WRAP_WINDOW)
+            {
+                lGap = (int)(65535 - lLast + lBlockID - 1);
+            }
+            else
+            {
+                lReordered = true;
+            }
+        }
+        if (lReordered)
+        {
+            lHealth.Reordered(lMonotonic);
+        }
+        else
+        {
+            lLastBlockID = lBlockID;
+        }
+
+        int lResent = (int) lBuffer->GetPacketsRecoveredCount();
+        if (result == 0)
+        {
+            lHealth.Frame(lMonotonic, lGap, 0, lResent, (int) lPipeline.GetOutputQueueSize(),
+                          (int) lPipeline.GetBufferCount(), (long) lBuffer->GetAcquiredSize());
+        }
+        else
+        {
+            lHealth.Failure(lMonotonic, lGap, (int) dropCount, lResent, failure);
+        }
+        AdaptBufferCount(lGap + ((result == 0) ? 0 : 1), (result == 0) ? 0 : (int) dropCount);
     }
     else
     {
-        std::cout << "ImperxStream::Snap Timeout: " << lResult << std::endl;
-        result = 1;
+        lHealth.Timeout(lMonotonic);
+        result = -1;
     }
     
-    lPipeline.ReleaseBuffer( lBuffer );
-//    std::cout << "ImperxStream::Snap Exiting" << std::endl;
     return result;
 }
 
 
+int ImperxStream::SyncClock()
+{
+    if (lDeviceParams == NULL)
+    {
+        return -1;
+    }
+    // The device copies its tick counter when the latch command reaches
+    // it, so the host clocks read once the command is acknowledged are
+    // late by the reply's trip alone, which the fit's lower envelope takes out
+    timespec lSent, lRealtime, lMonotonic;
+    clock_gettime(CLOCK_MONOTONIC, &lSent);
+    PvResult lResult = lDeviceParams->ExecuteCommand( "GevTimestampControlLatch" );
+    clock_gettime(CLOCK_REALTIME, &lRealtime);
+    clock_gettime(CLOCK_MONOTONIC, &lMonotonic);
+    PvInt64 lTicks = 0;
+    if (!lResult.IsOK() || !lDeviceParams->GetIntegerValue( "GevTimestampValue", lTicks ).IsOK())
+    {
+        return -1;
+    }
+    long lRoundTrip = (lMonotonic.tv_sec - lSent.tv_sec) * 1000000000L + (lMonotonic.tv_nsec - lSent.tv_nsec);
+    if (lRoundTrip > CLOCK_LATCH_MAX_NS)
+    {
+        return -1;
+    }
+    pthread_mutex_lock(&lClockMutex);
+    lRealtimeFit.AddSample((uint64_t) lTicks, lRealtime);
+    lMonotonicFit.AddSample((uint64_t) lTicks, lMonotonic);
+    pthread_mutex_unlock(&lClockMutex);
+    return 0;
+}
+
 float ImperxStream::getTemperature()
 {               
     long long int lTempValue = -512;
@@ -301,6 +660,63 @@ float ImperxStream::getTemperature()
     return (float)lTempValue/4.;
 }
 
+void ImperxStream::AdaptBufferCount(int framesLost, int packetsMissing)
+{
+    timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    int lCount = lBufferPolicy.Update(now, framesLost, packetsMissing,
+                                      (int) lPipeline.GetOutputQueueSize());
+    if (lCount != (int) lPipeline.GetBufferCount())
+    {
+        // The pipeline resizes on the fly, surplus buffers are freed as
+        // they come back from the consumer
+        std::cout << "ImperxStream::AdaptBufferCount " << lPipeline.GetBufferCount()
+                  << " -> " << lCount << " buffers at "
+                  << lBufferPolicy.FrameRate() << " FPS" << std::endl;
+        lPipeline.SetBufferCount( lCount );
+    }
+}
+
+void ImperxStream::SetBufferLimits(int minCount, int maxCount, long long memoryBudget)
+{
+    lBufferPolicy.SetLimits(minCount, maxCount, memoryBudget);
+}
+
+int ImperxStream::GetBufferCount()
+{
+    return (int) lPipeline.GetBufferCount();
+}
+
+std::string ImperxStream::GetSerialNumber()
+{
+    if (!lDevice.IsConnected())
+    {
+        return std::string();
+    }
+    return lIdentity.serial;
+}
+
+StreamHealthReport ImperxStream::GetStreamHealth()
+{
+    timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return lHealth.Report(now);
+}
+
+int ImperxStream::GetStreamStatistics(long long &imageCount, double &frameRate, double &bandwidth)
+{
+    if (lStreamParams == NULL)
+    {
+        return -1;
+    }
+    PvInt64 lImageCount = 0;
+    lStreamParams->GetIntegerValue( "ImagesCount", lImageCount );
+    imageCount = lImageCount;
+    lStreamParams->GetFloatValue( "AcquisitionRateAverage", frameRate );
+    lStreamParams->GetFloatValue( "BandwidthAverage", bandwidth );
+    return 0;
+}
+
 
 void ImperxStream::Stop()
 {
@@ -309,6 +725,7 @@ void ImperxStream::Stop()
         // Tell the device to stop sending images
         std::cout << "Stop: Send AcquisitionStop\n";
         lDeviceParams->ExecuteCommand( "AcquisitionStop" );
+        lStreaming = false;
     
         // If present reset TLParamsLocked to 0. Must be done AFTER the 
         // streaming has been stopped
@@ -331,6 +748,7 @@ void ImperxStream::Stop()
         std::cout << "Stop: Closing stream\n";
         lStream.Close();
     }
+    lStreamParams = NULL;
 }
 
 void ImperxStream::Disconnect()
@@ -346,7 +764,17 @@ void ImperxStream::ConfigureSnap()
 {
     lDeviceParams->SetEnumValue("AcquisitionMode","SingleFrame");
     lDeviceParams->SetEnumValue("ExposureMode","Timed");
-    lDeviceParams->SetEnumValue("PixelFormat","Mono8");
+    lDeviceParams->SetEnumValue("PixelFormat",PixelFormatName(lPixelFormat));
+    lDeviceParams->SetBooleanValue("AecEnable", false);
+    lDeviceParams->SetBooleanValue("AgcEnable", false);
+}
+
+void ImperxStream::ConfigureStream()
+{
+    // Same as ConfigureSnap, but the camera free-runs once started
+    lDeviceParams->SetEnumValue("AcquisitionMode","Continuous");
+    lDeviceParams->SetEnumValue("ExposureMode","Timed");
+    lDeviceParams->SetEnumValue("PixelFormat",PixelFormatName(lPixelFormat));
     lDeviceParams->SetBooleanValue("AecEnable", false);
     lDeviceParams->SetBooleanValue("AgcEnable", false);
 }
@@ -366,10 +794,23 @@ int ImperxStream::SetExposure(int exposureTime)
     } else if (exposureTime > 38221) {
         lDeviceParams->SetBooleanValue("ProgFrameTimeEnable", true);
         lDeviceParams->SetIntegerValue("ProgFrameTimeAbs", exposureTime);
-        //It can take a while for MaxExposure to update properly
-        do {
+        //It can take a while for MaxExposure to update properly,
+        //poll with backoff and give up rather than spin forever
+        timespec wait = {0, EXPOSURE_POLL_START_NS};
+        long waited = 0;
+        lDeviceParams->GetIntegerValue("MaxExposure", temp);
+        while (exposureTime - temp > 100)
+        {
+            if (waited >= EXPOSURE_SETTLE_TIMEOUT_NS)
+            {
+                std::cout << "ImperxStream::SetExposure MaxExposure stuck at " << temp << std::endl;
+                return -1;
+            }
+            nanosleep(&wait, NULL);
+            waited += wait.tv_nsec;
+            wait.tv_nsec = std::min(wait.tv_nsec * 2, (long) EXPOSURE_POLL_MAX_NS);
             lDeviceParams->GetIntegerValue("MaxExposure", temp);
-        } while (exposureTime - temp > 100);
+        }
         outcome = lDeviceParams->SetIntegerValue("ExposureTimeRaw", temp);
         if (outcome.IsSuccess())
         {
@@ -379,6 +820,87 @@ int ImperxStream::SetExposure(int exposureTime)
     return -1;
 }
 
+int ImperxStream::SetROI(const cv::Rect &roi)
+{
+    if (lDeviceParams == NULL)
+    {
+        return -1;
+    }
+
+    // The window can only change while the stream parameters are unlocked,
+    // which needs the acquisition stopped
+    bool restart = lStreaming;
+    if (restart)
+    {
+        lDeviceParams->ExecuteCommand( "AcquisitionStop" );
+        lStreaming = false;
+    }
+    lDeviceParams->SetIntegerValue( "TLParamsLocked", 0 );
+
+    // Offsets go to zero first so that the new size always fits
+    int result = SetROIOffset(0, 0);
+    if (result == 0)
+    {
+        result = SetROISize(roi.width, roi.height);
+    }
+    if (result == 0)
+    {
+        result = SetROIOffset(roi.x, roi.y);
+    }
+    if (result != 0)
+    {
+        std::cout << "ImperxStream::SetROI Unable to set " << roi.width << "x" << roi.height
+                  << "+" << roi.x << "+" << roi.y << std::endl;
+    }
+
+    // Buffers are sized at Initialize, grow them if the payload no longer fits
+    PvInt64 lSize = 0;
+    lDeviceParams->GetIntegerValue( "PayloadSize", lSize );
+    if (lPipeline.IsStarted())
+    {
+        if (lSize > lPipeline.GetBufferSize())
+        {
+            lPipeline.Stop();
+            lPipeline.SetBufferSize( static_cast<PvUInt32>( lSize ) );
+            lPipeline.Start();
+        }
+        lDeviceParams->SetIntegerValue( "TLParamsLocked", 1 );
+    }
+
+    // the camera restarts its block IDs, that is not a loss
+    lLastBlockID = 0;
+    if (restart)
+    {
+        lDeviceParams->ExecuteCommand( "AcquisitionStart" );
+        lStreaming = true;
+    }
+    return result;
+}
+
+int ImperxStream::SetPixelFormat(PixelFormat format)
+{
+    // The payload size changes with the format, buffers are sized at Initialize
+    if (lPipeline.IsStarted())
+    {
+        std::cout << "ImperxStream::SetPixelFormat Stream already initialized" << std::endl;
+        return -1;
+    }
+    if (lDeviceParams != NULL &&
+        !lDeviceParams->SetEnumValue("PixelFormat", PixelFormatName(format)).IsOK())
+    {
+        std::cout << "ImperxStream::SetPixelFormat Camera does not support "
+                  << PixelFormatName(format) << std::endl;
+        return -1;
+    }
+    lPixelFormat = format;
+    return 0;
+}
+
+PixelFormat ImperxStream::GetPixelFormat()
+{
+    return lPixelFormat;
+}
+
 int ImperxStream::SetROISize(cv::Size size)
 {
     return SetROISize(size.width, size.height);
@@ -447,7 +969,7 @@ int ImperxStream::SetROIOffset(int x, int y)
 int ImperxStream::SetROIOffsetX(int x)
 {
     PvResult outcome;
-    if (x >= 0 && x <= 965)
+    if (x >= 0 && x <= 1288)
     {
         outcome = lDeviceParams->SetIntegerValue("OffsetX", x);
         if (outcome.IsSuccess())
@@ -461,7 +983,7 @@ int ImperxStream::SetROIOffsetX(int x)
 int ImperxStream::SetROIOffsetY(int y)
 {
     PvResult outcome;
-    if (y >= 0 && y <= 1295)
+    if (y >= 0 && y <= 965)
     {
         outcome = lDeviceParams->SetIntegerValue("OffsetY", y);
         if (outcome.IsSuccess())
@@ -536,6 +1058,11 @@ int ImperxStream::GetExposure()
     return (int) exposure;
 }
 
+cv::Rect ImperxStream::GetROI()
+{
+    return cv::Rect(GetROIOffsetX(), GetROIOffsetY(), GetROIWidth(), GetROIHeight());
+}
+
 cv::Size ImperxStream::GetROISize()
 {
     int width, height;
@@ -7,40 +7,59 @@
 #include <PvStream.h>
 #include <PvStreamRaw.h>
 
-#include <string>
-#include <opencv.hpp>
+#include <pthread.h>
+#include <atomic>
+#include <vector>
 
-#include <stdint.h>
+#include "FrameSource.hpp"
+#include "BufferCountPolicy.hpp"
+#include "ClockFit.hpp"
 
-struct CameraSettings
+// A GigE Vision device seen on the network
+struct DeviceIdentity
 {
-    CameraSettings(): exposure(10000),
-                      size(1296, 966),
-                      offset(0,0),
-                      analogGain(400),
-                      preampGain(-3),
-                      blackLevel(0) {};
-    uint16_t exposure;
-    cv::Size size;
-    cv::Point offset;
-    uint16_t analogGain;
-    int16_t preampGain;
-    int blackLevel;
+    DeviceIdentity(): packetSize(0) {};
+    std::string mac;
+    std::string ip;
+    std::string serial;
+    int packetSize;     // negotiated GevSCPSPacketSize, 0 until known
 };
 
-class ImperxStream
+class ImperxStream : public FrameSource
 {
 public:
     ImperxStream();
     ~ImperxStream();
+    // list every GEV device on every interface, returns the number found or -1
+    static int Discover(std::vector<DeviceIdentity> &devices);
+    /* Both connect directly to the last device this stream was connected
+       to when they can, and only fall back to a full PvSystem::Find()
+       scan if that fails or a different device is asked for
+    */
     int Connect();
-    int Connect(const std::string &IP);
+    // connect to the device with this IP address, MAC address or serial number
+    int Connect(const std::string &address);
+    // the device last connected to, empty before the first connect
+    const DeviceIdentity &GetIdentity();
     //get/set parameters(name, value);
     int Initialize();
     void ConfigureSnap();
+    void ConfigureStream();
+    int Snap(FrameLease &lease, int timeout);
     int Snap(cv::Mat &frame, timespec timeout);
     int Snap(cv::Mat &frame, int timeout);
     int Snap(cv::Mat &frame);
+
+    /* Continuous (free-running) acquisition, see ConfigureStream()
+       StartAcquisition() is sent once, then frames are pulled from the
+       pipeline with Retrieve() until StopAcquisition() or Stop().
+       Retrieve returns 0 for a frame, 1 for a failed frame, -1 on timeout
+    */
+    int StartAcquisition();
+    int Retrieve(FrameLease &lease, int timeout);
+    void StopAcquisition();
+    bool IsStreaming();
+
     void Stop();
     void Disconnect();
     
@@ -49,6 +68,7 @@ public:
        returns -1 otherwise
     */
     int SetExposure(int exposureTime);
+    int SetROI(const cv::Rect &roi);
     int SetROISize(cv::Size size);
     int SetROISize(int width, int height);
     int SetROIOffset(cv::Point offset);
@@ -60,8 +80,11 @@ public:
     int SetAnalogGain(int gain);
     int SetBlackLevel(int black);
     int SetPreAmpGain(int gain);
+    // before Initialize(), Configure*() keeps what was set last
+    int SetPixelFormat(PixelFormat format);
     
     int GetExposure();
+    cv::Rect GetROI();
     cv::Size GetROISize();
     cv::Point GetROIOffset();
     int GetROIHeight();
@@ -71,10 +94,27 @@ public:
     int GetAnalogGain();
     int GetBlackLevel();
     int GetPreAmpGain();
+    PixelFormat GetPixelFormat();
 
     float getTemperature( void );
+    std::string GetSerialNumber();
+    int GetStreamStatistics(long long &imageCount, double &frameRate, double &bandwidth);
+    StreamHealthReport GetStreamHealth();
+    // one latched sample of the device clock against the host clocks
+    int SyncClock();
+
+    /* Pipeline depth is sized by BufferCountPolicy from the payload size,
+       observed frame rate and losses; these bound it (set before Initialize)
+       memoryBudget is in bytes for all buffers together
+    */
+    void SetBufferLimits(int minCount, int maxCount, long long memoryBudget);
+    int GetBufferCount();
 
 private:
+    int ConnectDirect();
+    void RememberDevice();
+    DeviceIdentity lIdentity;
+
     PvSystem lSystem;
     PvDevice lDevice;
     PvDeviceInfo *lDeviceInfo;
@@ -82,5 +122,26 @@ private:
     PvStream lStream;
     PvGenParameterArray *lStreamParams;
     PvPipeline lPipeline;
+    std::atomic<bool> lStreaming;
+    PixelFormat lPixelFormat;
+
+    void AdaptBufferCount(int framesLost, int packetsMissing);
+    BufferCountPolicy lBufferPolicy;
+    std::atomic<uint64_t> lLastBlockID;     // reset by SetROI()
+    StreamHealth lHealth;
+
+    /* device timestamp ticks to host clocks, fitted to the device clock
+       latched from the control thread (SyncClock), under lClockMutex
+    */
+    ClockFit lRealtimeFit;
+    ClockFit lMonotonicFit;
+    pthread_mutex_t lClockMutex;
+    /* until those have enough samples: the host time each frame started
+       to arrive, delivery less its payload's time on the wire; that is
+       late by the exposure and readout, and leases say which was used
+    */
+    ClockFit lDeliveryRealtimeFit;
+    ClockFit lDeliveryMonotonicFit;
+    double lWireNsPerByte;
 };
 
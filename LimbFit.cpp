@@ -0,0 +1,422 @@
+#include "LimbFit.hpp"
+
+#include <algorithm>
+#include <cmath>
+
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+
+#define LIMBFIT_COARSE          4       // rows skipped per step down a column before refining
+#define LIMBFIT_ITERATIONS      5       // rounds of rejecting outliers and fitting again
+#define LIMBFIT_MIN_SIGMA       0.25    // pixels, rejection never gets tighter than this
+#define LIMBFIT_SECTORS         16      // directions for the coverage
+
+namespace
+{
+    // Gaussian elimination with partial pivoting, returns false if singular
+    bool Solve3(double a[3][3], double b[3], double x[3])
+    {
+        for (int col = 0; col < 3; col++)
+        {
+            int pivot = col;
+            for (int row = col + 1; row < 3; row++)
+            {
+                if (std::fabs(a[row][col]) > std::fabs(a[pivot][col]))
+                {
+                    pivot = row;
+                }
+            }
+            if (std::fabs(a[pivot][col]) < 1e-12)
+            {
+                return false;
+            }
+            for (int k = 0; k < 3; k++)
+            {
+                std::swap(a[col][k], a[pivot][k]);
+            }
+            std::swap(b[col], b[pivot]);
+            for (int row = col + 1; row < 3; row++)
+            {
+                double f = a[row][col] / a[col][col];
+                for (int k = col; k < 3; k++)
+                {
+                    a[row][k] -= f * a[col][k];
+                }
+                b[row] -= f * b[col];
+            }
+        }
+        for (int row = 2; row >= 0; row--)
+        {
+            double sum = b[row];
+            for (int k = row + 1; k < 3; k++)
+            {
+                sum -= a[row][k] * x[k];
+            }
+            x[row] = sum / a[row][row];
+        }
+        return true;
+    }
+
+    // first index from the left with a value above threshold, -1 if none
+    int FirstAbove(const unsigned char *row, int width, int threshold)
+    {
+        int x = 0;
+#ifdef __SSE2__
+        // unsigned compare as signed, both sides shifted by 128
+        const __m128i flip = _mm_set1_epi8((char)0x80);
+        const __m128i level = _mm_set1_epi8((char)(threshold ^ 0x80));
+        for (; x + 16 <= width; x += 16)
+        {
+            __m128i v = _mm_xor_si128(_mm_loadu_si128((const __m128i *)(row + x)), flip);
+            int mask = _mm_movemask_epi8(_mm_cmpgt_epi8(v, level));
+            if (mask != 0)
+            {
+                return x + __builtin_ctz(mask);
+            }
+        }
+#endif
+        for (; x < width; x++)
+        {
+            if (row[x] > threshold)
+            {
+                return x;
+            }
+        }
+        return -1;
+    }
+
+    // the same from the right
+    int LastAbove(const unsigned char *row, int width, int threshold)
+    {
+        int x = width;
+#ifdef __SSE2__
+        const __m128i flip = _mm_set1_epi8((char)0x80);
+        const __m128i level = _mm_set1_epi8((char)(threshold ^ 0x80));
+        for (; x - 16 >= 0; x -= 16)
+        {
+            __m128i v = _mm_xor_si128(_mm_loadu_si128((const __m128i *)(row + x - 16)), flip);
+            int mask = _mm_movemask_epi8(_mm_cmpgt_epi8(v, level));
+            if (mask != 0)
+            {
+                return x - 16 + 31 - __builtin_clz(mask);
+            }
+        }
+#endif
+        for (x--; x >= 0; x--)
+        {
+            if (row[x] > threshold)
+            {
+                return x;
+            }
+        }
+        return -1;
+    }
+
+    // where the level crosses the threshold between a pixel below and one above
+    double Crossing(int below, int above, int threshold)
+    {
+        return (double)(threshold - below) / (above - below);
+    }
+}
+
+LimbFit::LimbFit()
+    : lSpacing(8)
+    , lRejection(3.0)
+    , lMinInliers(20)
+    , lMinCoverage(0.25)
+{
+}
+
+void LimbFit::SetSpacing(int spacing)
+{
+    lSpacing = std::max(spacing, 1);
+}
+
+void LimbFit::SetRejection(double sigmas)
+{
+    lRejection = std::max(sigmas, 1.0);
+}
+
+void LimbFit::SetMinimum(int inliers, double coverage)
+{
+    lMinInliers = std::max(inliers, 3);
+    lMinCoverage = std::min(std::max(coverage, 0.0), 1.0);
+}
+
+void LimbFit::FindRowEdges(const unsigned char *pixels, int width, int height, int threshold)
+{
+    for (int y = lSpacing / 2; y < height; y += lSpacing)
+    {
+        const unsigned char *row = pixels + (size_t)y * width;
+        int left = FirstAbove(row, width, threshold);
+        if (left < 0)
+        {
+            continue;
+        }
+        int right = LastAbove(row, width, threshold);
+        // a crossing on the first or last pixel is where the frame ends
+        if (left > 0)
+        {
+            Point point = { left - 1 + Crossing(row[left - 1], row[left], threshold), (double)y };
+            lPoints.push_back(point);
+        }
+        if (right < width - 1)
+        {
+            Point point = { right + 1 - Crossing(row[right + 1], row[right], threshold), (double)y };
+            lPoints.push_back(point);
+        }
+    }
+}
+
+void LimbFit::FindColumnEdges(const unsigned char *pixels, int width, int height, int threshold)
+{
+    for (int x = lSpacing / 2; x < width; x += lSpacing)
+    {
+        const unsigned char *column = pixels + x;
+        // coarse steps down to the first pixel above, then back for the exact one
+        int top = -1;
+        for (int y = 0; y < height; y += LIMBFIT_COARSE)
+        {
+            if (column[(size_t)y * width] > threshold)
+            {
+                top = y;
+                for (int back = std::max(y - LIMBFIT_COARSE + 1, 0); back < y; back++)
+                {
+                    if (column[(size_t)back * width] > threshold)
+                    {
+                        top = back;
+                        break;
+                    }
+                }
+                break;
+            }
+        }
+        if (top < 0)
+        {
+            continue;
+        }
+        int bottom = top;
+        for (int y = height - 1; y > top; y -= LIMBFIT_COARSE)
+        {
+            if (column[(size_t)y * width] > threshold)
+            {
+                bottom = y;
+                for (int back = std::min(y + LIMBFIT_COARSE - 1, height - 1); back > y; back--)
+                {
+                    if (column[(size_t)back * width] > threshold)
+                    {
+                        bottom = back;
+                        break;
+                    }
+                }
+                break;
+            }
+        }
+
+        if (top > 0)
+        {
+            Point point = { (double)x, top - 1 + Crossing(column[(size_t)(top - 1) * width],
+                                                          column[(size_t)top * width], threshold) };
+            lPoints.push_back(point);
+        }
+        if (bottom < height - 1)
+        {
+            Point point = { (double)x, bottom + 1 - Crossing(column[(size_t)(bottom + 1) * width],
+                                                             column[(size_t)bottom * width], threshold) };
+            lPoints.push_back(point);
+        }
+    }
+}
+
+bool LimbFit::FitCircle(const std::vector<char> &use, double &x, double &y, double &radius)
+{
+    // Algebraic fit of x^2 + y^2 + Dx + Ey + F = 0 about the mean point,
+    // linear, and a good start for the geometric fit
+    double meanX = 0, meanY = 0;
+    int n = 0;
+    for (size_t i = 0; i < lPoints.size(); i++)
+    {
+        if (use[i])
+        {
+            meanX += lPoints[i].x;
+            meanY += lPoints[i].y;
+            n++;
+        }
+    }
+    if (n < 3)
+    {
+        return false;
+    }
+    meanX /= n;
+    meanY /= n;
+
+    double a[3][3] = {{0, 0, 0}, {0, 0, 0}, {0, 0, 0}};
+    double b[3] = {0, 0, 0};
+    for (size_t i = 0; i < lPoints.size(); i++)
+    {
+        if (!use[i])
+        {
+            continue;
+        }
+        double u = lPoints[i].x - meanX;
+        double v = lPoints[i].y - meanY;
+        double row[3] = {u, v, 1.0};
+        double rhs = -(u*u + v*v);
+        for (int j = 0; j < 3; j++)
+        {
+            for (int k = 0; k < 3; k++)
+            {
+                a[j][k] += row[j] * row[k];
+            }
+            b[j] += row[j] * rhs;
+        }
+    }
+    double solution[3];
+    if (!Solve3(a, b, solution))
+    {
+        return false;
+    }
+    double cu = -solution[0] / 2, cv = -solution[1] / 2;
+    double squared = cu*cu + cv*cv - solution[2];
+    if (squared <= 0)
+    {
+        return false;
+    }
+    x = meanX + cu;
+    y = meanY + cv;
+    radius = std::sqrt(squared);
+    return true;
+}
+
+bool LimbFit::RefineCircle(const std::vector<char> &use, double &x, double &y, double &radius)
+{
+    // Gauss-Newton on the distances to the circle, the algebraic fit is
+    // pulled inwards when only an arc of the limb is seen
+    for (int iteration = 0; iteration < 10; iteration++)
+    {
+        double a[3][3] = {{0, 0, 0}, {0, 0, 0}, {0, 0, 0}};
+        double b[3] = {0, 0, 0};
+        for (size_t i = 0; i < lPoints.size(); i++)
+        {
+            if (!use[i])
+            {
+                continue;
+            }
+            double dx = lPoints[i].x - x;
+            double dy = lPoints[i].y - y;
+            double d = std::sqrt(dx*dx + dy*dy);
+            if (d < 1e-9)
+            {
+                continue;
+            }
+            double row[3] = {-dx / d, -dy / d, -1.0};
+            double residual = d - radius;
+            for (int j = 0; j < 3; j++)
+            {
+                for (int k = 0; k < 3; k++)
+                {
+                    a[j][k] += row[j] * row[k];
+                }
+                b[j] -= row[j] * residual;
+            }
+        }
+        double step[3];
+        if (!Solve3(a, b, step))
+        {
+            return false;
+        }
+        x += step[0];
+        y += step[1];
+        radius += step[2];
+        if (std::fabs(step[0]) + std::fabs(step[1]) + std::fabs(step[2]) < 1e-4)
+        {
+            break;
+        }
+    }
+    return radius > 0;
+}
+
+bool LimbFit::Measure(const unsigned char *pixels, int width, int height,
+                      int offsetX, int offsetY, int threshold, LimbFitResult &result)
+{
+    result = LimbFitResult();
+    lPoints.clear();
+    if (pixels == NULL || width < 2 || height < 2 || threshold < 0 || threshold >= 255)
+    {
+        return false;
+    }
+    FindRowEdges(pixels, width, height, threshold);
+    FindColumnEdges(pixels, width, height, threshold);
+    result.points = lPoints.size();
+
+    std::vector<char> use(lPoints.size(), 1);
+    double x, y, radius;
+    if (!FitCircle(use, x, y, radius))
+    {
+        return false;
+    }
+
+    // drop points far from the circle (sky spikes, spots near the limb,
+    // the edge of a clipped disk) and fit the rest until nothing changes
+    std::vector<double> residuals(lPoints.size());
+    std::vector<double> magnitudes;
+    for (int iteration = 0; iteration < LIMBFIT_ITERATIONS; iteration++)
+    {
+        magnitudes.clear();
+        for (size_t i = 0; i < lPoints.size(); i++)
+        {
+            residuals[i] = std::hypot(lPoints[i].x - x, lPoints[i].y - y) - radius;
+            if (use[i])
+            {
+                magnitudes.push_back(std::fabs(residuals[i]));
+            }
+        }
+        std::nth_element(magnitudes.begin(), magnitudes.begin() + magnitudes.size() / 2, magnitudes.end());
+        double sigma = 1.4826 * magnitudes[magnitudes.size() / 2];
+        double limit = lRejection * std::max(sigma, LIMBFIT_MIN_SIGMA);
+
+        bool changed = false;
+        for (size_t i = 0; i < lPoints.size(); i++)
+        {
+            char keep = std::fabs(residuals[i]) <= limit;
+            changed |= (keep != use[i]);
+            use[i] = keep;
+        }
+        if (!changed || !FitCircle(use, x, y, radius))
+        {
+            break;
+        }
+    }
+    if (!RefineCircle(use, x, y, radius))
+    {
+        return false;
+    }
+
+    // quality: spread of the inliers about the circle, and how much of it they cover
+    double sum = 0;
+    int inliers = 0;
+    bool sectors[LIMBFIT_SECTORS] = {false};
+    for (size_t i = 0; i < lPoints.size(); i++)
+    {
+        if (!use[i])
+        {
+            continue;
+        }
+        double dx = lPoints[i].x - x, dy = lPoints[i].y - y;
+        double residual = std::sqrt(dx*dx + dy*dy) - radius;
+        sum += residual * residual;
+        inliers++;
+        int sector = (int)((std::atan2(dy, dx) + M_PI) / (2 * M_PI) * LIMBFIT_SECTORS);
+        sectors[std::min(std::max(sector, 0), LIMBFIT_SECTORS - 1)] = true;
+    }
+    result.inliers = inliers;
+    result.coverage = std::count(sectors, sectors + LIMBFIT_SECTORS, true) / (double)LIMBFIT_SECTORS;
+    result.rms = inliers > 0 ? std::sqrt(sum / inliers) : 0;
+    result.sigma = inliers > 0 ? result.rms * std::sqrt(2.0 / inliers) : 0;
+    result.x = offsetX + x;
+    result.y = offsetY + y;
+    result.radius = radius;
+    result.found = inliers >= lMinInliers && result.coverage >= lMinCoverage;
+    return result.found;
+}
@@ -0,0 +1,73 @@
+#ifndef _LIMBFIT_HPP_
+#define _LIMBFIT_HPP_
+
+#include <vector>
+
+// Circle through the limb of one frame
+struct LimbFitResult
+{
+    LimbFitResult(): found(false),
+                     x(0),
+                     y(0),
+                     radius(0),
+                     rms(0),
+                     sigma(0),
+                     points(0),
+                     inliers(0),
+                     coverage(0) {};
+    bool found;
+    double x, y;        // center in sensor pixels, readout window offset included
+    double radius;      // pixels
+    double rms;         // of the inlier distances from the circle, pixels
+    double sigma;       // expected error of the center, rms * sqrt(2 / inliers)
+    int points;         // limb points found
+    int inliers;        // kept by the fit
+    double coverage;    // fraction of the 16 directions around the center with inliers
+};
+
+/* Second pointing solver, for when the thresholded centroid is biased:
+   a disk clipped by the sensor edge or the readout window, or a change
+   in limb darkening. Limb points are found where a sparse set of rows
+   and columns first cross a threshold coming in from the sky, placed
+   to a fraction of a pixel by interpolation, and a circle is fitted to
+   them by least squares, dropping points far from it and fitting again.
+   Crossings at the frame edge are not limb and are never used.
+   Rows are searched 16 pixels at a time with SSE2 when built with it,
+   columns coarse to fine, so only a few percent of the frame is read.
+*/
+class LimbFit
+{
+public:
+    LimbFit();
+
+    // every spacing-th row and column is searched
+    void SetSpacing(int spacing);
+    // points further out than this many times the robust sigma are dropped
+    void SetRejection(double sigmas);
+    // a solution needs at least this many inliers and this coverage
+    void SetMinimum(int inliers, double coverage);
+
+    /* 8-bit frame, threshold between sky and limb (e.g. the centroid's)
+       returns true and fills result when a circle is fitted
+    */
+    bool Measure(const unsigned char *pixels, int width, int height,
+                 int offsetX, int offsetY, int threshold, LimbFitResult &result);
+
+private:
+    struct Point
+    {
+        double x, y;
+    };
+    void FindRowEdges(const unsigned char *pixels, int width, int height, int threshold);
+    void FindColumnEdges(const unsigned char *pixels, int width, int height, int threshold);
+    bool FitCircle(const std::vector<char> &use, double &x, double &y, double &radius);
+    bool RefineCircle(const std::vector<char> &use, double &x, double &y, double &radius);
+
+    int lSpacing;
+    double lRejection;
+    int lMinInliers;
+    double lMinCoverage;
+    std::vector<Point> lPoints;
+};
+
+#endif
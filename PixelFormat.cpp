@@ -0,0 +1,273 @@
+#include "PixelFormat.hpp"
+
+#include <string.h>
+
+#ifdef __SSSE3__
+#include <tmmintrin.h>
+#endif
+
+const char *PixelFormatName(PixelFormat format)
+{
+    switch (format)
+    {
+    case MONO10:
+        return "Mono10";
+    case MONO12:
+        return "Mono12";
+    case MONO10_PACKED:
+        return "Mono10Packed";
+    case MONO12_PACKED:
+        return "Mono12Packed";
+    default:
+        return "Mono8";
+    }
+}
+
+PixelFormat PixelFormatFor(int bits, bool packed)
+{
+    switch (bits)
+    {
+    case 10:
+        return packed ? MONO10_PACKED : MONO10;
+    case 12:
+        return packed ? MONO12_PACKED : MONO12;
+    default:
+        return MONO8;
+    }
+}
+
+int PixelBits(PixelFormat format)
+{
+    switch (format)
+    {
+    case MONO10:
+    case MONO10_PACKED:
+        return 10;
+    case MONO12:
+    case MONO12_PACKED:
+        return 12;
+    default:
+        return 8;
+    }
+}
+
+bool IsPacked(PixelFormat format)
+{
+    return format == MONO10_PACKED || format == MONO12_PACKED;
+}
+
+size_t PixelBytes(PixelFormat format, size_t pixels)
+{
+    switch (format)
+    {
+    case MONO10:
+    case MONO12:
+        return pixels * 2;
+    case MONO10_PACKED:
+    case MONO12_PACKED:
+        return pixels * 3 / 2;
+    default:
+        return pixels;
+    }
+}
+
+namespace
+{
+    void UnpackMono8(const unsigned char *src, uint16_t *dst, size_t pixels)
+    {
+        size_t i = 0;
+#ifdef __SSSE3__
+        const __m128i zero = _mm_setzero_si128();
+        for (; i + 16 <= pixels; i += 16)
+        {
+            __m128i in = _mm_loadu_si128((const __m128i *)(src + i));
+            _mm_storeu_si128((__m128i *)(dst + i), _mm_unpacklo_epi8(in, zero));
+            _mm_storeu_si128((__m128i *)(dst + i + 8), _mm_unpackhi_epi8(in, zero));
+        }
+#endif
+        for (; i < pixels; i++)
+        {
+            dst[i] = src[i];
+        }
+    }
+
+    /* Each triplet b0 b1 b2 goes into two 16-bit lanes, b0:b1 for the
+       even pixel and b2:b1 for the odd one (high:low byte), after which
+       both pixels are a shift and a mask away. 16-byte loads cover four
+       triplets, so the vector loop stops while 16 bytes remain readable.
+    */
+    void UnpackMono12Packed(const unsigned char *src, uint16_t *dst, size_t pixels)
+    {
+        size_t i = 0;
+#ifdef __SSSE3__
+        const size_t bytes = pixels * 3 / 2;
+        const __m128i spread = _mm_setr_epi8(1, 0, 1, 2, 4, 3, 4, 5, 7, 6, 7, 8, 10, 9, 10, 11);
+        // even: (b0:b1 >> 4) & 0xff0 | b1 & 0xf    odd: b2:b1 >> 4
+        const __m128i highMask = _mm_setr_epi16(0x0ff0, 0x0fff, 0x0ff0, 0x0fff,
+                                                0x0ff0, 0x0fff, 0x0ff0, 0x0fff);
+        const __m128i lowMask = _mm_setr_epi16(0x000f, 0, 0x000f, 0, 0x000f, 0, 0x000f, 0);
+        for (; (i / 2) * 3 + 16 <= bytes; i += 8)
+        {
+            __m128i in = _mm_loadu_si128((const __m128i *)(src + (i / 2) * 3));
+            __m128i lanes = _mm_shuffle_epi8(in, spread);
+            __m128i out = _mm_or_si128(_mm_and_si128(_mm_srli_epi16(lanes, 4), highMask),
+                                       _mm_and_si128(lanes, lowMask));
+            _mm_storeu_si128((__m128i *)(dst + i), out);
+        }
+#endif
+        for (; i + 1 < pixels; i += 2)
+        {
+            const unsigned char *b = src + (i / 2) * 3;
+            dst[i] = (b[0] << 4) | (b[1] & 0x0f);
+            dst[i + 1] = (b[2] << 4) | (b[1] >> 4);
+        }
+    }
+
+    void UnpackMono10Packed(const unsigned char *src, uint16_t *dst, size_t pixels)
+    {
+        size_t i = 0;
+#ifdef __SSSE3__
+        const size_t bytes = pixels * 3 / 2;
+        const __m128i spread = _mm_setr_epi8(1, 0, 1, 2, 4, 3, 4, 5, 7, 6, 7, 8, 10, 9, 10, 11);
+        // both: (hi:b1 >> 6) & 0x3fc, plus b1 & 3 for even and (b1 >> 4) & 3 for odd
+        const __m128i highMask = _mm_set1_epi16(0x03fc);
+        const __m128i evenMask = _mm_setr_epi16(3, 0, 3, 0, 3, 0, 3, 0);
+        const __m128i oddMask = _mm_setr_epi16(0, 3, 0, 3, 0, 3, 0, 3);
+        for (; (i / 2) * 3 + 16 <= bytes; i += 8)
+        {
+            __m128i in = _mm_loadu_si128((const __m128i *)(src + (i / 2) * 3));
+            __m128i lanes = _mm_shuffle_epi8(in, spread);
+            __m128i out = _mm_and_si128(_mm_srli_epi16(lanes, 6), highMask);
+            out = _mm_or_si128(out, _mm_and_si128(lanes, evenMask));
+            out = _mm_or_si128(out, _mm_and_si128(_mm_srli_epi16(lanes, 4), oddMask));
+            _mm_storeu_si128((__m128i *)(dst + i), out);
+        }
+#endif
+        for (; i + 1 < pixels; i += 2)
+        {
+            const unsigned char *b = src + (i / 2) * 3;
+            dst[i] = (b[0] << 2) | (b[1] & 0x03);
+            dst[i + 1] = (b[2] << 2) | ((b[1] >> 4) & 0x03);
+        }
+    }
+
+    void ReduceMono16(const uint16_t *src, unsigned char *dst, size_t pixels, int shift)
+    {
+        size_t i = 0;
+#ifdef __SSSE3__
+        const __m128i count = _mm_cvtsi32_si128(shift);
+        for (; i + 16 <= pixels; i += 16)
+        {
+            __m128i a = _mm_srl_epi16(_mm_loadu_si128((const __m128i *)(src + i)), count);
+            __m128i b = _mm_srl_epi16(_mm_loadu_si128((const __m128i *)(src + i + 8)), count);
+            // out of range values from a misconfigured camera saturate
+            _mm_storeu_si128((__m128i *)(dst + i), _mm_packus_epi16(a, b));
+        }
+#endif
+        for (; i < pixels; i++)
+        {
+            int value = src[i] >> shift;
+            dst[i] = value > 255 ? 255 : value;
+        }
+    }
+
+    // the top 8 bits are whole bytes in both packed formats
+    void ReducePacked(const unsigned char *src, unsigned char *dst, size_t pixels)
+    {
+        size_t i = 0;
+#ifdef __SSSE3__
+        const size_t bytes = pixels * 3 / 2;
+        const __m128i low = _mm_setr_epi8(0, 2, 3, 5, 6, 8, 9, 11, -1, -1, -1, -1, -1, -1, -1, -1);
+        const __m128i high = _mm_setr_epi8(-1, -1, -1, -1, -1, -1, -1, -1, 0, 2, 3, 5, 6, 8, 9, 11);
+        for (; (i / 2) * 3 + 28 <= bytes; i += 16)
+        {
+            const unsigned char *b = src + (i / 2) * 3;
+            __m128i a = _mm_shuffle_epi8(_mm_loadu_si128((const __m128i *)b), low);
+            __m128i c = _mm_shuffle_epi8(_mm_loadu_si128((const __m128i *)(b + 12)), high);
+            _mm_storeu_si128((__m128i *)(dst + i), _mm_or_si128(a, c));
+        }
+#endif
+        for (; i + 1 < pixels; i += 2)
+        {
+            const unsigned char *b = src + (i / 2) * 3;
+            dst[i] = b[0];
+            dst[i + 1] = b[2];
+        }
+    }
+}
+
+void UnpackPixels(const unsigned char *src, PixelFormat format, uint16_t *dst, size_t pixels)
+{
+    switch (format)
+    {
+    case MONO10:
+    case MONO12:
+        // already one little-endian word per pixel
+        memcpy(dst, src, pixels * 2);
+        break;
+    case MONO10_PACKED:
+        UnpackMono10Packed(src, dst, pixels);
+        break;
+    case MONO12_PACKED:
+        UnpackMono12Packed(src, dst, pixels);
+        break;
+    default:
+        UnpackMono8(src, dst, pixels);
+        break;
+    }
+}
+
+void ReducePixels(const unsigned char *src, PixelFormat format, unsigned char *dst, size_t pixels)
+{
+    switch (format)
+    {
+    case MONO10:
+        ReduceMono16((const uint16_t *)src, dst, pixels, 2);
+        break;
+    case MONO12:
+        ReduceMono16((const uint16_t *)src, dst, pixels, 4);
+        break;
+    case MONO10_PACKED:
+    case MONO12_PACKED:
+        ReducePacked(src, dst, pixels);
+        break;
+    default:
+        memcpy(dst, src, pixels);
+        break;
+    }
+}
+
+void PackPixels(const uint16_t *src, PixelFormat format, unsigned char *dst, size_t pixels)
+{
+    switch (format)
+    {
+    case MONO10:
+    case MONO12:
+        memcpy(dst, src, pixels * 2);
+        break;
+    case MONO10_PACKED:
+        for (size_t i = 0; i + 1 < pixels; i += 2)
+        {
+            unsigned char *b = dst + (i / 2) * 3;
+            b[0] = src[i] >> 2;
+            b[1] = (src[i] & 0x03) | ((src[i + 1] & 0x03) << 4);
+            b[2] = src[i + 1] >> 2;
+        }
+        break;
+    case MONO12_PACKED:
+        for (size_t i = 0; i + 1 < pixels; i += 2)
+        {
+            unsigned char *b = dst + (i / 2) * 3;
+            b[0] = src[i] >> 4;
+            b[1] = (src[i] & 0x0f) | ((src[i + 1] & 0x0f) << 4);
+            b[2] = src[i + 1] >> 4;
+        }
+        break;
+    default:
+        for (size_t i = 0; i < pixels; i++)
+        {
+            dst[i] = src[i];
+        }
+        break;
+    }
+}
@@ -0,0 +1,54 @@
+#ifndef _PIXELFORMAT_HPP_
+#define _PIXELFORMAT_HPP_
+
+#include <stddef.h>
+#include <stdint.h>
+
+/* Monochrome GigE Vision pixel formats the Imperx can send. The 10 and
+   12 bit formats come either unpacked, one little-endian 16-bit word per
+   pixel, or packed, two pixels in three bytes:
+     Mono12Packed  b0 = p0[11:4]  b1 = p1[3:0] << 4 | p0[3:0]  b2 = p1[11:4]
+     Mono10Packed  b0 = p0[9:2]   b1 = p1[1:0] << 4 | p0[1:0]  b2 = p1[9:2]
+   so the first and last byte of each triplet hold the top 8 bits.
+*/
+enum PixelFormat { MONO8, MONO10, MONO12, MONO10_PACKED, MONO12_PACKED };
+
+// GenICam PixelFormat enum entry, e.g. "Mono12Packed"
+const char *PixelFormatName(PixelFormat format);
+// from a bit depth (8, 10 or 12) and whether the camera packs pixels
+PixelFormat PixelFormatFor(int bits, bool packed);
+int PixelBits(PixelFormat format);
+bool IsPacked(PixelFormat format);
+// bytes a frame of that many pixels takes on the wire and in the buffer
+size_t PixelBytes(PixelFormat format, size_t pixels);
+
+// top 8 bits of one pixel, for sampling code that only needs a level
+inline int PixelLevel(const unsigned char *data, PixelFormat format, size_t index)
+{
+    switch (format)
+    {
+    case MONO10:
+        return ((const uint16_t *)data)[index] >> 2;
+    case MONO12:
+        return ((const uint16_t *)data)[index] >> 4;
+    case MONO10_PACKED:
+    case MONO12_PACKED:
+        return data[(index >> 1) * 3 + (index & 1) * 2];
+    default:
+        return data[index];
+    }
+}
+
+/* Frame conversions, SSSE3 when built with it and scalar otherwise.
+   UnpackPixels widens any format to one 16-bit word per pixel holding
+   the camera's own value (0-255, 0-1023 or 0-4095), for saving.
+   ReducePixels keeps the top 8 bits of each pixel, for the display.
+   Packed frames must have an even number of pixels.
+*/
+void UnpackPixels(const unsigned char *src, PixelFormat format, uint16_t *dst, size_t pixels);
+void ReducePixels(const unsigned char *src, PixelFormat format, unsigned char *dst, size_t pixels);
+
+// the opposite of UnpackPixels, for generated frames
+void PackPixels(const uint16_t *src, PixelFormat format, unsigned char *dst, size_t pixels);
+
+#endif
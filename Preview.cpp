@@ -0,0 +1,41 @@
+#include "Preview.hpp"
+
+#include <stddef.h>
+
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+
+void HalvePixels(const unsigned char *src, int width, int height, unsigned char *dst)
+{
+    int outWidth = width / 2, outHeight = height / 2;
+    for (int y = 0; y < outHeight; y++)
+    {
+        const unsigned char *top = src + (size_t)(2 * y) * width;
+        const unsigned char *bottom = top + width;
+        unsigned char *out = dst + (size_t)y * outWidth;
+        int x = 0;
+#ifdef __SSE2__
+        // even and odd pixels of each row as words, summed over the block
+        const __m128i even = _mm_set1_epi16(0x00ff);
+        const __m128i two = _mm_set1_epi16(2);
+        for (; x + 16 <= outWidth; x += 16)
+        {
+            __m128i sums[2];
+            for (int k = 0; k < 2; k++)
+            {
+                __m128i a = _mm_loadu_si128((const __m128i *)(top + 2 * x + 16 * k));
+                __m128i b = _mm_loadu_si128((const __m128i *)(bottom + 2 * x + 16 * k));
+                __m128i s = _mm_add_epi16(_mm_and_si128(a, even), _mm_srli_epi16(a, 8));
+                s = _mm_add_epi16(s, _mm_add_epi16(_mm_and_si128(b, even), _mm_srli_epi16(b, 8)));
+                sums[k] = _mm_srli_epi16(_mm_add_epi16(s, two), 2);
+            }
+            _mm_storeu_si128((__m128i *)(out + x), _mm_packus_epi16(sums[0], sums[1]));
+        }
+#endif
+        for (; x < outWidth; x++)
+        {
+            out[x] = (top[2 * x] + top[2 * x + 1] + bottom[2 * x] + bottom[2 * x + 1] + 2) >> 2;
+        }
+    }
+}
@@ -0,0 +1,11 @@
+#ifndef _PREVIEW_HPP_
+#define _PREVIEW_HPP_
+
+/* Half-size copy of an 8-bit frame, each pixel the rounded mean of a
+   2x2 block, for previews that cost what the screen shows rather than
+   what the sensor reads out. An odd last row or column is dropped.
+   SSE2 when built with it, 32 pixels of two rows at a time.
+*/
+void HalvePixels(const unsigned char *src, int width, int height, unsigned char *dst);
+
+#endif
@@ -0,0 +1,300 @@
+#include "Realtime.hpp"
+
+#include <iostream>
+#include <fstream>
+#include <sstream>
+#include <string>
+#include <algorithm>
+#include <sched.h>
+#include <sys/mman.h>
+#include <unistd.h>
+#include <alloca.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <limits.h>
+
+#define REALTIME_STACK_MARGIN   (16 * 1024)     // left untouched below a configured stack
+#define REALTIME_PREFAULT       (256 * 1024)    // touched on a default-sized stack
+
+namespace
+{
+    void FillCpuSet(unsigned long cpus, cpu_set_t &set)
+    {
+        CPU_ZERO(&set);
+        long online = sysconf(_SC_NPROCESSORS_ONLN);
+        for (long cpu = 0; cpu < online && cpu < CPU_SETSIZE; cpu++)
+        {
+            // no mask means any CPU, not whatever the creator was pinned to
+            if (cpus == 0 || (cpu < (long)(8 * sizeof(cpus)) && (cpus >> cpu) & 1))
+            {
+                CPU_SET(cpu, &set);
+            }
+        }
+    }
+
+    bool ParseRole(const std::string &name, ThreadRole &role)
+    {
+        for (int r = 0; r < ROLE_COUNT; r++)
+        {
+            if (name == RealtimeProfile::RoleName((ThreadRole)r))
+            {
+                role = (ThreadRole)r;
+                return true;
+            }
+        }
+        return false;
+    }
+}
+
+RealtimeProfile::RealtimeProfile()
+    : lLockMemory(false)
+{
+}
+
+const char *RealtimeProfile::RoleName(ThreadRole role)
+{
+    switch (role)
+    {
+    case ROLE_CAMERA:
+        return "camera";
+    case ROLE_CONTROL:
+        return "control";
+    case ROLE_SAVE:
+        return "save";
+    case ROLE_DISPLAY:
+        return "display";
+    default:
+        return "unknown";
+    }
+}
+
+int RealtimeProfile::Load(const char *fileName)
+{
+    std::ifstream file(fileName);
+    if (!file.is_open())
+    {
+        return -1;
+    }
+
+    int entries = 0;
+    std::string line;
+    while (std::getline(file, line))
+    {
+        line = line.substr(0, line.find('#'));
+        std::istringstream fields(line);
+        std::string name;
+        if (!(fields >> name))
+        {
+            continue;
+        }
+
+        if (name == "lock_memory")
+        {
+            int lock;
+            if (fields >> lock)
+            {
+                lLockMemory = lock;
+                entries++;
+            }
+            continue;
+        }
+
+        ThreadRole role;
+        RoleSchedule schedule;
+        std::string cpus;
+        if (!ParseRole(name, role) || !(fields >> schedule.priority >> cpus))
+        {
+            std::cout << "RealtimeProfile::Load Ignoring \"" << line << "\"" << std::endl;
+            continue;
+        }
+        schedule.cpus = strtoul(cpus.c_str(), NULL, 0);
+        long stackKb;
+        if (fields >> stackKb && stackKb > 0)
+        {
+            schedule.stackSize = stackKb * 1024;
+        }
+        Set(role, schedule);
+        entries++;
+    }
+    return entries;
+}
+
+void RealtimeProfile::Set(ThreadRole role, const RoleSchedule &schedule)
+{
+    RoleSchedule &entry = lRoles[role];
+    entry = schedule;
+    entry.priority = std::min(std::max(schedule.priority, 0), sched_get_priority_max(SCHED_FIFO));
+    if (entry.stackSize > 0)
+    {
+        entry.stackSize = std::max(entry.stackSize, (size_t)PTHREAD_STACK_MIN + REALTIME_STACK_MARGIN);
+    }
+}
+
+const RoleSchedule &RealtimeProfile::Get(ThreadRole role) const
+{
+    return lRoles[role];
+}
+
+void RealtimeProfile::SetLockMemory(bool lock)
+{
+    lLockMemory = lock;
+}
+
+int RealtimeProfile::LockMemory()
+{
+    if (!lLockMemory)
+    {
+        return 0;
+    }
+    // future mappings too, so pipeline buffers and thread stacks are
+    // resident from the moment they are allocated
+    if (mlockall(MCL_CURRENT | MCL_FUTURE) != 0)
+    {
+        std::cout << "RealtimeProfile::LockMemory mlockall failed: " << strerror(errno) << std::endl;
+        return -1;
+    }
+    return 0;
+}
+
+int RealtimeProfile::Prepare(pthread_attr_t *attr, ThreadRole role) const
+{
+    const RoleSchedule &schedule = lRoles[role];
+    sched_param param;
+    memset(&param, 0, sizeof(param));
+    param.sched_priority = schedule.priority;
+
+    int rc = pthread_attr_setinheritsched(attr, PTHREAD_EXPLICIT_SCHED);
+    rc |= pthread_attr_setschedpolicy(attr, schedule.priority > 0 ? SCHED_FIFO : SCHED_OTHER);
+    rc |= pthread_attr_setschedparam(attr, &param);
+
+    cpu_set_t set;
+    FillCpuSet(schedule.cpus, set);
+    rc |= pthread_attr_setaffinity_np(attr, sizeof(set), &set);
+
+    if (schedule.stackSize > 0)
+    {
+        rc |= pthread_attr_setstacksize(attr, schedule.stackSize);
+    }
+    return (rc == 0) ? 0 : -1;
+}
+
+int RealtimeProfile::ApplyToSelf(ThreadRole role) const
+{
+    const RoleSchedule &schedule = lRoles[role];
+    sched_param param;
+    memset(&param, 0, sizeof(param));
+    param.sched_priority = schedule.priority;
+
+    int rc = pthread_setschedparam(pthread_self(), schedule.priority > 0 ? SCHED_FIFO : SCHED_OTHER, &param);
+    if (rc != 0)
+    {
+        std::cout << "RealtimeProfile::ApplyToSelf " << RoleName(role) << " scheduling: " << strerror(rc) << std::endl;
+    }
+    cpu_set_t set;
+    FillCpuSet(schedule.cpus, set);
+    int affinity = pthread_setaffinity_np(pthread_self(), sizeof(set), &set);
+    if (affinity != 0)
+    {
+        std::cout << "RealtimeProfile::ApplyToSelf " << RoleName(role) << " affinity: " << strerror(affinity) << std::endl;
+    }
+    return (rc == 0 && affinity == 0) ? 0 : -1;
+}
+
+void RealtimeProfile::PrefaultStack(ThreadRole role) const
+{
+    size_t stackSize = lRoles[role].stackSize;
+    size_t bytes = (stackSize > 0) ? stackSize - REALTIME_STACK_MARGIN : REALTIME_PREFAULT;
+    long page = sysconf(_SC_PAGESIZE);
+    volatile unsigned char *stack = (volatile unsigned char *)alloca(bytes);
+    for (size_t i = 0; i < bytes; i += page)
+    {
+        stack[i] = 0;
+    }
+}
+
+void RealtimeProfile::Print(FILE *out) const
+{
+    for (int r = 0; r < ROLE_COUNT; r++)
+    {
+        const RoleSchedule &schedule = lRoles[r];
+        fprintf(out, "%-8s %s %2d cpus 0x%lx stack %zu kB\n", RoleName((ThreadRole)r),
+                schedule.priority > 0 ? "FIFO " : "OTHER", schedule.priority,
+                schedule.cpus, schedule.stackSize / 1024);
+    }
+    fprintf(out, "memory %slocked\n", lLockMemory ? "" : "not ");
+}
+
+JitterHistogram::JitterHistogram()
+{
+    Reset();
+}
+
+void JitterHistogram::Reset()
+{
+    memset(lBuckets, 0, sizeof(lBuckets));
+    lCount = 0;
+    lMax = 0;
+}
+
+void JitterHistogram::Add(double usec)
+{
+    if (usec < 0)
+    {
+        usec = -usec;
+    }
+    int bucket = 0;
+    while (bucket < BUCKETS - 1 && usec >= (double)(1L << bucket))
+    {
+        bucket++;
+    }
+    lBuckets[bucket]++;
+    lCount++;
+    lMax = std::max(lMax, usec);
+}
+
+long JitterHistogram::Count() const
+{
+    return lCount;
+}
+
+double JitterHistogram::Max() const
+{
+    return lMax;
+}
+
+double JitterHistogram::Percentile(double fraction) const
+{
+    long wanted = (long)(lCount * fraction);
+    long count = 0;
+    for (int bucket = 0; bucket < BUCKETS - 1; bucket++)
+    {
+        count += lBuckets[bucket];
+        if (count >= wanted)
+        {
+            return (double)(1L << bucket);
+        }
+    }
+    return lMax;
+}
+
+void JitterHistogram::Print(FILE *out, const char *label) const
+{
+    fprintf(out, "%s jitter (%ld):", label, lCount);
+    for (int bucket = 0; bucket < BUCKETS; bucket++)
+    {
+        if (lBuckets[bucket] == 0)
+        {
+            continue;
+        }
+        if (bucket < BUCKETS - 1)
+        {
+            fprintf(out, " <%ldus:%ld", 1L << bucket, lBuckets[bucket]);
+        }
+        else
+        {
+            fprintf(out, " >=%ldus:%ld", 1L << (bucket - 1), lBuckets[bucket]);
+        }
+    }
+    fprintf(out, " max %.0fus\n", lMax);
+}
@@ -0,0 +1,87 @@
+#ifndef _REALTIME_HPP_
+#define _REALTIME_HPP_
+
+#include <pthread.h>
+#include <stddef.h>
+#include <stdio.h>
+
+// what a thread does decides how it is scheduled
+enum ThreadRole { ROLE_CAMERA, ROLE_CONTROL, ROLE_SAVE, ROLE_DISPLAY, ROLE_COUNT };
+
+struct RoleSchedule
+{
+    RoleSchedule(): priority(0),
+                    cpus(0),
+                    stackSize(0) {};
+    int priority;               // SCHED_FIFO 1-99, 0 for the normal scheduler
+    unsigned long cpus;         // affinity, bit n for CPU n, 0 for any
+    size_t stackSize;           // bytes, 0 for the default
+};
+
+/* How acquisition wins the few cores of the SBC against saving and
+   drawing: a scheduling class, priority, CPU set and stack per thread
+   role, and whether all memory is locked. Nothing changes unless a
+   profile is loaded. Profile file, # starts a comment:
+     role priority cpus [stack_kb]      e.g. camera 80 0x2 256
+     lock_memory 0|1
+   roles are camera, control, save and display
+*/
+class RealtimeProfile
+{
+public:
+    RealtimeProfile();
+
+    // returns the number of entries read, -1 if the file can't be read
+    int Load(const char *fileName);
+    void Set(ThreadRole role, const RoleSchedule &schedule);
+    const RoleSchedule &Get(ThreadRole role) const;
+    void SetLockMemory(bool lock);
+
+    // mlockall() if the profile asks for it, returns 0 on success or when not asked
+    int LockMemory();
+    /* Fills attr for a thread of that role, the attributes are always
+       explicit so threads don't inherit real-time scheduling from their
+       creator. Returns 0 on success, -1 otherwise
+    */
+    int Prepare(pthread_attr_t *attr, ThreadRole role) const;
+    // the same for the calling thread, e.g. the GLUT main thread
+    int ApplyToSelf(ThreadRole role) const;
+    /* Touches the stack the thread will use, from inside it, so page
+       faults happen at start-up instead of in the middle of a frame
+    */
+    void PrefaultStack(ThreadRole role) const;
+
+    static const char *RoleName(ThreadRole role);
+    void Print(FILE *out) const;
+
+private:
+    RoleSchedule lRoles[ROLE_COUNT];
+    bool lLockMemory;
+};
+
+/* Histogram of timing deviations in power-of-two microsecond buckets,
+   e.g. of when frames are handed over compared with when the camera
+   took them. Fed and read by the same thread.
+*/
+class JitterHistogram
+{
+public:
+    enum { BUCKETS = 20 };      // the last one holds everything from 2^18 us up
+
+    JitterHistogram();
+    void Reset();
+    void Add(double usec);
+    long Count() const;
+    double Max() const;
+    // smallest bucket bound that holds at least the fraction of samples
+    double Percentile(double fraction) const;
+    // one line, "<1us:n <2us:n ... max"
+    void Print(FILE *out, const char *label) const;
+
+private:
+    long lBuckets[BUCKETS];
+    long lCount;
+    double lMax;
+};
+
+#endif
@@ -0,0 +1,219 @@
+#include "StreamHealth.hpp"
+
+#include <algorithm>
+#include <vector>
+
+namespace
+{
+    double Seconds(const timespec &t)
+    {
+        return t.tv_sec + t.tv_nsec / 1e9;
+    }
+}
+
+const char *StreamHealthReport::CauseName() const
+{
+    switch (cause)
+    {
+    case LINK_LOSS:
+        return "link loss";
+    case BACKPRESSURE:
+        return "backpressure";
+    case STALLED:
+        return "stalled";
+    default:
+        return "healthy";
+    }
+}
+
+StreamHealth::StreamHealth()
+    : lWindow(5)
+{
+    pthread_mutex_init(&lMutex, NULL);
+    Reset();
+}
+
+StreamHealth::~StreamHealth()
+{
+    pthread_mutex_destroy(&lMutex);
+}
+
+void StreamHealth::SetWindow(int seconds)
+{
+    pthread_mutex_lock(&lMutex);
+    lWindow = std::max(seconds, 1);
+    pthread_mutex_unlock(&lMutex);
+}
+
+void StreamHealth::Reset()
+{
+    pthread_mutex_lock(&lMutex);
+    lBuckets.clear();
+    lIntervals.clear();
+    lLastFrame = 0;
+    lStarted = 0;
+    lTotals = StreamHealthReport();
+    pthread_mutex_unlock(&lMutex);
+}
+
+StreamHealth::Bucket &StreamHealth::Current(const timespec &now)
+{
+    if (lBuckets.empty() || lBuckets.back().second != now.tv_sec)
+    {
+        Bucket bucket = Bucket();
+        bucket.second = now.tv_sec;
+        lBuckets.push_back(bucket);
+    }
+    if (lStarted == 0)
+    {
+        lStarted = Seconds(now);
+    }
+    Prune(Seconds(now));
+    return lBuckets.back();
+}
+
+void StreamHealth::Prune(double now)
+{
+    while (!lBuckets.empty() && lBuckets.front().second <= now - lWindow - 1)
+    {
+        lBuckets.pop_front();
+    }
+    while (!lIntervals.empty() && lIntervals.front().first < now - lWindow)
+    {
+        lIntervals.pop_front();
+    }
+}
+
+void StreamHealth::Frame(const timespec &now, int blockGap, int packetsMissing, int packetsResent,
+                         int queued, int bufferCount, long bytes)
+{
+    pthread_mutex_lock(&lMutex);
+    Bucket &bucket = Current(now);
+    bucket.frames++;
+    bucket.blockGaps += blockGap;
+    bucket.packetsMissing += packetsMissing;
+    bucket.packetsResent += packetsResent;
+    bucket.bytes += bytes;
+    bucket.queuePeak = std::max(bucket.queuePeak, queued);
+    bucket.bufferCount = bufferCount;
+
+    double t = Seconds(now);
+    if (lLastFrame > 0)
+    {
+        lIntervals.push_back(std::make_pair(t, t - lLastFrame));
+    }
+    lLastFrame = t;
+
+    lTotals.totalFrames++;
+    lTotals.totalGaps += blockGap;
+    lTotals.totalMissing += packetsMissing;
+    lTotals.totalResent += packetsResent;
+    pthread_mutex_unlock(&lMutex);
+}
+
+void StreamHealth::Failure(const timespec &now, int blockGap, int packetsMissing, int packetsResent, int code)
+{
+    pthread_mutex_lock(&lMutex);
+    Bucket &bucket = Current(now);
+    bucket.failures++;
+    bucket.blockGaps += blockGap;
+    bucket.packetsMissing += packetsMissing;
+    bucket.packetsResent += packetsResent;
+
+    lTotals.totalFailures++;
+    lTotals.lastFailure = code;
+    lTotals.totalGaps += blockGap;
+    lTotals.totalMissing += packetsMissing;
+    lTotals.totalResent += packetsResent;
+    pthread_mutex_unlock(&lMutex);
+}
+
+void StreamHealth::Timeout(const timespec &now)
+{
+    pthread_mutex_lock(&lMutex);
+    Current(now).timeouts++;
+    lTotals.totalTimeouts++;
+    pthread_mutex_unlock(&lMutex);
+}
+
+void StreamHealth::Reordered(const timespec &now)
+{
+    pthread_mutex_lock(&lMutex);
+    Current(now).reordered++;
+    lTotals.totalReordered++;
+    pthread_mutex_unlock(&lMutex);
+}
+
+StreamHealthReport StreamHealth::Report(const timespec &now)
+{
+    pthread_mutex_lock(&lMutex);
+    double t = Seconds(now);
+    Prune(t);
+
+    StreamHealthReport report = lTotals;
+    for (size_t i = 0; i < lBuckets.size(); i++)
+    {
+        const Bucket &bucket = lBuckets[i];
+        report.frames += bucket.frames;
+        report.blockGaps += bucket.blockGaps;
+        report.failures += bucket.failures;
+        report.timeouts += bucket.timeouts;
+        report.reordered += bucket.reordered;
+        report.packetsMissing += bucket.packetsMissing;
+        report.packetsResent += bucket.packetsResent;
+        report.bandwidth += bucket.bytes;
+        report.queuePeak = std::max(report.queuePeak, bucket.queuePeak);
+        report.bufferCount = bucket.bufferCount ? bucket.bufferCount : report.bufferCount;
+    }
+    // whole seconds are kept, so the window reaches back to the start of the oldest one
+    report.window = lBuckets.empty() ? 0 : t - std::max((double)lBuckets.front().second, lStarted);
+    if (report.window > 0)
+    {
+        report.frameRate = report.frames / report.window;
+        report.bandwidth /= report.window;
+    }
+    else
+    {
+        report.bandwidth = 0;
+    }
+
+    std::vector<double> intervals;
+    intervals.reserve(lIntervals.size());
+    for (size_t i = 0; i < lIntervals.size(); i++)
+    {
+        intervals.push_back(lIntervals[i].second * 1e3);
+    }
+    pthread_mutex_unlock(&lMutex);
+
+    if (!intervals.empty())
+    {
+        size_t p50 = intervals.size() / 2;
+        size_t p99 = std::min(intervals.size() - 1, (size_t)(intervals.size() * 0.99));
+        std::nth_element(intervals.begin(), intervals.begin() + p50, intervals.end());
+        report.intervalP50 = intervals[p50];
+        std::nth_element(intervals.begin(), intervals.begin() + p99, intervals.end());
+        report.intervalP99 = intervals[p99];
+        report.intervalMax = *std::max_element(intervals.begin() + p99, intervals.end());
+    }
+
+    // Missing packets or failed buffers with a shallow queue are the wire;
+    // whole frames lost while the queue was backed up are the consumer
+    bool backedUp = report.bufferCount > 0 && 2 * report.queuePeak >= report.bufferCount;
+    if (report.frames == 0 && report.timeouts > 0)
+    {
+        report.cause = StreamHealthReport::STALLED;
+    }
+    else if (report.blockGaps == 0 && report.failures == 0 && report.packetsMissing == 0)
+    {
+        report.cause = StreamHealthReport::HEALTHY;
+    }
+    else if (backedUp)
+    {
+        report.cause = StreamHealthReport::BACKPRESSURE;
+    }
+    else
+    {
+        report.cause = StreamHealthReport::LINK_LOSS;
+    }
+    return report;
+}
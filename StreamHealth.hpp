@@ -0,0 +1,118 @@
+#ifndef _STREAMHEALTH_HPP_
+#define _STREAMHEALTH_HPP_
+
+#include <pthread.h>
+#include <ctime>
+#include <deque>
+
+// Stream health over the last window, plus totals since Reset()
+struct StreamHealthReport
+{
+    // what the window points to: packets going missing on the wire, or
+    // the consumer not keeping up while the pipeline output queue backs up
+    enum Cause { HEALTHY, LINK_LOSS, BACKPRESSURE, STALLED };
+    // failures that have no operation result code of their own
+    enum { FAILURE_NOT_IMAGE = -1, FAILURE_NO_BUFFER = -2 };
+
+    StreamHealthReport(): window(0),
+                          frames(0),
+                          blockGaps(0),
+                          failures(0),
+                          timeouts(0),
+                          reordered(0),
+                          packetsMissing(0),
+                          packetsResent(0),
+                          queuePeak(0),
+                          bufferCount(0),
+                          frameRate(0),
+                          bandwidth(0),
+                          intervalP50(0),
+                          intervalP99(0),
+                          intervalMax(0),
+                          totalFrames(0),
+                          totalGaps(0),
+                          totalFailures(0),
+                          totalTimeouts(0),
+                          totalReordered(0),
+                          totalMissing(0),
+                          totalResent(0),
+                          lastFailure(0),
+                          cause(HEALTHY) {};
+    double window;          // seconds covered
+    long frames;
+    long blockGaps;         // frames that never arrived, from BlockID gaps
+    long failures;          // buffers delivered with a failed operation result
+    long timeouts;
+    long reordered;         // BlockIDs repeated or behind the last, not counted as gaps
+    long packetsMissing;
+    long packetsResent;
+    int queuePeak;          // deepest pipeline output queue seen
+    int bufferCount;        // pipeline depth at the time
+    double frameRate;       // frames per second
+    double bandwidth;       // payload bytes per second
+    double intervalP50;     // ms between delivered frames
+    double intervalP99;
+    double intervalMax;
+
+    long long totalFrames, totalGaps, totalFailures, totalTimeouts, totalReordered;
+    long long totalMissing, totalResent;
+    int lastFailure;        // the source's code for the latest failure, 0 for none yet
+
+    Cause cause;
+    const char *CauseName() const;
+};
+
+/* Rolling record of how a GigE stream is doing, fed by the source for
+   every retrieval and read by the HUD and the log. Counters are kept in
+   one-second buckets and inter-frame intervals as samples, both over the
+   last window. Safe to feed from one thread and read from others.
+*/
+class StreamHealth
+{
+public:
+    StreamHealth();
+    ~StreamHealth();
+
+    // window length in seconds, default 5
+    void SetWindow(int seconds);
+    void Reset();
+
+    /* now is CLOCK_MONOTONIC at delivery, blockGap the frames missing
+       before this one, queued/bufferCount the pipeline output queue and
+       depth, bytes the payload delivered
+    */
+    void Frame(const timespec &now, int blockGap, int packetsMissing, int packetsResent,
+               int queued, int bufferCount, long bytes);
+    // code says what failed, e.g. the operation result, see lastFailure
+    void Failure(const timespec &now, int blockGap, int packetsMissing, int packetsResent, int code);
+    void Timeout(const timespec &now);
+    // a buffer whose BlockID was a repeat or came out of order
+    void Reordered(const timespec &now);
+
+    StreamHealthReport Report(const timespec &now);
+
+private:
+    StreamHealth(const StreamHealth &);
+    StreamHealth &operator=(const StreamHealth &);
+
+    struct Bucket
+    {
+        long second;
+        long frames, blockGaps, failures, timeouts, reordered;
+        long packetsMissing, packetsResent, bytes;
+        int queuePeak, bufferCount;
+    };
+    Bucket &Current(const timespec &now);
+    void Prune(double now);
+
+    int lWindow;
+    std::deque<Bucket> lBuckets;
+    // (delivery time, interval) pairs in seconds
+    std::deque<std::pair<double, double> > lIntervals;
+    double lLastFrame;
+    double lStarted;        // first event since Reset()
+    StreamHealthReport lTotals;
+    pthread_mutex_t lMutex;
+};
+
+#endif
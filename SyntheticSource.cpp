@@ -0,0 +1,513 @@
+#include "SyntheticSource.hpp"
+
+#include <iostream>
+#include <algorithm>
+#include <cmath>
+#include <string.h>
+#include <time.h>
+
+#define SYNTHETIC_POOL_SIZE     8       // frames that may be leased out at once
+#define SYNTHETIC_NOISE_SIZE    65536   // entries in the precomputed noise table, power of 2
+#define SYNTHETIC_DISK_FLUX     0.05    // DN per usec at the disk center for unit gain
+#define SYNTHETIC_SKY_FRACTION  0.02    // scattered light level relative to the disk center
+#define SYNTHETIC_BITS          12      // depth the template and noise are kept at
+#define SYNTHETIC_SCALE         (1 << (SYNTHETIC_BITS - 8))     // from 8-bit DN
+
+namespace
+{
+    double TimespecToSec(const timespec &t)
+    {
+        return t.tv_sec + t.tv_nsec / 1e9;
+    }
+
+    timespec AddSec(timespec t, double sec)
+    {
+        long long ns = (long long)t.tv_sec * 1000000000LL + t.tv_nsec + (long long)(sec * 1e9);
+        t.tv_sec = ns / 1000000000LL;
+        t.tv_nsec = ns % 1000000000LL;
+        return t;
+    }
+}
+
+SyntheticSource::SyntheticSource()
+    : lWidth(1296)
+    , lHeight(966)
+    , lROI(0, 0, 1296, 966)
+    , lPixelFormat(MONO8)
+    , lMargin(32)
+    , lTemplateDirty(true)
+    , lRate(30.0)
+    , lJitter(0.0)
+    , lDiskX(648.0)
+    , lDiskY(483.0)
+    , lRadius(276.0)   // 16 arcmin at 3.47 arcsec/pixel
+    , lWander(4.0)
+    , lLimbDarkening(0.6)
+    , lNoiseSigma(2.0)
+    , lExposure(10000)
+    , lAnalogGain(400)
+    , lPreAmpGain(-3)
+    , lBlackLevel(0)
+    , lConnected(false)
+    , lInitialized(false)
+    , lStreaming(false)
+    , lBlockID(0)
+    , lImageCount(0)
+    , lSeed(2463534242u)
+{
+    lTemplate.resize((lWidth + 2*lMargin) * (lHeight + 2*lMargin));
+    for (int i = 0; i < SYNTHETIC_POOL_SIZE; i++)
+    {
+        // big enough for the widest format
+        lPool.push_back(std::make_shared<std::vector<unsigned char> >(lWidth * lHeight * 2));
+    }
+    lRow.resize(lWidth);
+    SetNoise(lNoiseSigma);
+    clock_gettime(CLOCK_MONOTONIC, &lStart);
+    clock_gettime(CLOCK_REALTIME, &lRealtimeStart);
+    lNextDue = lStart;
+    pthread_mutex_init(&lROIMutex, NULL);
+}
+
+SyntheticSource::~SyntheticSource()
+{
+    Stop();
+    Disconnect();
+    pthread_mutex_destroy(&lROIMutex);
+}
+
+void SyntheticSource::SetFrameRate(double rate)
+{
+    // rate <= 0 free-runs as fast as the consumer pulls
+    lRate = rate;
+}
+
+void SyntheticSource::SetJitter(double jitter)
+{
+    lJitter = jitter > 0 ? jitter : 0;
+}
+
+void SyntheticSource::SetDisk(double x, double y, double radius)
+{
+    lDiskX = x;
+    lDiskY = y;
+    lRadius = radius;
+    lTemplateDirty = true;
+}
+
+void SyntheticSource::SetWander(double amplitude)
+{
+    lWander = std::min(std::fabs(amplitude), (double)lMargin);
+}
+
+void SyntheticSource::SetLimbDarkening(double u)
+{
+    lLimbDarkening = u;
+    lTemplateDirty = true;
+}
+
+void SyntheticSource::SetNoise(double sigma)
+{
+    lNoiseSigma = sigma;
+    lNoise.resize(SYNTHETIC_NOISE_SIZE);
+    for (int i = 0; i < SYNTHETIC_NOISE_SIZE; i += 2)
+    {
+        // Box-Muller, two samples per pair of uniforms
+        double u1 = (Random() + 1.0) / 4294967297.0;
+        double u2 = Random() / 4294967296.0;
+        double r = sqrt(-2.0 * log(u1)) * sigma * SYNTHETIC_SCALE;
+        lNoise[i] = (int16_t) lround(r * cos(2 * M_PI * u2));
+        lNoise[i + 1] = (int16_t) lround(r * sin(2 * M_PI * u2));
+    }
+}
+
+uint32_t SyntheticSource::Random()
+{
+    // xorshift32, good enough for noise and jitter
+    lSeed ^= lSeed << 13;
+    lSeed ^= lSeed >> 17;
+    lSeed ^= lSeed << 5;
+    return lSeed;
+}
+
+int SyntheticSource::Connect()
+{
+    std::cout << "SyntheticSource::Connect Using synthetic sun-disk frames" << std::endl;
+    lConnected = true;
+    return 0;
+}
+
+int SyntheticSource::Initialize()
+{
+    if (!lConnected)
+    {
+        std::cout << "SyntheticSource::Initialize No device connected!" << std::endl;
+        return -1;
+    }
+    clock_gettime(CLOCK_MONOTONIC, &lStart);
+    clock_gettime(CLOCK_REALTIME, &lRealtimeStart);
+    lNextDue = lStart;
+    lBlockID = 0;
+    lImageCount = 0;
+    lHealth.Reset();
+    lInitialized = true;
+    return 0;
+}
+
+void SyntheticSource::ConfigureSnap()
+{
+}
+
+void SyntheticSource::ConfigureStream()
+{
+}
+
+int SyntheticSource::StartAcquisition()
+{
+    if (!lInitialized)
+    {
+        std::cout << "SyntheticSource::StartAcquisition Stream not initialized!" << std::endl;
+        return -1;
+    }
+    clock_gettime(CLOCK_MONOTONIC, &lNextDue);
+    lStreaming = true;
+    return 0;
+}
+
+void SyntheticSource::StopAcquisition()
+{
+    lStreaming = false;
+}
+
+bool SyntheticSource::IsStreaming()
+{
+    return lStreaming;
+}
+
+void SyntheticSource::Stop()
+{
+    lStreaming = false;
+    lInitialized = false;
+}
+
+void SyntheticSource::Disconnect()
+{
+    lConnected = false;
+}
+
+std::shared_ptr<std::vector<unsigned char> > SyntheticSource::FreeSlot()
+{
+    // Only this object hands out references, so a use count of one
+    // cannot go back up behind our back
+    for (size_t i = 0; i < lPool.size(); i++)
+    {
+        if (lPool[i].use_count() == 1)
+        {
+            return lPool[i];
+        }
+    }
+    return std::shared_ptr<std::vector<unsigned char> >();
+}
+
+int SyntheticSource::Snap(FrameLease &lease, int timeout)
+{
+    lease.release();
+    if (!lInitialized)
+    {
+        return 1;
+    }
+    clock_gettime(CLOCK_MONOTONIC, &lNextDue);
+    bool streaming = lStreaming;
+    lStreaming = true;
+    int result = Retrieve(lease, timeout);
+    lStreaming = streaming;
+    return (result == 0) ? 0 : 1;
+}
+
+int SyntheticSource::Retrieve(FrameLease &lease, int timeout)
+{
+    lease.release();
+
+    // the window can be changed from the control thread
+    pthread_mutex_lock(&lROIMutex);
+    const cv::Rect roi = lROI;
+    pthread_mutex_unlock(&lROIMutex);
+
+    timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    double wait = TimespecToSec(lNextDue) - TimespecToSec(now);
+
+    if (!lStreaming || wait * 1000.0 > timeout)
+    {
+        // Nothing will arrive within the timeout
+        timespec sleepUntil = AddSec(now, timeout / 1000.0);
+        clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &sleepUntil, NULL);
+        lHealth.Timeout(sleepUntil);
+        return -1;
+    }
+
+    // a consumer that falls behind looks like a full output queue
+    int gap = 0, queued = 0;
+    if (lRate > 0)
+    {
+        if (wait > 0)
+        {
+            clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &lNextDue, NULL);
+        }
+        else if (-wait * lRate * roi.height > lHeight)
+        {
+            // Consumer fell behind: the frames in between were lost, as they
+            // would be on the wire, which shows up as a BlockID gap
+            gap = (int)(-wait * lRate * roi.height / lHeight);
+            lBlockID += gap;
+            queued = SYNTHETIC_POOL_SIZE;
+            lNextDue = now;
+        }
+    }
+    else
+    {
+        lNextDue = now;
+    }
+
+    timespec exposed = lNextDue;
+    double period = (lRate > 0) ? (1.0 / lRate) * roi.height / lHeight : 0.0;
+    double jitter = lJitter * 1e-6 * ((Random() / 2147483648.0) - 1.0);
+    lNextDue = AddSec(lNextDue, period + jitter);
+    lBlockID++;
+
+    std::shared_ptr<std::vector<unsigned char> > slot = FreeSlot();
+    if (!slot)
+    {
+        // the consumer holds every buffer, counted rather than logged per frame
+        lHealth.Failure(exposed, gap, 0, 0, StreamHealthReport::FAILURE_NO_BUFFER);
+        return 1;
+    }
+
+    Render(&(*slot)[0], roi);
+    lImageCount++;
+    lHealth.Frame(exposed, gap, 0, 0, queued, SYNTHETIC_POOL_SIZE,
+                  (long)PixelBytes(lPixelFormat, (size_t)roi.width * roi.height));
+
+    lease.width = roi.width;
+    lease.height = roi.height;
+    lease.offsetX = roi.x;
+    lease.offsetY = roi.y;
+    lease.format = lPixelFormat;
+    lease.blockID = lBlockID;
+    lease.timestamp = (uint64_t)((TimespecToSec(exposed) - TimespecToSec(lStart)) * 1e9);
+    // the generator's clock is the host clock, no fit needed
+    lease.captureTimeMono = exposed;
+    lease.captureTime = AddSec(lRealtimeStart, lease.timestamp / 1e9);
+    lease.clockLatched = true;
+    lease.pixels = std::shared_ptr<const unsigned char>(slot, &(*slot)[0]);
+    return 0;
+}
+
+void SyntheticSource::RenderTemplate()
+{
+    // Brightness follows exposure and gain, so long exposures saturate
+    double gain = (lAnalogGain / 400.0) * pow(10.0, lPreAmpGain / 20.0);
+    double peak = SYNTHETIC_DISK_FLUX * lExposure * gain;
+    double sky = SYNTHETIC_SKY_FRACTION * peak + lBlackLevel / 4.0;
+    int canvasWidth = lWidth + 2*lMargin;
+    int canvasHeight = lHeight + 2*lMargin;
+
+    for (int y = 0; y < canvasHeight; y++)
+    {
+        double dy = y - lMargin - lDiskY;
+        for (int x = 0; x < canvasWidth; x++)
+        {
+            double dx = x - lMargin - lDiskX;
+            double r = sqrt(dx*dx + dy*dy);
+            double level = sky;
+            // antialias the limb over one pixel
+            double coverage = lRadius + 0.5 - r;
+            if (coverage > 0)
+            {
+                double rr = std::min(r / lRadius, 1.0);
+                double mu = sqrt(1.0 - rr*rr);
+                double disk = peak * (1.0 - lLimbDarkening * (1.0 - mu));
+                level += std::min(coverage, 1.0) * disk;
+            }
+            lTemplate[y * canvasWidth + x] = (int16_t) std::min(level * SYNTHETIC_SCALE + 0.5, 32767.0);
+        }
+    }
+    lTemplateDirty = false;
+}
+
+void SyntheticSource::Render(unsigned char *frame, const cv::Rect &roi)
+{
+    if (lTemplateDirty)
+    {
+        RenderTemplate();
+    }
+
+    // slow pointing wander, whole pixels only so the template can be reused
+    double t = TimespecToSec(lNextDue) - TimespecToSec(lStart);
+    int shiftX = (int) lround(lWander * sin(2 * M_PI * t / 60.0));
+    int shiftY = (int) lround(lWander * cos(2 * M_PI * t / 47.0));
+    int canvasWidth = lWidth + 2*lMargin;
+
+    const int maximum = (1 << SYNTHETIC_BITS) - 1;
+    const int shift = SYNTHETIC_BITS - PixelBits(lPixelFormat);
+    unsigned int k = Random();
+    for (int y = 0; y < roi.height; y++)
+    {
+        const int16_t *row = &lTemplate[(y + roi.y + lMargin - shiftY) * canvasWidth
+                                        + roi.x + lMargin - shiftX];
+        if (lPixelFormat == MONO8)
+        {
+            unsigned char *out = frame + y * roi.width;
+            for (int x = 0; x < roi.width; x++)
+            {
+                int value = row[x] + lNoise[(k++) & (SYNTHETIC_NOISE_SIZE - 1)];
+                out[x] = (unsigned char)((value < 0 ? 0 : (value > maximum ? maximum : value)) >> shift);
+            }
+            continue;
+        }
+        for (int x = 0; x < roi.width; x++)
+        {
+            int value = row[x] + lNoise[(k++) & (SYNTHETIC_NOISE_SIZE - 1)];
+            lRow[x] = (uint16_t)((value < 0 ? 0 : (value > maximum ? maximum : value)) >> shift);
+        }
+        // widths are a multiple of 8, so packed rows start on a whole triplet
+        PackPixels(&lRow[0], lPixelFormat,
+                   frame + PixelBytes(lPixelFormat, (size_t)y * roi.width), roi.width);
+    }
+}
+
+int SyntheticSource::SetExposure(int exposureTime)
+{
+    if (exposureTime < 5)
+    {
+        return -1;
+    }
+    lExposure = exposureTime;
+    lTemplateDirty = true;
+    return 0;
+}
+
+int SyntheticSource::SetAnalogGain(int gain)
+{
+    if (gain < 0 || gain > 1023)
+    {
+        return -1;
+    }
+    lAnalogGain = gain;
+    lTemplateDirty = true;
+    return 0;
+}
+
+int SyntheticSource::SetBlackLevel(int black)
+{
+    if (black < 0 || black > 1023)
+    {
+        return -1;
+    }
+    lBlackLevel = black;
+    lTemplateDirty = true;
+    return 0;
+}
+
+int SyntheticSource::SetPreAmpGain(int gain)
+{
+    if (gain != -3 && gain != 0 && gain != 3 && gain != 6)
+    {
+        return -1;
+    }
+    lPreAmpGain = gain;
+    lTemplateDirty = true;
+    return 0;
+}
+
+int SyntheticSource::SetROI(const cv::Rect &roi)
+{
+    // same limits as the Imperx sensor
+    if (roi.x < 0 || roi.y < 0 || roi.width < 8 || roi.height < 1 || (roi.width % 8) != 0 ||
+        roi.x + roi.width > lWidth || roi.y + roi.height > lHeight)
+    {
+        return -1;
+    }
+    pthread_mutex_lock(&lROIMutex);
+    lROI = roi;
+    pthread_mutex_unlock(&lROIMutex);
+    return 0;
+}
+
+cv::Rect SyntheticSource::GetROI()
+{
+    pthread_mutex_lock(&lROIMutex);
+    cv::Rect roi = lROI;
+    pthread_mutex_unlock(&lROIMutex);
+    return roi;
+}
+
+int SyntheticSource::SetPixelFormat(PixelFormat format)
+{
+    // same rule as the camera, the payload is sized at Initialize()
+    if (lInitialized)
+    {
+        return -1;
+    }
+    lPixelFormat = format;
+    return 0;
+}
+
+PixelFormat SyntheticSource::GetPixelFormat()
+{
+    return lPixelFormat;
+}
+
+int SyntheticSource::GetExposure()
+{
+    return lExposure;
+}
+
+int SyntheticSource::GetAnalogGain()
+{
+    return lAnalogGain;
+}
+
+int SyntheticSource::GetBlackLevel()
+{
+    return lBlackLevel;
+}
+
+int SyntheticSource::GetPreAmpGain()
+{
+    return lPreAmpGain;
+}
+
+float SyntheticSource::getTemperature()
+{
+    return 25.0;
+}
+
+std::string SyntheticSource::GetSerialNumber()
+{
+    return std::string("0");
+}
+
+StreamHealthReport SyntheticSource::GetStreamHealth()
+{
+    timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return lHealth.Report(now);
+}
+
+int SyntheticSource::SyncClock()
+{
+    // the timestamps are host time already
+    return 0;
+}
+
+int SyntheticSource::GetStreamStatistics(long long &imageCount, double &frameRate, double &bandwidth)
+{
+    timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    double elapsed = TimespecToSec(now) - TimespecToSec(lStart);
+    imageCount = lImageCount;
+    frameRate = elapsed > 0 ? lImageCount / elapsed : 0.0;
+    bandwidth = frameRate * PixelBytes(lPixelFormat, (size_t)lWidth * lHeight) * 8;
+    return 0;
+}
@@ -0,0 +1,109 @@
+#ifndef _SYNTHETICSOURCE_HPP_
+#define _SYNTHETICSOURCE_HPP_
+
+#include "FrameSource.hpp"
+
+#include <pthread.h>
+#include <vector>
+#include <ctime>
+
+/* Frame source that renders a 1296x966 solar disk instead of talking
+   to a camera. Frames come out at a fixed rate with optional timing jitter;
+   the disk has limb darkening and slowly wanders, and the brightness follows
+   exposure and gain so frames saturate the same way the real camera does.
+   Timestamps are device-style ticks (nanoseconds since Initialize()).
+   A readout window (SetROI) shortens the frame period in proportion to
+   the rows read, like a readout-limited sensor. Frames come in any of
+   the camera's pixel formats, rendered at 12 bits and cut down from there.
+*/
+class SyntheticSource : public FrameSource
+{
+public:
+    SyntheticSource();
+    ~SyntheticSource();
+
+    /* Generator parameters, may be changed at any time
+       rate in frames per second, jitter in microseconds (uniform +/-),
+       disk center and radius in pixels, wander amplitude in pixels,
+       limb darkening coefficient u in I(mu) = 1 - u(1 - mu),
+       noise sigma in DN
+    */
+    void SetFrameRate(double rate);
+    void SetJitter(double jitter);
+    void SetDisk(double x, double y, double radius);
+    void SetWander(double amplitude);
+    void SetLimbDarkening(double u);
+    void SetNoise(double sigma);
+
+    int Connect();
+    int Initialize();
+    void ConfigureSnap();
+    void ConfigureStream();
+    int Snap(FrameLease &lease, int timeout);
+
+    int StartAcquisition();
+    int Retrieve(FrameLease &lease, int timeout);
+    void StopAcquisition();
+    bool IsStreaming();
+
+    void Stop();
+    void Disconnect();
+
+    int SetExposure(int exposureTime);
+    int SetAnalogGain(int gain);
+    int SetBlackLevel(int black);
+    int SetPreAmpGain(int gain);
+
+    int GetExposure();
+    int GetAnalogGain();
+    int GetBlackLevel();
+    int GetPreAmpGain();
+
+    int SetROI(const cv::Rect &roi);
+    cv::Rect GetROI();
+    int SetPixelFormat(PixelFormat format);
+    PixelFormat GetPixelFormat();
+
+    float getTemperature( void );
+    std::string GetSerialNumber();
+    int GetStreamStatistics(long long &imageCount, double &frameRate, double &bandwidth);
+    StreamHealthReport GetStreamHealth();
+    int SyncClock();
+
+private:
+    void RenderTemplate();
+    void Render(unsigned char *frame, const cv::Rect &roi);
+    std::shared_ptr<std::vector<unsigned char> > FreeSlot();
+    uint32_t Random();
+
+    int lWidth, lHeight;
+    cv::Rect lROI;              // under lROIMutex, it may be set while streaming
+    pthread_mutex_t lROIMutex;
+    PixelFormat lPixelFormat;
+    std::vector<uint16_t> lRow;     // one row before packing
+    // the disk is rendered once (per exposure/gain change) onto a canvas
+    // with a margin, and each frame is a shifted window into it plus noise
+    int lMargin;
+    std::vector<int16_t> lTemplate;
+    bool lTemplateDirty;
+
+    // frames handed out in leases; a slot is free again when only the
+    // pool still references it
+    std::vector<std::shared_ptr<std::vector<unsigned char> > > lPool;
+    std::vector<int16_t> lNoise;
+
+    double lRate, lJitter;
+    double lDiskX, lDiskY, lRadius, lWander;
+    double lLimbDarkening, lNoiseSigma;
+    int lExposure, lAnalogGain, lPreAmpGain, lBlackLevel;
+
+    bool lConnected, lInitialized, lStreaming;
+    timespec lStart, lNextDue;
+    timespec lRealtimeStart;
+    uint64_t lBlockID;
+    long long lImageCount;
+    StreamHealth lHealth;
+    uint32_t lSeed;
+};
+
+#endif
@@ -0,0 +1,273 @@
+#include "WriterPool.hpp"
+
+#include <algorithm>
+#include <iostream>
+#include <ctime>
+#include <stdint.h>
+
+WriterPool::WriterPool()
+    : lRunning(false)
+    , lStopping(false)
+    , lOverflow(DROP_OLDEST)
+{
+    pthread_mutex_init(&lMutex, NULL);
+    pthread_cond_init(&lQueued, NULL);
+    pthread_cond_init(&lFreed, NULL);
+}
+
+WriterPool::~WriterPool()
+{
+    Stop();
+    Free();
+    pthread_cond_destroy(&lFreed);
+    pthread_cond_destroy(&lQueued);
+    pthread_mutex_destroy(&lMutex);
+}
+
+int WriterPool::Start(int threads, int capacity, Overflow overflow, const pthread_attr_t *attr)
+{
+    if (lRunning || threads < 1)
+    {
+        return -1;
+    }
+    Free();
+    capacity = std::max(capacity, 1);
+    // one job per writer on top of the queue, so a full queue still keeps every writer busy
+    for (int i = 0; i < capacity + threads; i++)
+    {
+        SaveJob *job = new SaveJob();
+        job->width = job->height = 0;
+        job->words = false;
+        lJobs.push_back(job);
+        lFree.push_back(job);
+    }
+    lReport = WriterPoolReport();
+    lReport.capacity = capacity;
+    lOverflow = overflow;
+    lRunning = true;
+    lStopping = false;
+
+    for (int i = 0; i < threads; i++)
+    {
+        pthread_t thread;
+        int rc = pthread_create(&thread, attr, WriterThread, this);
+        if (rc != 0 && attr != NULL)
+        {
+            // e.g. no permission for real-time scheduling, write anyway
+            std::cerr << "WriterPool::Start thread attributes refused (" << rc << "), using defaults" << std::endl;
+            rc = pthread_create(&thread, NULL, WriterThread, this);
+        }
+        if (rc != 0)
+        {
+            std::cerr << "WriterPool::Start pthread_create returned " << rc << std::endl;
+            break;
+        }
+        lThreads.push_back(thread);
+    }
+    lReport.threads = lThreads.size();
+    if (lThreads.empty())
+    {
+        lRunning = false;
+        Free();
+        return -1;
+    }
+    return 0;
+}
+
+void WriterPool::Stop()
+{
+    pthread_mutex_lock(&lMutex);
+    if (!lRunning)
+    {
+        pthread_mutex_unlock(&lMutex);
+        return;
+    }
+    lRunning = false;
+    pthread_cond_broadcast(&lQueued);
+    pthread_cond_broadcast(&lFreed);
+    pthread_mutex_unlock(&lMutex);
+
+    for (size_t i = 0; i < lThreads.size(); i++)
+    {
+        pthread_join(lThreads[i], NULL);
+    }
+    lThreads.clear();
+}
+
+void WriterPool::Wake()
+{
+    pthread_mutex_lock(&lMutex);
+    lStopping = true;
+    pthread_cond_broadcast(&lFreed);
+    pthread_mutex_unlock(&lMutex);
+}
+
+void WriterPool::Free()
+{
+    for (size_t i = 0; i < lJobs.size(); i++)
+    {
+        delete lJobs[i];
+    }
+    lJobs.clear();
+    lFree.clear();
+    lQueue.clear();
+}
+
+void WriterPool::SetOverflow(Overflow overflow)
+{
+    pthread_mutex_lock(&lMutex);
+    lOverflow = overflow;
+    pthread_cond_broadcast(&lFreed);
+    pthread_mutex_unlock(&lMutex);
+}
+
+SaveJob *WriterPool::Acquire()
+{
+    SaveJob *job = NULL;
+    pthread_mutex_lock(&lMutex);
+    if (lOverflow == BLOCK)
+    {
+        // pthread_cond_wait is a cancellation point, Wake() keeps camera
+        // threads out of it before they can be cancelled
+        while (lRunning && !lStopping && lOverflow == BLOCK && lFree.empty())
+        {
+            pthread_cond_wait(&lFreed, &lMutex);
+        }
+    }
+    if (!lRunning)
+    {
+        // stopped, or never started
+    }
+    else if (!lFree.empty())
+    {
+        job = lFree.front();
+        lFree.pop_front();
+    }
+    else if (lOverflow == DROP_OLDEST && !lQueue.empty())
+    {
+        // the frame that has waited longest is lost, its job is reused
+        job = lQueue.front();
+        lQueue.pop_front();
+        lReport.dropped++;
+    }
+    else
+    {
+        lReport.dropped++;
+    }
+    pthread_mutex_unlock(&lMutex);
+    if (job != NULL)
+    {
+        // a reused job lets go of the frame that was dropped
+        job->frame.reset();
+    }
+    return job;
+}
+
+void WriterPool::Submit(SaveJob *job)
+{
+    pthread_mutex_lock(&lMutex);
+    if (!lRunning)
+    {
+        // no writer left to take it
+        lReport.dropped++;
+        pthread_mutex_unlock(&lMutex);
+        Release(job);
+        return;
+    }
+    lQueue.push_back(job);
+    lReport.maxDepth = std::max(lReport.maxDepth, (int)lQueue.size());
+    pthread_cond_signal(&lQueued);
+    pthread_mutex_unlock(&lMutex);
+}
+
+void WriterPool::Release(SaveJob *job)
+{
+    job->frame.reset();
+    pthread_mutex_lock(&lMutex);
+    lFree.push_back(job);
+    pthread_cond_signal(&lFreed);
+    pthread_mutex_unlock(&lMutex);
+}
+
+WriterPoolReport WriterPool::Report()
+{
+    pthread_mutex_lock(&lMutex);
+    WriterPoolReport report = lReport;
+    report.depth = lQueue.size();
+    pthread_mutex_unlock(&lMutex);
+    return report;
+}
+
+const char *WriterPool::OverflowName(Overflow overflow)
+{
+    switch (overflow)
+    {
+    case DROP_OLDEST:
+        return "drop oldest";
+    case DROP_NEWEST:
+        return "drop newest";
+    case BLOCK:
+        return "block";
+    }
+    return "unknown";
+}
+
+void *WriterPool::WriterThread(void *pool)
+{
+    static_cast<WriterPool *>(pool)->Run();
+    return NULL;
+}
+
+void WriterPool::Run()
+{
+    pthread_mutex_lock(&lMutex);
+    for (;;)
+    {
+        // what is queued when stopping is still written
+        while (lRunning && lQueue.empty())
+        {
+            pthread_cond_wait(&lQueued, &lMutex);
+        }
+        if (lQueue.empty())
+        {
+            break;
+        }
+        SaveJob *job = lQueue.front();
+        lQueue.pop_front();
+        pthread_mutex_unlock(&lMutex);
+
+        timespec start, end;
+        clock_gettime(CLOCK_MONOTONIC, &start);
+        int rc = -1;
+        if (job->frame.empty())
+        {
+            std::cerr << "WriterPool::Run " << job->fileName << " has no pixels" << std::endl;
+        }
+        else if (job->words)
+        {
+            rc = writeFITSImage((const uint16_t *)job->frame.data(), job->header, job->fileName, job->width, job->height);
+        }
+        else
+        {
+            rc = writeFITSImage(job->frame.data(), job->header, job->fileName, job->width, job->height);
+        }
+        clock_gettime(CLOCK_MONOTONIC, &end);
+        job->frame.reset();
+        double elapsed = (end.tv_sec - start.tv_sec) * 1e3 + (end.tv_nsec - start.tv_nsec) / 1e6;
+
+        pthread_mutex_lock(&lMutex);
+        if (rc == 0)
+        {
+            lReport.written++;
+        }
+        else
+        {
+            lReport.failed++;
+        }
+        lReport.lastWrite = elapsed;
+        lReport.maxWrite = std::max(lReport.maxWrite, elapsed);
+        lFree.push_back(job);
+        pthread_cond_signal(&lFreed);
+    }
+    pthread_mutex_unlock(&lMutex);
+}
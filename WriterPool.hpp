@@ -0,0 +1,108 @@
+#ifndef _WRITERPOOL_HPP_
+#define _WRITERPOOL_HPP_
+
+#include "compression.hpp"
+#include "FramePool.hpp"
+
+#include <pthread.h>
+#include <deque>
+#include <string>
+#include <vector>
+
+// One frame to be written, filled completely by the camera thread
+struct SaveJob
+{
+    FrameRef frame;             // bytes, or uint16_t words when words is set
+    int width, height;
+    bool words;
+    HeaderData header;
+    std::string fileName;
+};
+
+struct WriterPoolReport
+{
+    WriterPoolReport(): threads(0),
+                        depth(0),
+                        capacity(0),
+                        maxDepth(0),
+                        written(0),
+                        failed(0),
+                        dropped(0),
+                        lastWrite(0),
+                        maxWrite(0) {};
+    int threads;
+    int depth;          // jobs waiting for a writer
+    int capacity;
+    int maxDepth;       // deepest the queue has been
+    long written;
+    long failed;        // writeFITSImage() returned an error
+    long dropped;       // frames lost to a full queue
+    double lastWrite;   // ms per file
+    double maxWrite;
+};
+
+/* A fixed set of writer threads fed by a bounded queue of save jobs, shared
+   by all cameras. Every job is allocated by Start() and the pixels are
+   held by reference to a FramePool buffer, released once written, so
+   saving never creates a thread or allocates while streaming, and no
+   more than the given number of FITS writes run at once however fast
+   frames are queued. Camera threads take a free job with Acquire(), fill
+   it and Submit() it; when every job is queued or being written the
+   overflow policy decides whether the newest frame is lost (Acquire()
+   returns NULL), the oldest waiting one is taken back and reused, or
+   the caller waits for a writer to finish.
+*/
+class WriterPool
+{
+public:
+    enum Overflow { DROP_OLDEST, DROP_NEWEST, BLOCK };
+
+    WriterPool();
+    ~WriterPool();
+
+    /* capacity jobs can wait while each thread writes one, so at most
+       capacity + threads frames are held; attr is used for the writer
+       threads when given (falls back to the defaults if refused)
+       returns 0, or -1 if no writer could be started
+    */
+    int Start(int threads, int capacity, Overflow overflow, const pthread_attr_t *attr = NULL);
+    // writes what is still queued, then joins the writers
+    void Stop();
+    /* at shutdown, before the camera threads are stopped: no caller waits
+       in Acquire() from now on, a frame without a free job is dropped
+    */
+    void Wake();
+
+    void SetOverflow(Overflow overflow);
+    // a job to fill, or NULL when the frame has to be dropped
+    SaveJob *Acquire();
+    // queues a filled job, once stopped it is released and counted dropped
+    void Submit(SaveJob *job);
+    // gives back an acquired job that won't be submitted
+    void Release(SaveJob *job);
+
+    WriterPoolReport Report();
+    static const char *OverflowName(Overflow overflow);
+
+private:
+    WriterPool(const WriterPool &);
+    WriterPool &operator=(const WriterPool &);
+
+    static void *WriterThread(void *pool);
+    void Run();
+    void Free();
+
+    pthread_mutex_t lMutex;
+    pthread_cond_t lQueued;     // a job was submitted, or the pool is stopping
+    pthread_cond_t lFreed;      // a job was written, for BLOCK
+    bool lRunning;
+    bool lStopping;             // Wake() was called, BLOCK no longer waits
+    Overflow lOverflow;
+    std::vector<pthread_t> lThreads;
+    std::vector<SaveJob *> lJobs;
+    std::deque<SaveJob *> lFree;
+    std::deque<SaveJob *> lQueue;
+    WriterPoolReport lReport;
+};
+
+#endif
@@ -0,0 +1,295 @@
+#include <iostream>
+#include <algorithm>
+#include <vector>
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "SyntheticSource.hpp"
+#include "AutoROI.hpp"
+#include "AutoExposure.hpp"
+#include "Realtime.hpp"
+#include "Centroid.hpp"
+#include "LimbFit.hpp"
+#include "FrameStats.hpp"
+#include "CoAdd.hpp"
+
+#define TIMEOUT 1000 // milliseconds
+
+sig_atomic_t volatile g_running = 1;
+
+void sig_handler(int signum)
+{
+    if ((signum == SIGINT) || (signum == SIGTERM))
+    {
+        g_running = 0;
+    }
+}
+
+double elapsedUsec(const timespec &start, const timespec &end)
+{
+    return (end.tv_sec - start.tv_sec) * 1e6 + (end.tv_nsec - start.tv_nsec) / 1e3;
+}
+
+// Summary line for one set of per-frame samples (usec)
+void report(const char *name, std::vector<double> samples)
+{
+    if (samples.empty())
+    {
+        return;
+    }
+    std::sort(samples.begin(), samples.end());
+    double sum = 0;
+    for (size_t i = 0; i < samples.size(); i++)
+    {
+        sum += samples[i];
+    }
+    printf("%-12s mean %9.1f us  p50 %9.1f  p99 %9.1f  max %9.1f\n", name,
+           sum / samples.size(),
+           samples[samples.size() / 2],
+           samples[(size_t)(samples.size() * 0.99)],
+           samples.back());
+}
+
+/* Drives the display/save pipeline stages from the synthetic sun source,
+   so their throughput and latency can be measured without a camera.
+   latency is from the (synthetic) exposure timestamp to the end of the
+   downstream processing of that frame.
+*/
+int main(int argc, char* argv[])
+{
+    double rate = 30.0;
+    double seconds = 10.0;
+    double jitter = 0.0;
+    bool autoRoi = false;
+    int bits = 8;
+    bool packed = false;
+    bool autoExposure = false;
+    int priority = 0;
+    switch(argc) {
+        case 9:
+            priority = atoi(argv[8]);
+        case 8:
+            autoExposure = atoi(argv[7]);
+        case 7:
+            packed = atoi(argv[6]);
+        case 6:
+            bits = atoi(argv[5]);
+        case 5:
+            autoRoi = atoi(argv[4]);
+        case 4:
+            jitter = atof(argv[3]);
+        case 3:
+            seconds = atof(argv[2]);
+        case 2:
+            rate = atof(argv[1]);
+        case 1:
+            break;
+        default:
+            std::cout << "Calling sequence: bench [frame rate (fps, 0 to free run)] [seconds] [jitter (us)] [auto roi (0/1)] [bit depth (8/10/12)] [packed (0/1)] [auto exposure (0/1)] [SCHED_FIFO priority (0 = none)]\n";
+            return 0;
+    }
+
+    signal(SIGINT, &sig_handler);
+    signal(SIGTERM, &sig_handler);
+
+    // the acquisition loop runs in the camera role, with locked memory when real-time
+    RealtimeProfile realtime;
+    RoleSchedule schedule;
+    schedule.priority = priority;
+    realtime.Set(ROLE_CAMERA, schedule);
+    realtime.SetLockMemory(priority > 0);
+    realtime.LockMemory();
+    realtime.ApplyToSelf(ROLE_CAMERA);
+    realtime.PrefaultStack(ROLE_CAMERA);
+
+    SyntheticSource camera;
+    camera.SetFrameRate(rate);
+    camera.SetJitter(jitter);
+    camera.SetPixelFormat(PixelFormatFor(bits, packed));
+    camera.Connect();
+    camera.ConfigureStream();
+    camera.Initialize();
+    camera.StartAcquisition();
+
+    FrameLease frame;
+    std::vector<unsigned char> display(1296 * 966);
+    std::vector<uint16_t> save(1296 * 966);
+    std::vector<double> latency, copy, measured, unpack, saved, window, exposure, center, circle, stacking;
+    Centroid centroid;
+    CentroidResult sun;
+    LimbFit limbFit;
+    LimbFitResult limb;
+    FrameStats levels;
+    CoAdd coadd(1296, 966);
+    AutoROI roi(1296, 966);
+    AutoExposure control;
+    long exposureChanges = 0, lastChange = 0;
+    double bytes = 0;
+    timespec start, now, stageStart;
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    timespec epoch = start;
+    long failed = 0;
+    unsigned long long lastBlock = 0, gaps = 0;
+    JitterHistogram delivery;
+    timespec lastArrival = {0, 0};
+    uint64_t lastTimestamp = 0;
+
+    while (g_running)
+    {
+        clock_gettime(CLOCK_MONOTONIC, &now);
+        if (elapsedUsec(start, now) > seconds * 1e6)
+        {
+            break;
+        }
+        if (camera.Retrieve(frame, TIMEOUT) != 0)
+        {
+            failed++;
+            continue;
+        }
+        clock_gettime(CLOCK_MONOTONIC, &now);
+        if (lastBlock != 0 && frame.blockID != lastBlock + 1)
+        {
+            gaps += frame.blockID - lastBlock - 1;
+        }
+        else if (lastBlock != 0)
+        {
+            // delivery spacing against the source's own frame spacing
+            delivery.Add(elapsedUsec(lastArrival, now) - (frame.timestamp - lastTimestamp) / 1e3);
+        }
+        lastBlock = frame.blockID;
+        lastArrival = now;
+        lastTimestamp = frame.timestamp;
+
+        // the copy out of the acquisition buffer that the display path
+        // makes, a plain memcpy for Mono8
+        clock_gettime(CLOCK_MONOTONIC, &stageStart);
+        ReducePixels(frame.data(), frame.format, &display[0], frame.width * frame.height);
+        clock_gettime(CLOCK_MONOTONIC, &now);
+        copy.push_back(elapsedUsec(stageStart, now));
+
+        // the same copy with the frame statistics taken on the way, as
+        // the camera thread does it
+        clock_gettime(CLOCK_MONOTONIC, &stageStart);
+        ReducePixelsStats(frame.data(), frame.format, &display[0], frame.width * frame.height, levels);
+        clock_gettime(CLOCK_MONOTONIC, &now);
+        measured.push_back(elapsedUsec(stageStart, now));
+
+        latency.push_back(elapsedUsec(epoch, now) - frame.timestamp / 1e3);
+        bytes += frame.bytes();
+
+        // the aspect solution, on the display copy like the camera thread does
+        clock_gettime(CLOCK_MONOTONIC, &stageStart);
+        centroid.Measure(&display[0], frame.width, frame.height, frame.offsetX, frame.offsetY, sun);
+        clock_gettime(CLOCK_MONOTONIC, &now);
+        center.push_back(elapsedUsec(stageStart, now));
+        if (sun.found)
+        {
+            clock_gettime(CLOCK_MONOTONIC, &stageStart);
+            limbFit.Measure(&display[0], frame.width, frame.height, frame.offsetX, frame.offsetY, sun.threshold, limb);
+            clock_gettime(CLOCK_MONOTONIC, &now);
+            circle.push_back(elapsedUsec(stageStart, now));
+        }
+
+        // summing runs of 8 registered frames, the mean of each run measured
+        clock_gettime(CLOCK_MONOTONIC, &stageStart);
+        if (coadd.Add(&display[0], frame.width, frame.height, frame.offsetX, frame.offsetY, sun))
+        {
+            coadd.Mean(&display[0]);
+        }
+        clock_gettime(CLOCK_MONOTONIC, &now);
+        stacking.push_back(elapsedUsec(stageStart, now));
+
+        // widening to 16 bits, as the save path does for deeper formats
+        if (frame.format != MONO8)
+        {
+            clock_gettime(CLOCK_MONOTONIC, &stageStart);
+            UnpackPixels(frame.data(), frame.format, &save[0], frame.width * frame.height);
+            clock_gettime(CLOCK_MONOTONIC, &now);
+            unpack.push_back(elapsedUsec(stageStart, now));
+
+            // the display copy, its statistics and the widened frame in one
+            // pass, as the camera thread does for a frame it saves
+            int saveMin, saveMax;
+            clock_gettime(CLOCK_MONOTONIC, &stageStart);
+            UnpackReducePixelsStats(frame.data(), frame.format, &save[0], &display[0],
+                                    frame.width * frame.height, levels, saveMin, saveMax);
+            clock_gettime(CLOCK_MONOTONIC, &now);
+            saved.push_back(elapsedUsec(stageStart, now));
+        }
+
+        // the exposure loop; the generator applies a change to the next
+        // frame, so every frame counts as settled
+        if (autoExposure)
+        {
+            clock_gettime(CLOCK_MONOTONIC, &stageStart);
+            if (control.Update(levels, camera.GetExposure(), camera.GetAnalogGain()))
+            {
+                camera.SetExposure(control.Exposure());
+                camera.SetAnalogGain(control.Gain());
+                exposureChanges++;
+                lastChange = latency.size();
+            }
+            clock_gettime(CLOCK_MONOTONIC, &now);
+            exposure.push_back(elapsedUsec(stageStart, now));
+        }
+
+        // finding the disk, and moving the readout window when it asks to
+        if (autoRoi)
+        {
+            clock_gettime(CLOCK_MONOTONIC, &stageStart);
+            if (roi.Update(frame))
+            {
+                frame.release();
+                camera.SetROI(roi.Window());
+            }
+            clock_gettime(CLOCK_MONOTONIC, &now);
+            window.push_back(elapsedUsec(stageStart, now));
+        }
+    }
+    frame.release();
+
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    double elapsed = elapsedUsec(start, now) / 1e6;
+    StreamHealthReport health = camera.GetStreamHealth();
+    camera.Stop();
+
+    printf("%s\n", PixelFormatName(PixelFormatFor(bits, packed)));
+    printf("%lu frames in %.1f s = %.2f FPS, %ld failed, %llu missing BlockIDs\n",
+           (unsigned long)latency.size(), elapsed, latency.size() / elapsed, failed, gaps);
+    printf("%.1f MB/s of pixels\n", bytes / elapsed / 1e6);
+    printf("last %.0f s: %.1f FPS, interval p50 %.2f p99 %.2f max %.2f ms, %ld gaps, %s\n",
+           health.window, health.frameRate, health.intervalP50, health.intervalP99,
+           health.intervalMax, health.blockGaps, health.CauseName());
+    delivery.Print(stdout, "delivery");
+    report("latency", latency);
+    report("copy", copy);
+    report("copystats", measured);
+    report("unpack", unpack);
+    report("copysave", saved);
+    report("centroid", center);
+    report("limbfit", circle);
+    report("coadd", stacking);
+    report("autoroi", window);
+    report("autoexp", exposure);
+    if (sun.found)
+    {
+        printf("last centroid (%.2f, %.2f) from %ld pixels\n", sun.x, sun.y, sun.pixels);
+    }
+    printf("last levels %d-%d mean %.1f sd %.1f, %.3f%% saturated\n",
+           levels.min, levels.max, levels.Mean(), levels.StdDev(), levels.SaturatedFraction() * 100);
+    if (limb.found)
+    {
+        printf("last limb fit (%.2f, %.2f) radius %.2f rms %.3f from %d of %d points\n",
+               limb.x, limb.y, limb.radius, limb.rms, limb.inliers, limb.points);
+    }
+    if (autoExposure)
+    {
+        printf("auto-exposure: %ld changes, settled after frame %ld at %d us gain %d, level %d\n",
+               exposureChanges, lastChange, camera.GetExposure(), camera.GetAnalogGain(),
+               control.BrightLevel());
+    }
+    return 0;
+}
@@ -1,126 +1,389 @@
 #include "compression.hpp"
-#include <CCfits>
+#include <fitsio.h>
+#include <algorithm>
 #include <cmath>
-#include <valarray>
+#include <iostream>
+#include <stdlib.h>
 #include <vector>
+#include <string.h>
+#include <unistd.h>
 
-using namespace CCfits;
+#define FITS_CARD           80
+#define FITS_BLOCK          2880
+#define FITS_VALUE_WIDTH    20      // fixed-format values end in column 30
+#define FITS_FLOAT_DIGITS   7       // as cfitsio writes a float
+#define FITS_DOUBLE_DIGITS  15      // and a double
 
-int writeFITSImage(unsigned char *data, HeaderData keys, const std::string fileName, int width, int height)
+namespace
 {
-    try {
+/* The primary header as one block of 80-character cards, built once per
+   image type when the program starts. Every value that changes from frame
+   to frame has a fixed-width field in it, so a header is a copy of the
+   block and a formatted number per field, with no keyword lookups.
+*/
+class HeaderTemplate
+{
+public:
+    HeaderTemplate(long bitpix, long bzero);
 
-    std::string timeKey;
-    if (width == 0 || height == 0)
+    // header gets Bytes() of this frame's header, whole FITS blocks
+    void Fill(const HeaderData &keys, const std::string &fileName, char *header) const;
+    size_t Bytes() const;
+
+private:
+    // the fields patched per frame
+    enum Field { KEY_CDELT1, KEY_CDELT2, KEY_EXPTIME, KEY_DATE_OBS, KEY_TIME_US, KEY_TIMEMONO,
+                 KEY_TIMELTCH, KEY_TEMPCCD, KEY_FILENAME, KEY_CAMERAID, KEY_EXPOSURE, KEY_GAIN_PRE, KEY_GAIN_ANA,
+                 KEY_FRAMENUM, KEY_ROI_X, KEY_ROI_Y, KEY_SETTLING, KEY_DATAMIN, KEY_DATAMAX,
+                 KEY_BITDEPTH, KEY_CALIBRAT, KEY_NCOADD, KEY_COADDREG, KEY_SUNFOUND, KEY_SUN_X,
+                 KEY_SUN_Y, KEY_SUNOFF_X, KEY_SUNOFF_Y, KEY_LIMBFIT, KEY_LIMB_X, KEY_LIMB_Y,
+                 KEY_LIMB_R, KEY_LIMB_RMS, KEY_LIMB_N, FIELDS };
+
+    // append a card, each returns the offset of the card
+    size_t Add(const char *name, const std::string &value, const char *comment);
+    size_t AddString(const char *name, const std::string &value, int width, const char *comment);
+    size_t AddInt(const char *name, long value, const char *comment);
+    size_t AddFloat(const char *name, double value, const char *comment);
+    size_t AddDouble(const char *name, double value, const char *comment);
+    size_t AddLogical(const char *name, bool value, const char *comment);
+
+    std::string lCards;
+    size_t lField[FIELDS];
+};
+
+// fixed-format values are right-justified in columns 11-30
+void PatchValue(char *card, const char *value)
+{
+    int length = std::min((int)strlen(value), FITS_VALUE_WIDTH);
+    memset(card + 10, ' ', FITS_VALUE_WIDTH - length);
+    memcpy(card + 10 + FITS_VALUE_WIDTH - length, value, length);
+}
+
+void PatchInt(char *card, long value)
+{
+    char text[32];
+    snprintf(text, sizeof(text), "%ld", value);
+    PatchValue(card, text);
+}
+
+/* a real always has a decimal point or an exponent, so it reads back as
+   one; one too long for the field loses digits rather than being cut off,
+   e.g. -1.23456789012345E-100
+*/
+void PatchReal(char *card, double value, int digits)
+{
+    char text[32];
+    do
     {
-        std::cerr << "Image dimension is 0. Not saving." << std::endl;
-        return -1;
-    }    
-    // declare auto-pointer to FITS at function scope. Ensures no resources
-    // leaked if something fails in dynamic allocation.
-    std::auto_ptr<FITS> pFits(0);
-
-    try
-    {                
-        pFits.reset(new FITS(fileName, BYTE_IMG, 0, 0));
+        snprintf(text, sizeof(text) - 1, "%.*G", digits, std::isfinite(value) ? value : 0.0);
+        if (strpbrk(text, ".E") == NULL)
+        {
+            strcat(text, ".");
+        }
     }
-    catch (FITS::CantCreate)
+    while ((int)strlen(text) > FITS_VALUE_WIDTH && --digits > 1);
+    PatchValue(card, text);
+}
+
+void PatchLogical(char *card, bool value)
+{
+    PatchValue(card, value ? "T" : "F");
+}
+
+/* strings start in column 11 and keep their width; a longer one runs over
+   the comment, up to the 68 characters a card holds
+*/
+void PatchString(char *card, const std::string &value, int width)
+{
+    int length = std::min((int)value.size(), FITS_CARD - 12);
+    card[10] = '\'';
+    memcpy(card + 11, value.data(), length);
+    if (length < width)
     {
-        // ... or not, as the case may be.
-        return -1;
+        memset(card + 11 + length, ' ', width - length);
     }
-    catch (FITS::CantOpen)
+    int end = 11 + std::max(length, width);
+    card[end] = '\'';
+    if (length > width)
     {
-        // ... or not, as the case may be.
-        std::cerr << "Could not open file to save FITS image\n";
-        return -1;
+        memset(card + end + 1, ' ', FITS_CARD - end - 1);
     }
+}
+
+HeaderTemplate::HeaderTemplate(long bitpix, long bzero)
+{
+    AddLogical("SIMPLE", true, "file does conform to FITS standard");
+    AddInt("BITPIX", bitpix, "Bit depth of image");
+    AddInt("NAXIS", 0, "number of data axes");
+    AddLogical("EXTEND", true, "FITS dataset may contain extensions");
 
-    long nelements(1); 
+    AddString("TELESCOP", "FOXSI", 8, "Name of source telescope package");
+    AddString("INSTRUME", "SAAS", 8, "Name of instrument");
+    AddString("ORIGIN", "FOXSI/SAAS SBC", 8, "Location where file was made");
+    AddInt("WAVELNTH", 6320, "Wavelength of observation (ang)");
+    AddString("WAVE_STR", "632 Nm", 8, "Wavelength of observation string");
+    AddInt("BZERO", bzero, "Bit depth of image");
+    AddFloat("BSCALE", 1.0, "Bit depth of image");
+    AddString("WAVEUNIT", "angstrom", 8, "Units of WAVELNTH");
+    AddString("PIXLUNIT", "DN", 8, "Pixel units");
+    AddString("IMG_TYPE", "LIGHT", 8, "Image type");
+    AddDouble("RSUN_REF", 6.9600000e+08, "");
+    AddString("CTLMODE", "LIGHT", 8, "Image type");
+    AddInt("LVL_NUM", 0, "Level of data");
 
-    std::vector<long int> extAx;
-    extAx.push_back(width);
-    extAx.push_back(height);
-    string newName ("Raw Frame");
+    AddDouble("RSUN_OBS", 0, "");
 
-    pFits->setCompressionType(RICE_1);
+    AddString("CTYPE1", "HPLN-TAN", 8, "A string value labeling each coordinate axis");
+    AddString("CTYPE2", "HPLN-TAN", 8, "A string value labeling each coordinate axis");
+    AddString("CUNIT1", "arcsec", 8, "Coordinate Units");
+    AddString("CUNIT2", "arcsec", 8, "Coordinate Units");
+    AddDouble("CRVAL1", 0.0, "Coordinate value of the reference pixel");
+    AddDouble("CRVAL2", 0.0, "Coordinate value of the reference pixel");
+    lField[KEY_CDELT1] = AddDouble("CDELT1", 0.0, "Plate scale");
+    lField[KEY_CDELT2] = AddDouble("CDELT2", 0.0, "Plate scale");
+    AddDouble("CRPIX1", 0.0, "Reference pixel");
+    AddDouble("CRPIX2", 0.0, "Reference pixel");
 
-    ExtHDU* imageExt;
-    try{
-        imageExt = pFits->addImage(newName, BYTE_IMG, extAx, 1);
-    }
-    catch(FitsError e){
-        std::cerr << "Error while creating image extension\n";
-        std::cerr << e.message() << "\n";
-        return -1;
+    lField[KEY_EXPTIME] = AddDouble("EXPTIME", 0.0, "Exposure time in seconds");
+    // asctime() without its newline
+    lField[KEY_DATE_OBS] = AddString("DATE_OBS", "", 24, "Date and time when observation of this image started (UTC)");
+    lField[KEY_TIME_US] = AddInt("TIME_US", 0, "Microseconds past the DATE_OBS second");
+    lField[KEY_TIMEMONO] = AddDouble("TIMEMONO", 0.0, "Monotonic clock at exposure (s)");
+    lField[KEY_TIMELTCH] = AddLogical("TIMELTCH", false, "Times from latched camera clock, else delivery");
+    lField[KEY_TEMPCCD] = AddFloat("TEMPCCD", 0.0, "Temperature of camera in Celsius");
+
+    // room for <prefix>_<camera>_YYYYMMDD_HHMMSS_mmm.fits
+    lField[KEY_FILENAME] = AddString("FILENAME", "", 44, "Name of the data file");
+    lField[KEY_CAMERAID] = AddInt("CAMERAID", 0, "Serial Number of camera");
+    lField[KEY_EXPOSURE] = AddInt("EXPOSURE", 0, "Exposure time in usec");
+    lField[KEY_GAIN_PRE] = AddFloat("GAIN_PRE", 0.0, "Preamp gain of CCD");
+    lField[KEY_GAIN_ANA] = AddInt("GAIN_ANA", 0, "Analog gain of CCD");
+    lField[KEY_FRAMENUM] = AddInt("FRAMENUM", 0, "Frame number");
+    lField[KEY_ROI_X] = AddInt("ROI_X", 0, "Readout window x offset on the sensor");
+    lField[KEY_ROI_Y] = AddInt("ROI_Y", 0, "Readout window y offset on the sensor");
+    lField[KEY_SETTLING] = AddLogical("SETTLING", false, "Camera parameter change in progress");
+    lField[KEY_DATAMIN] = AddInt("DATAMIN", 0, "Lowest pixel value");
+    lField[KEY_DATAMAX] = AddInt("DATAMAX", 0, "Highest pixel value");
+    lField[KEY_BITDEPTH] = AddInt("BITDEPTH", 0, "Significant bits per pixel from the camera");
+    lField[KEY_CALIBRAT] = AddLogical("CALIBRAT", false, "Dark, flat and bad pixels corrected");
+    lField[KEY_NCOADD] = AddInt("NCOADD", 0, "Frames summed into this image");
+    lField[KEY_COADDREG] = AddLogical("COADDREG", false, "Summed frames aligned on their centroids");
+    lField[KEY_SUNFOUND] = AddLogical("SUNFOUND", false, "Solar disk found in this frame");
+    lField[KEY_SUN_X] = AddFloat("SUN_X", 0.0, "Disk centroid x on the sensor (pixels)");
+    lField[KEY_SUN_Y] = AddFloat("SUN_Y", 0.0, "Disk centroid y on the sensor (pixels)");
+    lField[KEY_SUNOFF_X] = AddFloat("SUNOFF_X", 0.0, "Disk centroid x from calibrated center (arcsec)");
+    lField[KEY_SUNOFF_Y] = AddFloat("SUNOFF_Y", 0.0, "Disk centroid y from calibrated center (arcsec)");
+    lField[KEY_LIMBFIT] = AddLogical("LIMBFIT", false, "Circle fitted to the solar limb");
+    lField[KEY_LIMB_X] = AddFloat("LIMB_X", 0.0, "Limb fit center x on the sensor (pixels)");
+    lField[KEY_LIMB_Y] = AddFloat("LIMB_Y", 0.0, "Limb fit center y on the sensor (pixels)");
+    lField[KEY_LIMB_R] = AddFloat("LIMB_R", 0.0, "Limb fit radius (pixels)");
+    lField[KEY_LIMB_RMS] = AddFloat("LIMB_RMS", 0.0, "Limb points about the fitted circle (pixels)");
+    lField[KEY_LIMB_N] = AddInt("LIMB_N", 0, "Limb points used in the fit");
+
+    lCards += std::string("END").append(FITS_CARD - 3, ' ');
+    lCards.append((FITS_BLOCK - lCards.size() % FITS_BLOCK) % FITS_BLOCK, ' ');
+    // the writers fill it into FITS_HEADER_BYTES without looking, a key
+    // added past that stops the program here instead
+    if (lCards.size() > FITS_HEADER_BYTES)
+    {
+        std::cerr << "FITS header template is " << lCards.size() << " bytes, more than FITS_HEADER_BYTES" << std::endl;
+        abort();
     }
+}
 
-    nelements = width*height*sizeof(unsigned char);
-
-    std::valarray<unsigned char> array(data, nelements);
-
-    long  fpixel(1);
-
-    //add keys to the primary header
-    pFits->pHDU().addKey("TELESCOP",std::string("FOXSI"),"Name of source telescope package");
-//    pFits->pHDU().addKey("SIMPLE",(int)1,"always T for True, if conforming FITS file");
-
-    pFits->pHDU().addKey("INSTRUME",std::string("SAAS"),"Name of instrument");
-    pFits->pHDU().addKey("ORIGIN", std::string("FOXSI/SAAS SBC") , "Location where file was made");
-    pFits->pHDU().addKey("WAVELNTH", (long)6320, "Wavelength of observation (ang)");
-    pFits->pHDU().addKey("WAVE_STR", std::string("632 Nm"), "Wavelength of observation string");
-    pFits->pHDU().addKey("BITPIX", (long) 8, "Bit depth of image");
-    pFits->pHDU().addKey("BZERO", (long) 128, "Bit depth of image");
-    pFits->pHDU().addKey("BSCALE", (float) 1.0, "Bit depth of image");
-    pFits->pHDU().addKey("WAVEUNIT", std::string("angstrom"), "Units of WAVELNTH");
-    pFits->pHDU().addKey("PIXLUNIT", std::string("DN"), "Pixel units");
-    pFits->pHDU().addKey("IMG_TYPE", std::string("LIGHT"), "Image type");
-    pFits->pHDU().addKey("RSUN_REF", (double)6.9600000e+08, "");
-    pFits->pHDU().addKey("CTLMODE", std::string("LIGHT"), "Image type");
-    pFits->pHDU().addKey("LVL_NUM", (int) 0 , "Level of data");
-
-    pFits->pHDU().addKey("RSUN_OBS", (double) 0, "");
-
-    pFits->pHDU().addKey("CTYPE1", std::string("HPLN-TAN"), "A string value labeling each coordinate axis");
-    pFits->pHDU().addKey("CTYPE2", std::string("HPLN-TAN"), "A string value labeling each coordinate axis");
-    pFits->pHDU().addKey("CUNIT1", std::string("arcsec"), "Coordinate Units");
-    pFits->pHDU().addKey("CUNIT2", std::string("arcsec"), "Coordinate Units");
-    pFits->pHDU().addKey("CRVAL1", (double)0.0, "Coordinate value of the reference pixel");
-    pFits->pHDU().addKey("CRVAL2", (double)0.0, "Coordinate value of the reference pixel");
-    pFits->pHDU().addKey("CDELT1", (double)keys.plateScale, "Plate scale");
-    pFits->pHDU().addKey("CDELT2", (double)keys.plateScale, "Plate scale");
-    pFits->pHDU().addKey("CRPIX1", (double)0.0, "Reference pixel");
-    pFits->pHDU().addKey("CRPIX2", (double)0.0, "Reference pixel");
-
-    timeKey = asctime(gmtime(&(keys.captureTime).tv_sec));
-    pFits->pHDU().addKey("EXPTIME", (float)keys.exposure/1e6, "Exposure time in seconds");
-    pFits->pHDU().addKey("DATE_OBS", timeKey , "Date and time when observation of this image started (UTC)");
-    pFits->pHDU().addKey("TEMPCCD", (float)keys.cameraTemperature, "Temperature of camera in Celsius");
-
-    pFits->pHDU().addKey("FILENAME", fileName , "Name of the data file");
-    //pFits->pHDU().addKey("TIME", 0 , "Time of observation in seconds within a day");
-    pFits->pHDU().addKey("CAMERAID", (int)keys.cameraID , "Serial Number of camera");
-    pFits->pHDU().addKey("EXPOSURE", (int)keys.exposure,"Exposure time in usec");
-    pFits->pHDU().addKey("GAIN_PRE", (float)keys.preampGain, "Preamp gain of CCD");
-    pFits->pHDU().addKey("GAIN_ANA", (int)keys.analogGain, "Analog gain of CCD");
-    pFits->pHDU().addKey("FRAMENUM", (long)keys.frameCount, "Frame number");
-    
-
-    try{
-        imageExt->write(fpixel, nelements, array);
+size_t HeaderTemplate::Add(const char *name, const std::string &value, const char *comment)
+{
+    std::string card(name);
+    card.resize(8, ' ');
+    card += "= " + value;
+    if (comment[0] != '\0')
+    {
+        card += std::string(" / ") + comment;
     }
-    catch(FitsException e){
-        std::cerr << "Exception while writing image to extension\n";
-        std::cerr << e.message() << std::endl;
+    card.resize(FITS_CARD, ' ');
+    size_t offset = lCards.size();
+    lCards += card;
+    return offset;
+}
+
+size_t HeaderTemplate::AddString(const char *name, const std::string &value, int width, const char *comment)
+{
+    // a string is at least 8 characters between the quotes
+    std::string quoted = "'" + value;
+    quoted.resize(1 + std::max(std::max((int)value.size(), width), 8), ' ');
+    return Add(name, quoted + "'", comment);
+}
+
+size_t HeaderTemplate::AddInt(const char *name, long value, const char *comment)
+{
+    size_t offset = Add(name, std::string(FITS_VALUE_WIDTH, ' '), comment);
+    PatchInt(&lCards[offset], value);
+    return offset;
+}
+
+size_t HeaderTemplate::AddFloat(const char *name, double value, const char *comment)
+{
+    size_t offset = Add(name, std::string(FITS_VALUE_WIDTH, ' '), comment);
+    PatchReal(&lCards[offset], value, FITS_FLOAT_DIGITS);
+    return offset;
+}
+
+size_t HeaderTemplate::AddDouble(const char *name, double value, const char *comment)
+{
+    size_t offset = Add(name, std::string(FITS_VALUE_WIDTH, ' '), comment);
+    PatchReal(&lCards[offset], value, FITS_DOUBLE_DIGITS);
+    return offset;
+}
+
+size_t HeaderTemplate::AddLogical(const char *name, bool value, const char *comment)
+{
+    size_t offset = Add(name, std::string(FITS_VALUE_WIDTH, ' '), comment);
+    PatchLogical(&lCards[offset], value);
+    return offset;
+}
+
+size_t HeaderTemplate::Bytes() const
+{
+    return lCards.size();
+}
+
+void HeaderTemplate::Fill(const HeaderData &keys, const std::string &fileName, char *header) const
+{
+    memcpy(header, lCards.data(), lCards.size());
+
+    struct tm date;
+    gmtime_r(&keys.captureTime.tv_sec, &date);
+    char dateObs[32];
+    asctime_r(&date, dateObs);
+    dateObs[strcspn(dateObs, "\n")] = '\0';
+
+    PatchReal(header + lField[KEY_CDELT1], keys.plateScale, FITS_DOUBLE_DIGITS);
+    PatchReal(header + lField[KEY_CDELT2], keys.plateScale, FITS_DOUBLE_DIGITS);
+    PatchReal(header + lField[KEY_EXPTIME], (float)keys.exposure/1e6, FITS_DOUBLE_DIGITS);
+    PatchString(header + lField[KEY_DATE_OBS], dateObs, 24);
+    PatchInt(header + lField[KEY_TIME_US], keys.captureTime.tv_nsec/1000);
+    PatchReal(header + lField[KEY_TIMEMONO], keys.captureTimeMono.tv_sec + keys.captureTimeMono.tv_nsec/1e9,
+              FITS_DOUBLE_DIGITS);
+    PatchLogical(header + lField[KEY_TIMELTCH], keys.clockLatched);
+    PatchReal(header + lField[KEY_TEMPCCD], keys.cameraTemperature, FITS_FLOAT_DIGITS);
+    PatchString(header + lField[KEY_FILENAME], fileName, 44);
+    PatchInt(header + lField[KEY_CAMERAID], keys.cameraID);
+    PatchInt(header + lField[KEY_EXPOSURE], keys.exposure);
+    PatchReal(header + lField[KEY_GAIN_PRE], keys.preampGain, FITS_FLOAT_DIGITS);
+    PatchInt(header + lField[KEY_GAIN_ANA], keys.analogGain);
+    PatchInt(header + lField[KEY_FRAMENUM], keys.frameCount);
+    PatchInt(header + lField[KEY_ROI_X], keys.roiOffset[0]);
+    PatchInt(header + lField[KEY_ROI_Y], keys.roiOffset[1]);
+    PatchLogical(header + lField[KEY_SETTLING], keys.settling);
+    PatchInt(header + lField[KEY_DATAMIN], keys.imageMinMax[0]);
+    PatchInt(header + lField[KEY_DATAMAX], keys.imageMinMax[1]);
+    PatchInt(header + lField[KEY_BITDEPTH], keys.bitDepth);
+    PatchLogical(header + lField[KEY_CALIBRAT], keys.calibrated);
+    PatchInt(header + lField[KEY_NCOADD], keys.coadded);
+    PatchLogical(header + lField[KEY_COADDREG], keys.registered);
+    PatchLogical(header + lField[KEY_SUNFOUND], keys.sunFound);
+    PatchReal(header + lField[KEY_SUN_X], keys.sunCenter[0], FITS_FLOAT_DIGITS);
+    PatchReal(header + lField[KEY_SUN_Y], keys.sunCenter[1], FITS_FLOAT_DIGITS);
+    PatchReal(header + lField[KEY_SUNOFF_X], keys.sunOffset[0], FITS_FLOAT_DIGITS);
+    PatchReal(header + lField[KEY_SUNOFF_Y], keys.sunOffset[1], FITS_FLOAT_DIGITS);
+    PatchLogical(header + lField[KEY_LIMBFIT], keys.limbFound);
+    PatchReal(header + lField[KEY_LIMB_X], keys.limbCenter[0], FITS_FLOAT_DIGITS);
+    PatchReal(header + lField[KEY_LIMB_Y], keys.limbCenter[1], FITS_FLOAT_DIGITS);
+    PatchReal(header + lField[KEY_LIMB_R], keys.limbRadius, FITS_FLOAT_DIGITS);
+    PatchReal(header + lField[KEY_LIMB_RMS], keys.limbRms, FITS_FLOAT_DIGITS);
+    PatchInt(header + lField[KEY_LIMB_N], keys.limbPoints);
+}
+
+// built before main(), one per image type
+const HeaderTemplate byteHeader(8, 128);
+const HeaderTemplate wordHeader(16, 32768);
+
+/* An empty primary HDU holding the keys and a Rice tile-compressed image
+   extension. The cards of the filled-in template go to fits_write_record()
+   one at a time. cfitsio still reads the primary header's keywords back
+   when fits_create_img() closes it and moves on to the extension, so what
+   the template saves is formatting each card and looking keys up to
+   update them, not the header parse. The extension is compressed from the
+   caller's buffer without a copy.
+*/
+template <class T>
+int writeImage(const T *data, int imageType, int dataType, const HeaderTemplate &keysTemplate,
+               const HeaderData &keys, const std::string &fileName, int width, int height)
+{
+    if (width == 0 || height == 0)
+    {
+        std::cerr << "Image dimension is 0. Not saving." << std::endl;
         return -1;
     }
+    char header[FITS_HEADER_BYTES];
+    keysTemplate.Fill(keys, fileName, header);
 
-    } catch (FitsError fe) {
-        std::cerr << "Exception somewhere else in writeFITSImage()\n";
-        std::cerr << fe.message() << std::endl;
-        //throw fe;
+    // cfitsio does nothing once status is set, the calls run in a row;
+    // an existing file is left alone
+    fitsfile *fptr = NULL;
+    int status = 0;
+    long axes[2] = {width, height};
+    fits_create_file(&fptr, fileName.c_str(), &status);
+    bool created = (status == 0);
+    // every card up to END, cfitsio ends the header and pads it itself
+    for (size_t card = 0; card < keysTemplate.Bytes() && status == 0; card += FITS_CARD)
+    {
+        if (strncmp(header + card, "END     ", 8) == 0)
+        {
+            break;
+        }
+        char record[FLEN_CARD];
+        memcpy(record, header + card, FITS_CARD);
+        record[FITS_CARD] = '\0';
+        fits_write_record(fptr, record, &status);
+    }
+    fits_set_compression_type(fptr, RICE_1, &status);
+    fits_create_img(fptr, imageType, 2, axes, &status);
+    // a fresh header, nothing to look up and replace
+    fits_write_key(fptr, TSTRING, "EXTNAME", (void *)"Raw Frame", NULL, &status);
+    // cfitsio only reads from the array, whatever the prototype says
+    fits_write_img(fptr, dataType, 1, (LONGLONG)width * height, (void *)data, &status);
+    if (status == 0)
+    {
+        // the handle is gone whatever the close returns
+        fits_close_file(fptr, &status);
+        fptr = NULL;
     }
 
+    if (status != 0)
+    {
+        char message[FLEN_STATUS];
+        fits_get_errstatus(status, message);
+        std::cerr << "Error while writing " << fileName << ": " << message << std::endl;
+        // don't leave a partial file behind
+        int ignored = 0;
+        if (fptr != NULL)
+        {
+            fits_close_file(fptr, &ignored);
+        }
+        if (created)
+        {
+            unlink(fileName.c_str());
+        }
+        return -1;
+    }
     return 0;
+}
+}
+
+int writeFITSImage(const unsigned char *data, const HeaderData &keys, const std::string &fileName, int width, int height)
+{
+    return writeImage(data, BYTE_IMG, TBYTE, byteHeader, keys, fileName, width, height);
+}
 
-}
\ No newline at end of file
+int writeFITSImage(const uint16_t *data, const HeaderData &keys, const std::string &fileName, int width, int height)
+{
+    return writeImage(data, USHORT_IMG, TUSHORT, wordHeader, keys, fileName, width, height);
+}
+
+size_t formatFITSHeader(const HeaderData &keys, const std::string &fileName, bool words, char *header)
+{
+    const HeaderTemplate &keysTemplate = words ? wordHeader : byteHeader;
+    keysTemplate.Fill(keys, fileName, header);
+    return keysTemplate.Bytes();
+}
@@ -1,9 +1,15 @@
+#ifndef _COMPRESSION_HPP_
+#define _COMPRESSION_HPP_
+
 #include <string>
 #include <ctime>
+#include <stdint.h>
+#include <stddef.h>
 
 struct HeaderData
 {
     timespec captureTime, captureTimeMono;
+    bool clockLatched;      // capture time from latched device clock samples, not delivery
     int cameraID;
     float cameraTemperature;
     int cpuTemperature;
@@ -14,6 +20,34 @@ struct HeaderData
     int analogGain;
     int imageMinMax[2];
     float plateScale;
+    bool settling;
+    int roiOffset[2];       // readout window position on the sensor
+    int bitDepth;           // significant bits in each pixel, 8, 10 or 12
+    bool calibrated;        // dark, flat and bad pixels corrected
+    int coadded;            // frames summed into the image
+    bool registered;        // and aligned on their centroids first
+    bool sunFound;
+    float sunCenter[2];     // disk centroid in sensor pixels
+    float sunOffset[2];     // from the calibrated center, arcsec
+    bool limbFound;
+    float limbCenter[2];    // center of the circle fitted to the limb, sensor pixels
+    float limbRadius;       // pixels
+    float limbRms;          // of the limb points about the circle, pixels
+    int limbPoints;         // limb points used in the fit
 };
 
-int writeFITSImage(unsigned char *data, HeaderData keys, const std::string fileName, int width, int height);
+/* Rice-compressed image extension behind a primary HDU with the keys,
+   written by cfitsio straight from data; returns 0, or -1 on error
+*/
+int writeFITSImage(const unsigned char *data, const HeaderData &keys, const std::string &fileName, int width, int height);
+// Mono10/Mono12 frames, unpacked to one word per pixel
+int writeFITSImage(const uint16_t *data, const HeaderData &keys, const std::string &fileName, int width, int height);
+
+#define FITS_HEADER_BYTES 5760  // room for the primary header, two FITS blocks
+
+/* The primary header writeFITSImage() would write for these keys, filled
+   into header (FITS_HEADER_BYTES); returns its length
+*/
+size_t formatFITSHeader(const HeaderData &keys, const std::string &fileName, bool words, char *header);
+
+#endif
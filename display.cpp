@@ -1,27 +1,43 @@
 #define SAVE_IMAGES false // true to continuously save images
 #define SAVE_LOCATION1 "/mnt/SAAS/images/" //Save locations for FITS files
 #define MOD_SAVE 30
-#define TIMESTAMP_LENGTH       19
+#define TIMESTAMP_LENGTH       20
 #define PRINT_TO_FILE true // Default for whether print statements are sent to screen or file.
 
 #define MAX_THREADS            10
 #define MAX_SAVE_THREADS       4
+#define SAVE_QUEUE_DEPTH       8    // frames waiting for a writer thread before one is dropped
+#define SAVE_OVERFLOW          0    // with the queue full: 0 drops the oldest frame, 1 the newest, 2 waits
+#define FRAME_POOL_SPARE       2    // frame buffers beyond what the displays and writers can hold
 #define SLEEP_CAMERA_CONNECT   1    // waits for errors while connecting to camera
+#define RECONNECT_TIMEOUTS     5    // consecutive 1 s frame timeouts before the camera is considered lost
 #define SLEEP_KILL             2    // waits when killing all threads
 #define DEFAULT_CALIB_CENTER_X       648    // the default calibrated screen center for HUD display
 #define DEFAULT_CALIB_CENTER_Y       483    // the default calibrated screen center for HUD display
 #define NUM_CIRCLE_SEGMENTS   30    // the number of line segments to use for circles
 #define NUM_XPIXELS         1296    // number of X pixels of sensor
 #define NUM_YPIXELS         966     // number of Y pixels of sensor
-
-// Camera Defaults, overwritten by program_settings.txt
-#define DEFAULT_CAMERA_EXPOSURE 10000
-#define DEFAULT_CAMERA_AGAIN    400
-#define DEFAULT_CAMERA_PGAIN    -3
-#define DEFAULT_CAMERA_BLEVEL   0
+#define SYNTHETIC_CAMERA    false   // true to use generated frames instead of the Imperx camera
+#define SYNTHETIC_RATE      30      // frame rate of the generated frames
+#define PARAMETER_POLL_MS   1000    // how often camera parameters and temperature are read back
+#define AUTO_ROI            false   // true to read out only a window around the Sun
+#define ROI_MARGIN          40      // pixels of sky kept around the disk in the window
+#define AUTO_EXPOSURE       false   // true to adjust exposure and gain to the Sun's brightness
+#define EXPOSURE_TARGET     192     // level of the disk center that auto-exposure aims for (0-255)
+#define EXPOSURE_STEP       1.25    // factor applied per +/- key press
+#define CAMERA_BINDINGS "/home/schriste/SAAS/camera_bindings.txt"   // which camera is which
+#define REALTIME_PROFILE "/home/schriste/SAAS/realtime_profile.txt" // thread priorities and CPUs
+#define JITTER_REPORT_SECONDS   60  // how often the frame delivery jitter histogram is logged
+#define COADD_FRAMES        1       // frames summed into each saved frame, 1 to save single frames
+#define COADD_REGISTER      true    // true to align the frames of a sum on their centroids
+#define ZOOM_FACTOR         2       // screen pixels per sensor pixel in zoom mode
+#define CALIBRATE           false   // true to correct frames with the camera's dark, flat and bad pixels
+#define CALIBRATION_DIR "/home/schriste/SAAS/calibration/"  // <save prefix>_dark.fits, _flat.fits, _badpix.fits
 
 #include <stdlib.h>
 #include <math.h>
+#include <algorithm>
+#include <atomic>
 #include <stdio.h>
 #include <string.h>
 #include <time.h>
@@ -36,60 +52,81 @@
 #include <GL/glut.h>
 
 #include "compression.hpp"
+#include "FrameExchange.hpp"
 
 // imperx camera libraries
-#include <PvSampleUtils.h>
-#include <PvDevice.h>
-#include <PvPipeline.h>
-#include <PvBuffer.h>
-#include <PvStream.h>
-#include <PvStreamRaw.h>
-#include <PvSystem.h>
-#include <PvInterface.h>
-#include <PvDevice.h>
-
-//#include <opencv.hpp>
+#include "ImperxStream.hpp"
+#include "SyntheticSource.hpp"
+#include "CameraControl.hpp"
+#include "CameraManager.hpp"
+#include "AutoROI.hpp"
+#include "AutoExposure.hpp"
+#include "Realtime.hpp"
+#include "Centroid.hpp"
+#include "LimbFit.hpp"
+#include "FrameStats.hpp"
+#include "Calibration.hpp"
+#include "Preview.hpp"
+#include "CoAdd.hpp"
+#include "FramePool.hpp"
+#include "WriterPool.hpp"
 
 // global declarations
 // width and height of IMPERX Camera frame
 static float width = NUM_XPIXELS;
 static float height = NUM_YPIXELS;
 static float arcsec_to_pixel = 3.47;   // the plate scale
-long int frameCount = 0;
-long int saveCount = 0;  // counter for the number of images saved to disk
-float camera_temperature = 0.0;
 
 unsigned int calib_center_x = DEFAULT_CALIB_CENTER_X;
 unsigned int calib_center_y = DEFAULT_CALIB_CENTER_Y;
 
 bool isSavingImages = SAVE_IMAGES;
-unsigned int max_save_threads = MAX_SAVE_THREADS;
-unsigned int save_threads_count = 0;
+unsigned int max_save_threads = MAX_SAVE_THREADS;     // writer threads
+unsigned int save_queue_depth = SAVE_QUEUE_DEPTH;
+unsigned int save_overflow = SAVE_OVERFLOW;
 unsigned int mod_save = MOD_SAVE;
 
+bool use_synthetic_camera = SYNTHETIC_CAMERA;
+unsigned int synthetic_rate = SYNTHETIC_RATE;
+unsigned int parameter_poll_ms = PARAMETER_POLL_MS;
+bool use_auto_roi = AUTO_ROI;
+unsigned int roi_margin = ROI_MARGIN;
+bool use_auto_exposure = AUTO_EXPOSURE;
+std::atomic<unsigned int> exposure_target(EXPOSURE_TARGET);  // set from the keyboard, read by every camera thread
+bool use_calibration = CALIBRATE;
+unsigned int coadd_frames = COADD_FRAMES;
+bool coadd_register = COADD_REGISTER;
+
 FILE* file_ptr = NULL; // Pointer for general files.
 static FILE* print_file_ptr = NULL; // Pointer to where print statements should be sent.
 
 char message[100] = "Starting Up";
-int cameraID = 0;
 
-// to store the image
-unsigned char *data = new unsigned char[NUM_XPIXELS * NUM_YPIXELS];
-// to write the image
-unsigned char *data_save = new unsigned char[NUM_XPIXELS * NUM_YPIXELS];
+// buffers for the display copies and the saved frames of every camera,
+// declared before the cameras and writers so it is destroyed after them
+FramePool frame_pool;
 
-GLuint texture[1];      	// Storage for one texture to display the camera image
+// one context per camera, each run by its own CameraThread
+CameraManager cameras;
+int display_camera = 0;     // the camera shown on screen, 'c' cycles through them
+
+// scheduling per thread role, everything default without a profile file
+RealtimeProfile realtime;
+
+// writes the saved frames of every camera
+WriterPool writers;
 
-typedef struct CameraSettings{
-    uint16_t exposure;
-    uint16_t analogGain;
-    int16_t preampGain;
-    int blackLevel;
-} CameraSettings;
+GLuint texture[1];      	// Storage for one texture to display the camera image
+// where the texture goes on the sensor, the readout window of the frame shown
+float texture_x = 0, texture_y = 0, texture_width = NUM_XPIXELS, texture_height = NUM_YPIXELS;
+// the window, the preview level that suits it, and the sensor region shown when zoomed
+int window_width = NUM_XPIXELS, window_height = NUM_YPIXELS;
+int preview_level = 0;
+bool zoom = false;
+float view_x = 0, view_y = 0, view_width = NUM_XPIXELS, view_height = NUM_YPIXELS;
 
-// load default values, should be overwritten by program_settings.txt if exists
-CameraSettings settings = { .exposure = DEFAULT_CAMERA_EXPOSURE, .analogGain = DEFAULT_CAMERA_AGAIN,
-                            .preampGain = DEFAULT_CAMERA_PGAIN, .blackLevel = DEFAULT_CAMERA_BLEVEL};
+// load default values (see ImperxStream.hpp), should be overwritten by program_settings.txt if exists
+CameraSettings settings;
 
 bool is_camera_ready = false;
 
@@ -108,13 +145,28 @@ struct Thread_data{
     uint16_t command_key;
     uint8_t command_num_vars;
     uint16_t command_vars[15];
+    // frame to be saved, times are the fitted device exposure times
+    long frame_count;
+    timespec capture_time;
+    timespec capture_time_mono;
+    bool clock_latched;         // capture time fitted to latched device clock samples
+    int offset_x, offset_y;     // readout window position on the sensor
+    CameraSnapshot parameters;
+    bool settling;      // a parameter change was in flight during the exposure
+    CentroidResult centroid;    // where the Sun was in that frame
+    LimbFitResult limb;         // circle fitted to its limb
+    int image_min_max[2];       // in the camera's own values
+    int bit_depth;
+    bool calibrated;
+    int coadded;                // frames summed into the image
+    bool registered;            // frames of a sum aligned on their centroids
 };
 struct Thread_data thread_data[MAX_THREADS];
 
 
 //Function declarations
 void sig_handler(int signum);
-void start_thread(void *(*start_routine) (void *), const Thread_data *tdata);
+int start_thread(void *(*start_routine) (void *), const Thread_data *tdata, ThreadRole role);
 static int current_time(void);
 void framerate(void);
 static void gl_load_gltextures();
@@ -126,12 +178,16 @@ void gl_reshape (int w, int h);
 void gl_switchToOrtho (void);
 
 void keyboard (unsigned char key, int x, int y);
-void *CameraThread( void * threadargs, int camera_id);
-void *ImageSaveThread(void *threadargs);
+void *CameraThread( void * threadargs);
+void camera_status(const CameraContext *ctx, const char *status);
+void release_control(CameraContext *ctx, CameraControl *control);
+void format_health(const StreamHealthReport &health, char *buffer, size_t length);
+void fill_save_job(const Thread_data *my_data, SaveJob *job);
 void read_calibrated_ccd_center(void);
 void read_settings(void);
 void kill_all_threads();
 void writeCurrentUT(char *buffer);
+void writeUT(const timespec &time, char *buffer);
 
 // utilities
 timespec TimespecDiff(timespec start, timespec end);
@@ -151,14 +207,18 @@ timespec TimespecDiff(timespec start, timespec end){
 
 void writeCurrentUT(char *buffer)
 {
-    struct timeval tv;
-    struct tm *now_tm;
+    timespec now;
+    clock_gettime(CLOCK_REALTIME, &now);    // Get seconds and nanoseconds
+    writeUT(now, buffer);
+}
 
-    gettimeofday(&tv, NULL);    // Get seconds and microseconds
-    now_tm = gmtime(&tv.tv_sec);
+void writeUT(const timespec &time, char *buffer)
+{
+    struct tm *now_tm;
+    now_tm = gmtime(&time.tv_sec);
 
     sprintf(buffer, "%04d%02d%02d_%02d%02d%02d_%03d", now_tm->tm_year+1900, now_tm->tm_mon+1,
-            now_tm->tm_mday, now_tm->tm_hour, now_tm->tm_min, now_tm->tm_sec, (int)(tv.tv_usec/1000));
+            now_tm->tm_mday, now_tm->tm_hour, now_tm->tm_min, now_tm->tm_sec, (int)(time.tv_nsec/1000000));
 
 }
 
@@ -205,16 +265,91 @@ static void gl_load_gltextures()
 
     // Typical texture generation using data from the bitmap
     glBindTexture(GL_TEXTURE_2D, texture[0]);
+
+    // Only upload when the camera has published a newer frame (or the view
+    // changed), the texture keeps the last one otherwise
+    static int shown_camera = -1;
+    static bool shown_zoom = false;
+    static int shown_level = -1;
+    static int texture_pixels_x = 0, texture_pixels_y = 0;
+    CameraContext *ctx = cameras.Get(display_camera);
+    if (ctx == NULL) return;
+    if (!ctx->display.Update() && shown_camera == display_camera &&
+        shown_zoom == zoom && shown_level == preview_level) return;
+    if (ctx->display.ReadBuffer() == NULL) return;  // nothing published yet
+    shown_camera = display_camera;
+    shown_zoom = zoom;
+    shown_level = preview_level;
+
     glTexParameteri(GL_TEXTURE_2D,GL_TEXTURE_MIN_FILTER,GL_LINEAR);
     glTexParameteri(GL_TEXTURE_2D,GL_TEXTURE_MAG_FILTER,GL_LINEAR);
     glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_BASE_LEVEL, 0);
     glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAX_LEVEL, 0);
-    glTexImage2D(GL_TEXTURE_2D, 0, GL_LUMINANCE, width, height, 0, GL_LUMINANCE, GL_UNSIGNED_BYTE, (GLvoid*)data);
+    glPixelStorei(GL_UNPACK_ALIGNMENT, 1);
+
+    // the sensor region uploaded, and the rows and columns of it in the buffer
+    int offset_x = ctx->display.ReadOffsetX(), offset_y = ctx->display.ReadOffsetY();
+    int level = zoom ? 0 : preview_level;
+    int skip_x = 0, skip_y = 0;
+    int pixels_x = ctx->display.ReadWidth(level), pixels_y = ctx->display.ReadHeight(level);
+    if (zoom){
+        // full resolution around the crosshair, what fits in the window
+        pixels_x = std::min(pixels_x, window_width / ZOOM_FACTOR);
+        pixels_y = std::min(pixels_y, window_height / ZOOM_FACTOR);
+        skip_x = std::min(std::max((int)calib_center_x - offset_x - pixels_x / 2, 0), ctx->display.ReadWidth() - pixels_x);
+        skip_y = std::min(std::max((int)calib_center_y - offset_y - pixels_y / 2, 0), ctx->display.ReadHeight() - pixels_y);
+        view_x = offset_x + skip_x;
+        view_y = offset_y + skip_y;
+        view_width = pixels_x;
+        view_height = pixels_y;
+    } else {
+        view_x = 0;
+        view_y = 0;
+        view_width = NUM_XPIXELS;
+        view_height = NUM_YPIXELS;
+    }
+    texture_x = offset_x + skip_x;
+    texture_y = offset_y + skip_y;
+    texture_width = pixels_x << level;
+    texture_height = pixels_y << level;
+
+    glPixelStorei(GL_UNPACK_ROW_LENGTH, ctx->display.ReadWidth(level));
+    glPixelStorei(GL_UNPACK_SKIP_PIXELS, skip_x);
+    glPixelStorei(GL_UNPACK_SKIP_ROWS, skip_y);
+    // the texture is only reallocated when its size changes
+    if (pixels_x == texture_pixels_x && pixels_y == texture_pixels_y){
+        glTexSubImage2D(GL_TEXTURE_2D, 0, 0, 0, pixels_x, pixels_y,
+                        GL_LUMINANCE, GL_UNSIGNED_BYTE, (GLvoid*)ctx->display.ReadBuffer(level));
+    } else {
+        glTexImage2D(GL_TEXTURE_2D, 0, GL_LUMINANCE, pixels_x, pixels_y, 0,
+                     GL_LUMINANCE, GL_UNSIGNED_BYTE, (GLvoid*)ctx->display.ReadBuffer(level));
+        texture_pixels_x = pixels_x;
+        texture_pixels_y = pixels_y;
+    }
+    glPixelStorei(GL_UNPACK_ROW_LENGTH, 0);
+    glPixelStorei(GL_UNPACK_SKIP_PIXELS, 0);
+    glPixelStorei(GL_UNPACK_SKIP_ROWS, 0);
+}
+
+// world coordinates are sensor pixels, y up, over the region being shown
+static void gl_set_view(float x, float y, float w, float h)
+{
+    glMatrixMode(GL_PROJECTION);
+    glLoadIdentity();
+    gluOrtho2D(x, x + w, height - y - h, height - y);
+    glMatrixMode(GL_MODELVIEW);
 }
 
 void gl_draw_string( int x, int y, char *str ) {
+    // text stays where it is on the screen when zoomed
+    glMatrixMode(GL_PROJECTION);
+    glPushMatrix();
+    glLoadIdentity();
+    gluOrtho2D(0.0f, width, 0, height);
     glColor4f( 1.0f, 1.0f, 1.0f, 1.0f);
     glRasterPos2i( x, y );
+    glPopMatrix();
+    glMatrixMode(GL_MODELVIEW);
 
     for ( int i=0, len=strlen(str); i<len; i++ ) {
         if ( str[i] == '\n' ) {
@@ -258,313 +393,571 @@ void kill_all_threads()
             stop_message[i] = true;
         }
     }
-    sleep(SLEEP_KILL);
+    // the camera threads clear started[] on the way out, their last
+    // saves still have writers to go to; none may be left waiting for a
+    // free job, a thread cancelled in there would keep the pool's lock
+    writers.Wake();
+    bool running = true;
+    for(int waited = 0; running && waited < SLEEP_KILL * 10; waited++){
+        running = false;
+        for(int i = 0; i < MAX_THREADS; i++ ){
+            running = running || started[i];
+        }
+        if (running) usleep(100000);
+    }
     for(int i = 0; i < MAX_THREADS; i++ ){
         if (started[i]) {
             fprintf(print_file_ptr, "Quitting thread %i, quitting status is %i\n", i, pthread_cancel(threads[i]));
             started[i] = false;
         }
     }
+    // then writes what is queued
+    writers.Stop();
 }
 
 void *CameraThread( void * threadargs)
 {
-    // camera_id refers to 0 PYAS, 1 is RAS (if valid)
+    // camera_id refers to 0 PYAS, 1 is RAS (if valid), see the bindings file
     long tid = (long)((struct Thread_data *)threadargs)->thread_id;
-    fprintf(print_file_ptr, "Camera thread #%ld!\n", tid);
+    CameraContext *ctx = cameras.Get(((struct Thread_data *)threadargs)->camera_id);
+    fprintf(print_file_ptr, "Camera thread #%ld for camera %d %s!\n", tid, ctx->id, ctx->name.c_str());
+    realtime.PrefaultStack(ROLE_CAMERA);
 
-    //timespec frameRate = {0,FRAME_CADENCE*1000};
     bool cameraReady = false;
 
-    //cv::Mat localFrame, mockFrame;
-    //HeaderData localHeader;
-    //timespec localCaptureTime, preExposure, postExposure, timeElapsed, timeToWait;
-
     char lDoodle[] = "|\\-|-/";
     int lDoodleIndex = 0;
-    PvInt64 lImageCountVal = 0;
-    double lFrameRateVal = 0.0;
-    double lBandwidthVal = 0.0;
-    char thread_message[100];
-
-    PvSystem lSystem;
-    PvDeviceInfo* lDeviceInfo;
-    PvResult lResult;
-    PvDevice lDevice;
-    PvStream lStream;
-    PvPipeline *lPipeline;
-    PvGenParameterArray *lStreamParams;
-    PvGenParameterArray *lDeviceParams;
-    PvUInt32 lDeviceCount;
+    char status[100];
+
+    // All acquisition goes through the shared free-running FrameSource path,
+    // backed by the Imperx camera or by generated frames for testing
+    FrameSource *camera;
+    ImperxStream *imperx = NULL;
+    if (use_synthetic_camera || ctx->address == SYNTHETIC_ADDRESS){
+        SyntheticSource *synthetic = new SyntheticSource();
+        synthetic->SetFrameRate(synthetic_rate);
+        camera = synthetic;
+    } else {
+        imperx = new ImperxStream();
+        camera = imperx;
+    }
+    ctx->source = camera;
+    FrameLease frame;
+    // parameters and temperature, read back in the background
+    CameraControl *control = NULL;
+    CameraSnapshot parameters;
+
+    // time to first frame is measured from the last good frame before the
+    // camera was lost (or from starting) to the first frame after the new
+    // connection, so the timeouts it took to notice the loss are included
+    timespec searchStart, lastGoodFrame;
+    clock_gettime(CLOCK_MONOTONIC, &searchStart);
+    lastGoodFrame = searchStart;
+    bool awaitingFirstFrame = true;
+    int timeouts = 0;
+    // stream health goes to the HUD and the log once a second
+    StreamHealthReport health;
+    timespec lastHealth = {0, 0};
+
+    // how much later or earlier than the camera's own frame spacing frames
+    // reach this thread, i.e. the scheduling jitter on the host side
+    JitterHistogram jitter;
+    timespec lastArrival = {0, 0}, lastCapture = {0, 0};
+    uint64_t lastBlockID = 0;
+    timespec lastJitterReport;
+    clock_gettime(CLOCK_MONOTONIC, &lastJitterReport);
+
+    // readout window around the Sun, full sensor until it is found
+    const cv::Rect full_sensor(0, 0, NUM_XPIXELS, NUM_YPIXELS);
+    AutoROI roi(NUM_XPIXELS, NUM_YPIXELS);
+    roi.SetMargin(roi_margin);
+    // applied by the control thread, frames keep coming in meanwhile
+    ParameterChangeHandle roiChange;
+    // the aspect solution, on the 8-bit display copy of every frame
+    Centroid centroid;
+    CentroidResult sun;
+    // and a circle fitted to the limb, not biased by a clipped disk
+    LimbFit limbFit;
+    LimbFitResult limb;
+    // levels of the display copy, taken while copying
+    FrameStats levels;
+    // dark, flat and bad pixels, for the display copy (and so the aspect
+    // solution) and the saved frames
+    Calibration calibration(NUM_XPIXELS, NUM_YPIXELS);
+    if (use_calibration){
+        std::string prefix = std::string(CALIBRATION_DIR) + ctx->savePrefix;
+        calibration.LoadDark(prefix + "_dark.fits");
+        calibration.LoadFlat(prefix + "_flat.fits");
+        calibration.LoadBadPixels(prefix + "_badpix.fits");
+        fprintf(print_file_ptr, "%s calibration: %s dark, %s flat, %d bad pixels\n", ctx->name.c_str(),
+                calibration.HasDark() ? "with" : "no", calibration.HasFlat() ? "with" : "no", calibration.BadPixels());
+    }
+    const bool calibrate = use_calibration && calibration.Ready();
+    // runs of frames summed for saving, from the calibrated display copy,
+    // with their own pointing solution
+    CoAdd coadd(NUM_XPIXELS, NUM_YPIXELS);
+    coadd.SetFrames(coadd_frames);
+    coadd.SetRegistration(coadd_register);
+    const bool coadding = coadd_frames > 1;
+    std::vector<unsigned char> stackMean(coadding ? NUM_XPIXELS * NUM_YPIXELS : 0);
+    CentroidResult stackSun;
+    LimbFitResult stackLimb;
+    long stacks = 0;
+    timespec stackTime = {0, 0}, stackTimeMono = {0, 0};
+    bool stackClockLatched = false;
+    // never below the configured gain, gain only helps once exposure runs out
+    AutoExposure autoExposure;
+    autoExposure.SetLimits(5, 38221, ctx->settings.analogGain, 1023);
 
     while(!stop_message[tid])
     {
         if (!cameraReady){
-            strcpy( message, "Searching for Camera.");
-            fprintf(print_file_ptr, "%s\n", message);
+            camera_status(ctx, "Searching for Camera.");
 
-            // Find all GEV Devices on the network.
-            lSystem.SetDetectionTimeout( 2000 );
-            lResult = lSystem.Find();
-            if( !lResult.IsOK() )
-            {
-                sprintf(message, "PvSystem::Find Error: %s", lResult.GetCodeString().GetAscii() );
-                fprintf(print_file_ptr, "%s\n", message);
-                cameraReady = false;
-                sleep(SLEEP_CAMERA_CONNECT);
+            int connected;
+            if (imperx != NULL && !ctx->address.empty()){
+                connected = imperx->Connect(ctx->address);
             } else {
-                // Get the number of GEV Interfaces that were found using GetInterfaceCount.
-                PvUInt32 lInterfaceCount = lSystem.GetInterfaceCount();
-
-                // Display information about all found interface
-                // For each interface, display information about all devices.
-                for( PvUInt32 x = 0; x < lInterfaceCount; x++ ){
-                    // get pointer to each of interface
-                    PvInterface * lInterface = lSystem.GetInterface( x );
-
-                    sprintf(message, "Interface %i\nMAC Address: %s\nIP Address: %s\nSubnet Mask: %s\n\n",
-                           x,
-                           lInterface->GetMACAddress().GetAscii(),
-                           lInterface->GetIPAddress().GetAscii(),
-                           lInterface->GetSubnetMask().GetAscii() );
-                    fprintf(print_file_ptr, "%s\n", message);
-
-                    // Get the number of GEV devices that were found using GetDeviceCount.
-                    lDeviceCount = lInterface->GetDeviceCount();
-
-                    for( PvUInt32 y = 0; y < lDeviceCount ; y++ )
-                    {
-                        lDeviceInfo = lInterface->GetDeviceInfo( y );
-                        sprintf(message, "Device %i\nMAC Address: %s\nIP Address: %s\nSerial number: %s\n",
-                               y,
-                               lDeviceInfo->GetMACAddress().GetAscii(),
-                               lDeviceInfo->GetIPAddress().GetAscii(),
-                               lDeviceInfo->GetSerialNumber().GetAscii() );
-                        fprintf(print_file_ptr, "%s\n", message);
-                        cameraID = atoi(lDeviceInfo->GetSerialNumber().GetAscii());
-                    }
-                }
+                connected = camera->Connect();
+            }
+            if (connected != 0){
+                camera_status(ctx, "No Camera Found.");
+                sleep(SLEEP_CAMERA_CONNECT);
+                continue;
+            }
+            ctx->serialNumber = atoi(camera->GetSerialNumber().c_str());
+            sprintf(status, "Successfully connected to %s", camera->GetSerialNumber().c_str() );
+            camera_status(ctx, status);
 
-                // If no device is selected, abort
-                if( lDeviceCount == 0 ){
-                    sprintf(message, "No Camera Found.\n" );
-                    fprintf(print_file_ptr, "%s\n", message);
-                    cameraReady = false;
-                    sleep(SLEEP_CAMERA_CONNECT);
-                } else {
-                    // Connect to the GEV Device
-                    sprintf(message, "Connecting to %s\n", lDeviceInfo->GetMACAddress().GetAscii() );
-                    fprintf(print_file_ptr, "%s\n", message);
-                    //sprintf(serial_number, lDeviceInfo->GetSerialNumber().GetAscii());
-                    if ( !lDevice.Connect( lDeviceInfo ).IsOK() ){
-                        fprintf(print_file_ptr, "Unable to connect to %s\n", lDeviceInfo->GetMACAddress().GetAscii() );
-                        cameraReady = false;
-                        sleep(SLEEP_CAMERA_CONNECT);
+            // set camera settings, must happen before the stream parameters are locked
+            if (camera->SetPixelFormat(ctx->settings.pixelFormat) != 0){
+                camera->SetPixelFormat(MONO8);
+            }
+            camera->ConfigureStream();
+            camera->SetExposure(ctx->settings.exposure);
+            camera->SetAnalogGain(ctx->settings.analogGain);
+            if (camera->SetPreAmpGain(ctx->settings.preampGain) != 0){
+                camera->SetPreAmpGain(0);
+            }
+            camera->SetBlackLevel(ctx->settings.blackLevel);
+            // the window may be left over from before, buffers are sized for what is set now
+            camera->SetROI(full_sensor);
+            roi.Reset();
+            roiChange.reset();
+            autoExposure.Reset();
+
+            camera_status(ctx, "Starting pipeline");
+            if (camera->Initialize() != 0){
+                camera_status(ctx, "Unable to open stream to camera.");
+                camera->Stop();
+                camera->Disconnect();
+                sleep(SLEEP_CAMERA_CONNECT);
+                continue;
+            }
+
+            // The pipeline is already "armed", we just have to tell the device
+            // to start sending us images
+            camera_status(ctx, "Sending StartAcquisition command to device");
+            camera->StartAcquisition();
+
+            control = new CameraControl(camera);
+            pthread_attr_t control_attr;
+            pthread_attr_init(&control_attr);
+            realtime.Prepare(&control_attr, ROLE_CONTROL);
+            control->Start(parameter_poll_ms, &control_attr);
+            pthread_attr_destroy(&control_attr);
+            pthread_mutex_lock(&ctx->controlMutex);
+            ctx->control = control;
+            pthread_mutex_unlock(&ctx->controlMutex);
+
+            cameraReady = true;
+            ctx->frameCount = 0;
+        }
+        else    // camera is ready so start getting images
+        {
+            // a readout window change restarts acquisition, so it goes in
+            // here between frames with the last lease dropped
+            frame.release();
+            control->ApplyWindow();
+            int result = camera->Retrieve(frame, 1000);
+            timespec arrival;
+            clock_gettime(CLOCK_MONOTONIC, &arrival);
+
+            if ( result == 0 )
+            {
+                timeouts = 0;
+                lastGoodFrame = arrival;
+                // only consecutive frames, a lost one says nothing about scheduling
+                if (lastBlockID != 0 && frame.blockID == lastBlockID + 1){
+                    jitter.Add((arrival.tv_sec - lastArrival.tv_sec) * 1e6 + (arrival.tv_nsec - lastArrival.tv_nsec) / 1e3
+                               - (frame.captureTimeMono.tv_sec - lastCapture.tv_sec) * 1e6
+                               - (frame.captureTimeMono.tv_nsec - lastCapture.tv_nsec) / 1e3);
+                }
+                lastBlockID = frame.blockID;
+                lastArrival = arrival;
+                lastCapture = frame.captureTimeMono;
+                if (arrival.tv_sec - lastJitterReport.tv_sec >= JITTER_REPORT_SECONDS){
+                    fprintf(print_file_ptr, "%s ", ctx->name.c_str());
+                    jitter.Print(print_file_ptr, "frame delivery");
+                    jitter.Reset();
+                    lastJitterReport = arrival;
+                }
+                if (awaitingFirstFrame){
+                    timespec now;
+                    clock_gettime(CLOCK_MONOTONIC, &now);
+                    ctx->timeToFirstFrame = (now.tv_sec - searchStart.tv_sec) * 1e3 + (now.tv_nsec - searchStart.tv_nsec) / 1e6;
+                    sprintf(status, "First frame %.0f ms after %s", ctx->timeToFirstFrame,
+                            ctx->reconnects > 0 ? "losing the camera" : "starting");
+                    camera_status(ctx, status);
+                    awaitingFirstFrame = false;
+                }
+                ctx->captureTime = frame.captureTime;
+                ctx->captureTimeMono = frame.captureTimeMono;
+
+                // Copy out for the display, cut down to 8 bits, the PvBuffer
+                // goes back to the pipeline as soon as the lease is dropped.
+                // The frame's levels come from the same pass. The copy is a
+                // pool buffer, shared with the writers when it is saved. A
+                // deeper frame due to be saved is unpacked in that pass too
+                levels.Reset();
+                bool stackDone = false;
+                bool frameSaveDue = !coadding && (ctx->frameCount % mod_save == 0 || ctx->saveRequested);
+                FrameRef processed = frame_pool.Acquire();
+                FrameRef unpacked;
+                int unpackedMin = 0, unpackedMax = 0;
+                if (!processed.empty() && frame.width <= NUM_XPIXELS && frame.height <= NUM_YPIXELS){
+                    ctx->display.SetWriteFrame(processed);
+                    if (frameSaveDue && frame.format != MONO8){
+                        unpacked = frame_pool.Acquire();
+                    }
+                    if (!unpacked.empty()){
+                        UnpackReducePixelsStats(frame.data(), frame.format, (uint16_t *)unpacked.data(),
+                                                ctx->display.WriteBuffer(), frame.width * frame.height,
+                                                levels, unpackedMin, unpackedMax);
                     } else {
-                        sprintf(message, "Successfully connected to %s %s\n", lDeviceInfo->GetMACAddress().GetAscii(), lDeviceInfo->GetSerialNumber().GetAscii() );
-                        fprintf(print_file_ptr, "%s\n", message);
-
-                        // Get device parameters need to control streaming
-                        lDeviceParams = lDevice.GetGenParameters();
-
-                        // Negotiate streaming packet size
-                        lDevice.NegotiatePacketSize();
-
-                        // Open stream - have the PvDevice do it for us
-                        sprintf(message, "Opening stream to device\n" );
-                        fprintf(print_file_ptr, "%s\n", message);
-                        lStream.Open( lDeviceInfo->GetIPAddress() );
-
-                        // Create the PvPipeline object
-                        lPipeline = new PvPipeline( &lStream );
-
-                        // Reading payload size from device
-                        PvInt64 lSize = 0;
-                        lDeviceParams->GetIntegerValue( "PayloadSize", lSize );
-
-                        // Set the Buffer size and the Buffer count
-                        lPipeline->SetBufferSize( static_cast<PvUInt32>( lSize ) );
-                        lPipeline->SetBufferCount( 16 ); // Increase for high frame rate without missing block IDs
-
-                        // Have to set the Device IP destination to the Stream
-                        lDevice.SetStreamDestination( lStream.GetLocalIPAddress(), lStream.GetLocalPort() );
-
-                        // IMPORTANT: the pipeline needs to be "armed", or started before
-                        // we instruct the device to send us images
-                        sprintf(message, "Starting pipeline\n" );
-                        fprintf(print_file_ptr, "%s\n", message);
-
-                        // set camera settings
-                        PvResult outcome;
-                        lDeviceParams->SetBooleanValue("ProgFrameTimeEnable", false);
-                        outcome = lDeviceParams->SetEnumValue("ExposureMode", "Timed");
-                        outcome = lDeviceParams->SetIntegerValue("ExposureTimeRaw", settings.exposure);
-                        outcome = lDeviceParams->SetIntegerValue("GainRaw", settings.analogGain);
-
-                        PvString value;
-                        switch(settings.preampGain)
-                        {
-                            case -3:
-                                value = "minus3dB";
-                                break;
-                            case 0:
-                                value = "zero_dB";
-                                break;
-                            case 3:
-                                value = "plus3dB";
-                                break;
-                            case 6:
-                                value = "plus6dB";
-                                break;
-                            default:
-                                value = "zero_dB";
+                        ReducePixelsStats(frame.data(), frame.format, ctx->display.WriteBuffer(),
+                                          frame.width * frame.height, levels);
+                    }
+                    // the levels stay raw, saturation is a property of the raw frame
+                    if (calibrate){
+                        calibration.Apply(ctx->display.WriteBuffer(), frame.width, frame.height,
+                                          frame.offsetX, frame.offsetY);
+                    }
+                    centroid.Measure(ctx->display.WriteBuffer(), frame.width, frame.height,
+                                     frame.offsetX, frame.offsetY, sun);
+                    limb = LimbFitResult();
+                    if (sun.found){
+                        limbFit.Measure(ctx->display.WriteBuffer(), frame.width, frame.height,
+                                        frame.offsetX, frame.offsetY, sun.threshold, limb);
+                    }
+                    pthread_mutex_lock(&ctx->healthMutex);
+                    ctx->centroid = sun;
+                    ctx->limb = limb;
+                    pthread_mutex_unlock(&ctx->healthMutex);
+
+                    // Sum runs of frames, a run taken across a settings change is dropped
+                    if (coadding){
+                        if (!control->IsSettled(frame.captureTimeMono)){
+                            coadd.Reset();
+                        } else {
+                            stackDone = coadd.Add(ctx->display.WriteBuffer(), frame.width, frame.height,
+                                                  frame.offsetX, frame.offsetY, sun);
+                            // a run is timed by its first frame
+                            if (coadd.Count() == 1){
+                                stackTime = frame.captureTime;
+                                stackTimeMono = frame.captureTimeMono;
+                                stackClockLatched = frame.clockLatched;
+                            }
                         }
-
-                        outcome = lDeviceParams->SetEnumValue("PreAmpRaw", value);
-                        if (settings.blackLevel >= 0 && settings.blackLevel <= 1023){
-                            outcome = lDeviceParams->SetIntegerValue("BlackLevelRaw", settings.blackLevel);
+                        if (stackDone){
+                            stacks++;
+                            coadd.Mean(&stackMean[0]);
+                            centroid.Measure(&stackMean[0], coadd.Width(), coadd.Height(),
+                                             coadd.OffsetX(), coadd.OffsetY(), stackSun);
+                            stackLimb = LimbFitResult();
+                            if (stackSun.found){
+                                limbFit.Measure(&stackMean[0], coadd.Width(), coadd.Height(),
+                                                coadd.OffsetX(), coadd.OffsetY(), stackSun.threshold, stackLimb);
+                            }
                         }
+                    }
+                    // previews for a display smaller than the sensor
+                    HalvePixels(ctx->display.WriteBuffer(0), frame.width, frame.height, ctx->display.WriteBuffer(1));
+                    HalvePixels(ctx->display.WriteBuffer(1), frame.width / 2, frame.height / 2, ctx->display.WriteBuffer(2));
+                    ctx->display.Publish(frame.width, frame.height, ctx->frameCount, frame.offsetX, frame.offsetY);
+                }
 
-                        lPipeline->Start();
-
-                        // Get stream parameters/stats
-                        lStreamParams = lStream.GetParameters();
-
-                        // TLParamsLocked is optional but when present, it MUST be set to 1
-                        // before sending the AcquisitionStart command
-                        lDeviceParams->SetIntegerValue( "TLParamsLocked", 1 );
-
-                        sprintf(message, "Resetting timestamp counter...\n" );
-                        fprintf(print_file_ptr, "%s\n", message);
-                        lDeviceParams->ExecuteCommand( "GevTimestampControlReset" );
+                // Camera temperature and settings come from the cached snapshot,
+                // no control-channel round trip per frame
+                char timestamp[TIMESTAMP_LENGTH];
+                writeCurrentUT(timestamp);
 
-                        // The pipeline is already "armed", we just have to tell the device
-                        // to start sending us images
-                        sprintf(message, "Sending StartAcquisition command to device\n" );
-                        fprintf(print_file_ptr, "%s\n", message);
-                        lDeviceParams->ExecuteCommand( "AcquisitionStart" );
+                parameters = control->Get();
+                ctx->temperature = parameters.temperature;
+                if (ctx->id == display_camera){
+                    sprintf(message, "%s %s - Acquiring: %5.1f C", ctx->name.c_str(), timestamp, ctx->temperature );
+                }
 
-                        cameraReady = true;
-                        frameCount = 0;
+                // Follow the Sun's brightness, judged only on frames taken
+                // with the current settings so a change is seen before the next
+                if (use_auto_exposure && control->IsSettled(frame.captureTimeMono)){
+                    autoExposure.SetTarget(exposure_target);
+                    bool change = (levels.pixels > 0) ?
+                        autoExposure.Update(levels, parameters.exposure, parameters.analogGain) :
+                        autoExposure.Update(frame, parameters.exposure, parameters.analogGain);
+                    if (change){
+                        if (autoExposure.Exposure() != parameters.exposure){
+                            control->SetExposure(autoExposure.Exposure());
+                        }
+                        if (autoExposure.Gain() != parameters.analogGain){
+                            control->SetAnalogGain(autoExposure.Gain());
+                        }
+                        fprintf(print_file_ptr, "%s auto-exposure: level %d, %.2f%% saturated, exposure %d -> %d usec, gain %d -> %d\n",
+                                ctx->name.c_str(), autoExposure.BrightLevel(), autoExposure.SaturatedFraction() * 100,
+                                parameters.exposure, autoExposure.Exposure(), parameters.analogGain, autoExposure.Gain());
                     }
                 }
-            }
-        }
-        else    // camera is ready so start getting images
-        {
-            // Retrieve next buffer
-            PvBuffer *lBuffer = NULL;
-            PvResult  lOperationResult;
-            PvResult lResult = lPipeline->RetrieveNextBuffer( &lBuffer, 1000, &lOperationResult );
 
-            if ( lResult.IsOK() )
-            {
-                if ( lOperationResult.IsOK() ){
-                    //
-                    // We now have a valid buffer. This is where you would typically process the buffer.
-                    // -----------------------------------------------------------------------------------------
-                    // ...
-
-                    lStreamParams->GetIntegerValue( "ImagesCount", lImageCountVal );
-                    lStreamParams->GetFloatValue( "AcquisitionRateAverage", lFrameRateVal );
-                    lStreamParams->GetFloatValue( "BandwidthAverage", lBandwidthVal );
-
-                    // If the buffer contains an image, display width and height
-                    PvUInt32 lWidth = 0, lHeight = 0;
-                    if ( lBuffer->GetPayloadType() == PvPayloadTypeImage )
-                    {
-                        // Get image specific buffer interface
-                        PvImage *lImage = lBuffer->GetImage();
-
-                        // Read width, height
-                        lWidth = lBuffer->GetImage()->GetWidth();
-                        lHeight = lBuffer->GetImage()->GetHeight();
-                        data = lImage->GetDataPointer();
-
-                        // Get the camera temperature - this may slow down image aquisition...
-                        long long int lTempValue = -512;
-                        char timestamp[TIMESTAMP_LENGTH];
-                        writeCurrentUT(timestamp);
-
-                        lDevice.GetGenParameters()->GetIntegerValue( "GetTemperature", lTempValue );
-                        if (lTempValue >= 512) lTempValue = lTempValue - 1024;
-                        camera_temperature = (float)lTempValue / 4.;
-                        sprintf(message, "%s - Acquiring: %5.1f C", timestamp, camera_temperature );
-
-                        if (frameCount % mod_save == 0 && save_threads_count < max_save_threads){
-                            // Increment save threads counter.
-                            save_threads_count++;
-                            sprintf(thread_message, "Incrementing save_threads_count.  Was %u.  Now %u\n",
-                                save_threads_count-1, save_threads_count);
-                            fprintf(print_file_ptr, "%s", thread_message);
-
-                            // start thread to save the image.
-                            Thread_data tdata;
-                            start_thread(ImageSaveThread, &tdata);
-
-                            // Decrement save threads counter;
-                            save_threads_count--;
-                            sprintf(thread_message, "Decrementing save_threads_count. Was %u.  Now %u.\n", save_threads_count+1, save_threads_count);
-                            fprintf(print_file_ptr, "%s", thread_message);
+                // when summing, every mod_save-th run is saved instead of every mod_save-th frame
+                bool saveDue = coadding ? (stackDone && (stacks % mod_save == 0 || ctx->saveRequested)) :
+                                          (ctx->frameCount % mod_save == 0 || ctx->saveRequested);
+                if (saveDue){
+                    // A job for the writer threads, with their queue full a
+                    // frame is lost or waited for (save_overflow). The job
+                    // holds the pixels by reference: 8-bit frames are the
+                    // display copy itself, sums and deeper frames get a
+                    // buffer of their own
+                    SaveJob *job = writers.Acquire();
+                    FrameRef image;
+                    if (job != NULL && !coadding && frame.format == MONO8){
+                        image = processed;
+                    } else if (job != NULL && !coadding && !unpacked.empty()){
+                        image = unpacked;
+                    } else if (job != NULL && (coadding || (frame.width <= NUM_XPIXELS && frame.height <= NUM_YPIXELS))){
+                        image = frame_pool.Acquire();
+                    }
+                    if (job != NULL && image.empty()){
+                        writers.Release(job);
+                        job = NULL;
+                    }
+                    if (job != NULL){
+                        int imageMin = levels.min, imageMax = levels.max;
+                        Thread_data tdata = Thread_data();
+                        if (coadding){
+                            // the sum, one word per pixel
+                            memcpy(image.data(), coadd.Sum(), coadd.Width() * coadd.Height() * sizeof(uint16_t));
+                            PixelRange((const uint16_t *)image.data(), coadd.Width() * coadd.Height(), imageMin, imageMax);
+                            job->width = coadd.Width();
+                            job->height = coadd.Height();
+                            job->words = true;
+                            // the bits the sum of that many 8-bit frames can reach
+                            tdata.bit_depth = 8;
+                            while ((1 << tdata.bit_depth) - 1 < 255 * coadd.Frames()){
+                                tdata.bit_depth++;
+                            }
+                            tdata.coadded = coadd.Frames();
+                        } else {
+                            // saved at full depth, deeper formats one word per pixel;
+                            // an 8-bit frame is already copied and calibrated
+                            if (!unpacked.empty()){
+                                imageMin = unpackedMin;
+                                imageMax = unpackedMax;
+                            } else if (frame.format != MONO8){
+                                UnpackPixelsRange(frame.data(), frame.format, (uint16_t *)image.data(),
+                                                  frame.width * frame.height, imageMin, imageMax);
+                            }
+                            if (calibrate && frame.format == MONO8){
+                                PixelRange(image.data(), frame.width * frame.height, imageMin, imageMax);
+                            } else if (calibrate){
+                                calibration.Apply((uint16_t *)image.data(), frame.width, frame.height,
+                                                  frame.offsetX, frame.offsetY, PixelBits(frame.format));
+                                PixelRange((const uint16_t *)image.data(), frame.width * frame.height, imageMin, imageMax);
+                            }
+                            job->width = frame.width;
+                            job->height = frame.height;
+                            job->words = frame.format != MONO8;
+                            tdata.bit_depth = PixelBits(frame.format);
+                            tdata.coadded = 1;
+                        }
+                        job->frame = image;
+
+                        tdata.camera_id = ctx->id;
+                        tdata.frame_count = ctx->frameCount;
+                        tdata.capture_time = frame.captureTime;
+                        tdata.capture_time_mono = frame.captureTimeMono;
+                        tdata.clock_latched = frame.clockLatched;
+                        tdata.offset_x = frame.offsetX;
+                        tdata.offset_y = frame.offsetY;
+                        tdata.parameters = parameters;
+                        tdata.settling = !control->IsSettled(frame.captureTimeMono);
+                        tdata.centroid = sun;
+                        tdata.limb = limb;
+                        tdata.image_min_max[0] = imageMin;
+                        tdata.image_min_max[1] = imageMax;
+                        tdata.calibrated = calibrate;
+                        if (coadding){
+                            // the run is timed and placed by its first frame
+                            tdata.frame_count = ctx->frameCount - coadd.Frames() + 1;
+                            tdata.capture_time = stackTime;
+                            tdata.capture_time_mono = stackTimeMono;
+                            tdata.clock_latched = stackClockLatched;
+                            tdata.offset_x = coadd.OffsetX();
+                            tdata.offset_y = coadd.OffsetY();
+                            tdata.settling = false;
+                            tdata.centroid = stackSun;
+                            tdata.limb = stackLimb;
+                            tdata.registered = coadd_register;
                         }
-                        frameCount++;
+                        fill_save_job(&tdata, job);
+                        writers.Submit(job);
+                        ctx->saveCount++;
+                        ctx->saveRequested = false;
                     }
-                    char block_message[255];
-                    char timestamp[TIMESTAMP_LENGTH];
-                    writeCurrentUT(timestamp);
-                    sprintf(block_message, "\n %c BlockID: %016llX W: %i H: %i %.01f FPS %.01f Mb/s at %s\r\n",
-                            lDoodle[ lDoodleIndex ],
-                            lBuffer->GetBlockID(),
-                            lWidth,
-                            lHeight,
-                            lFrameRateVal,
-                            lBandwidthVal / 1000000.0,
-                            timestamp);
-                    fprintf(print_file_ptr, block_message);
-                // We have an image - do some processing (...) and VERY IMPORTANT,
-                // release the buffer back to the pipeline
                 }
-                lPipeline->ReleaseBuffer( lBuffer );
+                ctx->frameCount++;
+
+                char block_message[255];
+                sprintf(block_message, "\n %s %c BlockID: %016llX W: %i H: %i %.01f FPS %.01f Mb/s at %s\r\n",
+                        ctx->name.c_str(),
+                        lDoodle[ lDoodleIndex ],
+                        (unsigned long long)frame.blockID,
+                        frame.width,
+                        frame.height,
+                        health.frameRate,
+                        health.bandwidth * 8 / 1000000.0,
+                        timestamp);
+                fprintf(print_file_ptr, "%s", block_message);
+
+                // Read out only the Sun once it has been found, and the
+                // whole sensor again when it is lost. The window changes
+                // before the next Retrieve(); until it is done the frames
+                // still have the old one, so they aren't judged
+                if (roiChange && roiChange->GetState() == ParameterChange::FAILED){
+                    roi.Reset();
+                    bool full = roiChange->RequestedWindow() == full_sensor;
+                    roiChange = full ? ParameterChangeHandle() : control->SetROI(full_sensor);
+                    camera_status(ctx, "Readout window refused, back to the full sensor");
+                } else if (use_auto_roi && (!roiChange || roiChange->IsDone()) && roi.Update(frame)){
+                    cv::Rect window = roi.Window();
+                    roiChange = control->SetROI(window);
+                    sprintf(status, "Readout window %dx%d at (%d,%d) requested", window.width, window.height, window.x, window.y);
+                    camera_status(ctx, status);
+                }
             }
-            else
+            else if ( result < 0 )
             {
                 // Timeout
-                fprintf(print_file_ptr, "%c Timeout\r", lDoodle[ lDoodleIndex ] );
+                fprintf(print_file_ptr, "%s %c Timeout\r", ctx->name.c_str(), lDoodle[ lDoodleIndex ] );
+                if (++timeouts >= RECONNECT_TIMEOUTS){
+                    // Nothing for a while, assume the link dropped and start
+                    // over, Connect() tries the known device before scanning
+                    camera_status(ctx, "Camera lost, reconnecting.");
+                    release_control(ctx, control);
+                    control = NULL;
+                    frame.release();
+                    camera->Stop();
+                    camera->Disconnect();
+                    ctx->reconnects++;
+                    searchStart = lastGoodFrame;
+                    awaitingFirstFrame = true;
+                    lastBlockID = 0;
+                    timeouts = 0;
+                    cameraReady = false;
+                }
+            }
+
+            timespec now;
+            clock_gettime(CLOCK_MONOTONIC, &now);
+            if (cameraReady && now.tv_sec > lastHealth.tv_sec){
+                health = camera->GetStreamHealth();
+                pthread_mutex_lock(&ctx->healthMutex);
+                ctx->health = health;
+                pthread_mutex_unlock(&ctx->healthMutex);
+                char health_message[255];
+                format_health(health, health_message, sizeof(health_message));
+                fprintf(print_file_ptr, "%s health: %s\n", ctx->name.c_str(), health_message);
+                if (sun.found){
+                    fprintf(print_file_ptr, "%s Sun at (%.2f, %.2f) px, offset (%.1f, %.1f) arcsec\n", ctx->name.c_str(),
+                            sun.x, sun.y, (sun.x - calib_center_x) * arcsec_to_pixel, (sun.y - calib_center_y) * arcsec_to_pixel);
+                    if (limb.found){
+                        fprintf(print_file_ptr, "%s limb fit (%.2f, %.2f) px, radius %.2f, rms %.2f px, %d of %d points\n",
+                                ctx->name.c_str(), limb.x, limb.y, limb.radius, limb.rms, limb.inliers, limb.points);
+                    }
+                } else {
+                    fprintf(print_file_ptr, "%s Sun not found\n", ctx->name.c_str());
+                }
+                if (coadding && stackSun.found){
+                    fprintf(print_file_ptr, "%s sum of %d: Sun at (%.2f, %.2f) px, shifted up to %d px\n", ctx->name.c_str(),
+                            coadd.Frames(), stackSun.x, stackSun.y, coadd.MaxShift());
+                }
+                if (levels.pixels > 0){
+                    fprintf(print_file_ptr, "%s levels %d-%d, mean %.1f sd %.1f, 99%% below %d, %.3f%% saturated\n",
+                            ctx->name.c_str(), levels.min, levels.max, levels.Mean(), levels.StdDev(),
+                            levels.Percentile(0.01), levels.SaturatedFraction() * 100);
+                }
+                if (ctx->id == 0){
+                    // the writers are shared, one camera reports them
+                    WriterPoolReport saves = writers.Report();
+                    fprintf(print_file_ptr, "writers: %d threads, queue %d of %d (peak %d), %ld written, %ld failed, %ld dropped, %.0f ms per file (max %.0f)\n",
+                            saves.threads, saves.depth, saves.capacity, saves.maxDepth, saves.written, saves.failed,
+                            saves.dropped, saves.lastWrite, saves.maxWrite);
+                    fprintf(print_file_ptr, "frame buffers: %d of %d free, %ld times none\n",
+                            frame_pool.Available(), frame_pool.Count(), frame_pool.Misses());
+                }
+                lastHealth = now;
             }
         }
     }
 
-    delete lPipeline;
-    lPipeline = NULL;
-
     fprintf(print_file_ptr, "CameraStream thread #%ld exiting\n", tid);
-    // clean up the camera
-    // Tell the device to stop sending images
-    fprintf(print_file_ptr, "Sending AcquisitionStop command to the device\n" );
-    lDeviceParams->ExecuteCommand( "AcquisitionStop" );
-
-    // If present reset TLParamsLocked to 0. Must be done AFTER the
-    // streaming has been stopped
-    lDeviceParams->SetIntegerValue( "TLParamsLocked", 0 );
-
-    // We stop the pipeline - letting the object lapse out of
-    // scope would have had the destructor do the same, but we do it anyway
-    fprintf(print_file_ptr, "Stop pipeline\n" );
-    lPipeline->Stop();
-
-    // Now close the stream. Also optionnal but nice to have
-    fprintf(print_file_ptr, "Closing stream\n" );
-    lStream.Close();
+    if (control != NULL){
+        release_control(ctx, control);
+    }
+    // clean up the camera, the lease has to go back before the pipeline stops
+    frame.release();
+    fprintf(print_file_ptr, "Stopping acquisition and closing stream\n" );
+    camera->Stop();
 
     // Finally disconnect the device. Optional, still nice to have
     fprintf(print_file_ptr, "Disconnecting device\n" );
-    lDevice.Disconnect();
+    camera->Disconnect();
+    ctx->source = NULL;
+    delete camera;
 
     cameraReady = false;
     started[tid] = false;
     pthread_exit( NULL );
 }
 
+void release_control(CameraContext *ctx, CameraControl *control)
+{
+    // once it is off the context no other thread can be using it
+    pthread_mutex_lock(&ctx->controlMutex);
+    ctx->control = NULL;
+    pthread_mutex_unlock(&ctx->controlMutex);
+    control->Stop();
+    delete control;
+}
+
+void format_health(const StreamHealthReport &health, char *buffer, size_t length)
+{
+    snprintf(buffer, length, "%.1f FPS, interval p50 %.1f p99 %.1f max %.1f ms, gaps %ld, "
+             "missing %ld, resent %ld, failed %ld (last %d), reordered %ld, timeouts %ld, queue %d/%d, %s",
+             health.frameRate, health.intervalP50, health.intervalP99, health.intervalMax,
+             health.blockGaps, health.packetsMissing, health.packetsResent, health.failures,
+             health.lastFailure, health.reordered, health.timeouts, health.queuePeak, health.bufferCount,
+             health.CauseName());
+}
+
+void camera_status(const CameraContext *ctx, const char *status)
+{
+    // only the camera on screen gets the HUD, all of them go to the log
+    if (ctx->id == display_camera){
+        snprintf(message, sizeof(message), "%s %s", ctx->name.c_str(), status);
+    }
+    fprintf(print_file_ptr, "%s %s\n", ctx->name.c_str(), status);
+}
+
 void sig_handler(int signum)
 {
     if ((signum == SIGINT) || (signum == SIGTERM))
@@ -575,14 +968,17 @@ void sig_handler(int signum)
     }
 }
 
-void start_thread(void *(*routine) (void *), const Thread_data *tdata)
+int start_thread(void *(*routine) (void *), const Thread_data *tdata, ThreadRole role)
 {
     pthread_mutex_lock(&mutexStartThread);
 
     int i = 0;
     while (started[i] == true) {
         i++;
-        if (i == MAX_THREADS) return; //should probably throw an exception
+        if (i == MAX_THREADS) {
+            pthread_mutex_unlock(&mutexStartThread);
+            return -1;
+        }
     }
 
     //Copy the thread data to a global to prevent deallocation
@@ -594,8 +990,18 @@ void start_thread(void *(*routine) (void *), const Thread_data *tdata)
     pthread_attr_t attr;
     pthread_attr_init(&attr);
     pthread_attr_setdetachstate(&attr, PTHREAD_CREATE_DETACHED);
+    realtime.Prepare(&attr, role);
 
     int rc = pthread_create(&threads[i], &attr, routine, &thread_data[i]);
+    if (rc != 0) {
+        // most likely no permission for real-time scheduling, run it anyway
+        fprintf(print_file_ptr, "Can't start %s thread as profiled (%d), using default scheduling\n",
+                RealtimeProfile::RoleName(role), rc);
+        pthread_attr_destroy(&attr);
+        pthread_attr_init(&attr);
+        pthread_attr_setdetachstate(&attr, PTHREAD_CREATE_DETACHED);
+        rc = pthread_create(&threads[i], &attr, routine, &thread_data[i]);
+    }
     if (rc != 0) {
         fprintf(print_file_ptr, "ERROR; return code from pthread_create() is %d\n", rc);
     } else started[i] = true;
@@ -603,7 +1009,7 @@ void start_thread(void *(*routine) (void *), const Thread_data *tdata)
     pthread_attr_destroy(&attr);
     pthread_mutex_unlock(&mutexStartThread);
 
-    return;
+    return (rc == 0) ? 0 : -1;
 }
 
 void gl_init(void) {
@@ -635,14 +1041,18 @@ void gl_display (void) {
 	//glPushMatrix();
 
 	gl_load_gltextures();
+    gl_set_view(view_x, view_y, view_width, view_height);
 
     // draw the camera image as a texture
     glEnable(GL_TEXTURE_2D);
     glBegin(GL_QUADS);
-    glTexCoord2f(0.0f, 1.0f); glVertex3f(0.0f, 0.0f, 0.0f);	// Bottom left of the texture and quad
-    glTexCoord2f(1.0f, 1.0f); glVertex3f(width, 0.0f, 0.0f);	// Bottom right of the texture and quad
-    glTexCoord2f(1.0f, 0.0f); glVertex3f(width,  height, 0.0f);	// Top right of the texture and quad
-    glTexCoord2f(0.0f, 0.0f); glVertex3f(0.0f,  height, 0.0f);	// Top left of the texture and quad
+    // a readout window is drawn where it sits on the sensor, the rest stays black
+    float left = texture_x, right = texture_x + texture_width;
+    float bottom = height - texture_y - texture_height, top = height - texture_y;
+    glTexCoord2f(0.0f, 1.0f); glVertex3f(left, bottom, 0.0f);	// Bottom left of the texture and quad
+    glTexCoord2f(1.0f, 1.0f); glVertex3f(right, bottom, 0.0f);	// Bottom right of the texture and quad
+    glTexCoord2f(1.0f, 0.0f); glVertex3f(right,  top, 0.0f);	// Top right of the texture and quad
+    glTexCoord2f(0.0f, 0.0f); glVertex3f(left,  top, 0.0f);	// Top left of the texture and quad
     glEnd();
     glDisable(GL_TEXTURE_2D);
 
@@ -650,6 +1060,47 @@ void gl_display (void) {
 	glColor4f(1, 1, 1, 1);
     // draw the message string
 	gl_draw_string(100, 100, message);
+    // and the stream health of the camera on screen
+    CameraContext *ctx = cameras.Get(display_camera);
+    if (ctx != NULL){
+        char health_message[255];
+        pthread_mutex_lock(&ctx->healthMutex);
+        StreamHealthReport health = ctx->health;
+        CentroidResult sun = ctx->centroid;
+        LimbFitResult limb = ctx->limb;
+        pthread_mutex_unlock(&ctx->healthMutex);
+        format_health(health, health_message, sizeof(health_message));
+        gl_draw_string(100, 70, health_message);
+
+        // the measured Sun: its center, limb and offset from the calibrated center
+        char sun_message[100];
+        if (sun.found){
+            sprintf(sun_message, "Sun offset %+.1f %+.1f arcsec", (sun.x - calib_center_x) * arcsec_to_pixel,
+                    (sun.y - calib_center_y) * arcsec_to_pixel);
+            glColor4f(1, 1, 0, 1);
+            glBegin(GL_LINES);
+            glVertex2f(sun.x - 15, NUM_YPIXELS - sun.y);
+            glVertex2f(sun.x + 15, NUM_YPIXELS - sun.y);
+            glVertex2f(sun.x, NUM_YPIXELS - sun.y - 15);
+            glVertex2f(sun.x, NUM_YPIXELS - sun.y + 15);
+            glEnd();
+            gl_draw_circle(sun.x, NUM_YPIXELS - sun.y, 16*60 / arcsec_to_pixel, NUM_CIRCLE_SEGMENTS);
+            glColor4f(1, 1, 1, 1);
+        } else {
+            sprintf(sun_message, "Sun not found");
+        }
+        gl_draw_string(100, 40, sun_message);
+
+        // the fitted limb, where it differs from the centroid the disk is clipped
+        if (limb.found){
+            glColor4f(0, 1, 0, 1);
+            gl_draw_circle(limb.x, NUM_YPIXELS - limb.y, limb.radius, NUM_CIRCLE_SEGMENTS);
+            glColor4f(1, 1, 1, 1);
+            sprintf(sun_message, "Limb offset %+.1f %+.1f arcsec, rms %.2f px", (limb.x - calib_center_x) * arcsec_to_pixel,
+                    (limb.y - calib_center_y) * arcsec_to_pixel, limb.rms);
+            gl_draw_string(100, 10, sun_message);
+        }
+    }
 
     // X - line
 	glBegin(GL_LINES);
@@ -702,6 +1153,11 @@ void gl_display (void) {
 
 void gl_reshape (int w, int h) {
     glViewport (0, 0, (GLsizei)w, (GLsizei)h); //set the viewport to the current window specifications
+    // the coarsest preview that still has a pixel for every screen pixel
+    window_width = w;
+    window_height = h;
+    float shrink = std::min((float)NUM_XPIXELS / std::max(w, 1), (float)NUM_YPIXELS / std::max(h, 1));
+    preview_level = (shrink >= 4) ? 2 : (shrink >= 2) ? 1 : 0;
     glMatrixMode (GL_PROJECTION); //set the matrix to projection
     glLoadIdentity ();
     gluOrtho2D(0.0f, width, 0, height);
@@ -724,16 +1180,55 @@ void keyboard (unsigned char key, int x, int y) {
         sleep(SLEEP_KILL);
         exit(0); //quit the program
     }
-    if (key=='s')
+    CameraContext *ctx = cameras.Get(display_camera);
+    if (key=='s' && ctx != NULL)
     {
         // if images are currently saving automatically disable this functionality
         if (!isSavingImages){
-            Thread_data tdata;
-            start_thread(ImageSaveThread, &tdata);
+            // the camera thread saves its next frame
+            ctx->saveRequested = true;
         } else {
             sprintf(message, "Manual Saving Disabled.");
         }
     }
+    if (key=='z')
+    {
+        // full resolution around the crosshair, or back to the whole sensor
+        zoom = !zoom;
+        sprintf(message, zoom ? "Zoom on the crosshair." : "Zoom off.");
+    }
+    if (key=='c' && cameras.Count() > 1)
+    {
+        // Show the next camera
+        display_camera = (display_camera + 1) % cameras.Count();
+        ctx = cameras.Get(display_camera);
+        sprintf(message, "Showing camera %d %s", ctx->id, ctx->name.c_str());
+        fprintf(print_file_ptr, "%s\n", message);
+    }
+    if ((key=='+' || key=='-') && use_auto_exposure)
+    {
+        // auto-exposure owns the exposure, move what it aims for instead
+        int target = (key=='+') ? exposure_target * EXPOSURE_STEP : exposure_target / EXPOSURE_STEP;
+        exposure_target = std::min(std::max(target, 16), 250);
+        sprintf(message, "Auto-exposure target level %u.", exposure_target.load());
+        fprintf(print_file_ptr, "%s\n", message);
+    }
+    else if ((key=='+' || key=='-') && ctx != NULL)
+    {
+        // Queue an exposure change, the control thread applies and verifies it
+        // so the display never waits on the camera. The camera thread can't
+        // tear the control down while it is locked
+        pthread_mutex_lock(&ctx->controlMutex);
+        if (ctx->control != NULL){
+            int exposure = ctx->control->Get().exposure;
+            exposure = (key=='+') ? exposure * EXPOSURE_STEP : exposure / EXPOSURE_STEP;
+            if (exposure < 1) exposure = 1;
+            ctx->control->SetExposure(exposure);
+            sprintf(message, "%s exposure change to %d usec requested.", ctx->name.c_str(), exposure);
+            fprintf(print_file_ptr, "%s\n", message);
+        }
+        pthread_mutex_unlock(&ctx->controlMutex);
+    }
 }
 
 void read_calibrated_ccd_center(void) {
@@ -788,6 +1283,59 @@ void read_settings(void) {
                     break;
                 case 6:
                     mod_save = value;
+                    break;
+                case 7:
+                    use_synthetic_camera = value;
+                    fprintf(print_file_ptr, "use_synthetic_camera is set to %d\n", use_synthetic_camera);
+                    break;
+                case 8:
+                    synthetic_rate = value;
+                    break;
+                case 9:
+                    parameter_poll_ms = value;
+                    break;
+                case 10:
+                    use_auto_roi = value;
+                    fprintf(print_file_ptr, "use_auto_roi is set to %d\n", use_auto_roi);
+                    break;
+                case 11:
+                    roi_margin = value;
+                    break;
+                case 12:
+                    settings.pixelFormat = PixelFormatFor(value, IsPacked(settings.pixelFormat));
+                    fprintf(print_file_ptr, "pixel format is set to %s\n", PixelFormatName(settings.pixelFormat));
+                    break;
+                case 13:
+                    settings.pixelFormat = PixelFormatFor(PixelBits(settings.pixelFormat), value);
+                    fprintf(print_file_ptr, "pixel format is set to %s\n", PixelFormatName(settings.pixelFormat));
+                    break;
+                case 14:
+                    use_auto_exposure = value;
+                    fprintf(print_file_ptr, "use_auto_exposure is set to %d\n", use_auto_exposure);
+                    break;
+                case 15:
+                    exposure_target = value;
+                    fprintf(print_file_ptr, "exposure_target is set to %u\n", exposure_target.load());
+                    break;
+                case 16:
+                    use_calibration = value;
+                    fprintf(print_file_ptr, "use_calibration is set to %d\n", use_calibration);
+                    break;
+                case 17:
+                    coadd_frames = std::min(std::max(value, 1), 256);
+                    fprintf(print_file_ptr, "coadd_frames is set to %u\n", coadd_frames);
+                    break;
+                case 18:
+                    coadd_register = value;
+                    break;
+                case 19:
+                    save_queue_depth = std::max(value, 1);
+                    break;
+                case 20:
+                    save_overflow = std::min(std::max(value, 0), 2);
+                    fprintf(print_file_ptr, "save_overflow is set to %s\n",
+                            WriterPool::OverflowName((WriterPool::Overflow)save_overflow));
+                    break;
                 default:
                     break;
             }
@@ -800,49 +1348,47 @@ void read_settings(void) {
     fclose(file_ptr);
 }
 
-void *ImageSaveThread(void *threadargs)
+void fill_save_job(const Thread_data *my_data, SaveJob *job)
 {
-    char filename[128];
     char timestamp[TIMESTAMP_LENGTH];
-    timespec localCaptureTime;
-    timespec preSave, postSave, elapsedSave;
-    HeaderData localHeader;
-
-    long tid = (long)((struct Thread_data *)threadargs)->thread_id;
-    struct Thread_data *my_data;
-    my_data = (struct Thread_data *) threadargs;
-    int camera_id = my_data->camera_id;
-
-    clock_gettime(CLOCK_MONOTONIC, &preSave);
-
-    // save an image as a FITS file
-    memcpy( &data_save, &data, sizeof(data));
-
-    clock_gettime(CLOCK_REALTIME, &localCaptureTime);
-
-    writeCurrentUT(timestamp);
-    sprintf(filename, "FOXSI_SAAS_%s.fits", timestamp);
-    filename[128 - 1] = '\0';
-
-    // TODO; add unique ID for camera.
-    localHeader.cameraID = cameraID;  // this is the serial number of the camera
-    localHeader.frameCount = frameCount;
-    localHeader.captureTime = localCaptureTime;
-    localHeader.exposure = (int)settings.exposure;
-    localHeader.preampGain = (int)settings.preampGain;
-    localHeader.analogGain = (float)settings.analogGain;
+    CameraContext *ctx = cameras.Get(my_data->camera_id);
+    HeaderData &localHeader = job->header;
+
+    // name the file after the camera and the exposure, not after when it is written
+    writeUT(my_data->capture_time, timestamp);
+    job->fileName = ctx->savePrefix + "_" + timestamp + ".fits";
+
+    localHeader = HeaderData();
+    localHeader.cameraID = ctx->serialNumber;  // this is the serial number of the camera
+    localHeader.frameCount = my_data->frame_count;
+    localHeader.captureTime = my_data->capture_time;
+    localHeader.captureTimeMono = my_data->capture_time_mono;
+    localHeader.clockLatched = my_data->clock_latched;
+    localHeader.exposure = my_data->parameters.exposure;
+    localHeader.preampGain = my_data->parameters.preampGain;
+    localHeader.analogGain = my_data->parameters.analogGain;
     localHeader.plateScale = arcsec_to_pixel;
-    localHeader.cameraTemperature = camera_temperature;
-
-    writeFITSImage(data_save, localHeader, filename, NUM_XPIXELS, NUM_YPIXELS);
-    saveCount++;
-
-    clock_gettime(CLOCK_MONOTONIC, &postSave);
-    elapsedSave = TimespecDiff(preSave, postSave);
-    fprintf(print_file_ptr, "Saving took: %ld sec %ld nsec \n", elapsedSave.tv_sec, elapsedSave.tv_nsec);
-
-    started[tid] = false;
-    pthread_exit(NULL);
+    localHeader.cameraTemperature = my_data->parameters.temperature;
+    localHeader.settling = my_data->settling;
+    localHeader.roiOffset[0] = my_data->offset_x;
+    localHeader.roiOffset[1] = my_data->offset_y;
+    localHeader.bitDepth = my_data->bit_depth;
+    localHeader.imageMinMax[0] = my_data->image_min_max[0];
+    localHeader.imageMinMax[1] = my_data->image_min_max[1];
+    localHeader.calibrated = my_data->calibrated;
+    localHeader.coadded = my_data->coadded;
+    localHeader.registered = my_data->registered;
+    localHeader.sunFound = my_data->centroid.found;
+    localHeader.sunCenter[0] = my_data->centroid.x;
+    localHeader.sunCenter[1] = my_data->centroid.y;
+    localHeader.sunOffset[0] = my_data->centroid.found ? (my_data->centroid.x - calib_center_x) * arcsec_to_pixel : 0;
+    localHeader.sunOffset[1] = my_data->centroid.found ? (my_data->centroid.y - calib_center_y) * arcsec_to_pixel : 0;
+    localHeader.limbFound = my_data->limb.found;
+    localHeader.limbCenter[0] = my_data->limb.x;
+    localHeader.limbCenter[1] = my_data->limb.y;
+    localHeader.limbRadius = my_data->limb.radius;
+    localHeader.limbRms = my_data->limb.rms;
+    localHeader.limbPoints = my_data->limb.inliers;
 }
 
 int main (int argc, char **argv) {
@@ -874,8 +1420,51 @@ int main (int argc, char **argv) {
     read_calibrated_ccd_center();
     read_settings();
 
-    // start the camera handling thread
-    start_thread(CameraThread, NULL);
+    if (realtime.Load(REALTIME_PROFILE) > 0){
+        fprintf(print_file_ptr, "Real-time profile from %s\n", REALTIME_PROFILE);
+        realtime.Print(print_file_ptr);
+    }
+    // before the cameras allocate their buffers
+    realtime.LockMemory();
+
+    // the writers, before any frame comes in
+    pthread_attr_t save_attr;
+    pthread_attr_init(&save_attr);
+    realtime.Prepare(&save_attr, ROLE_SAVE);
+    if (writers.Start(max_save_threads, save_queue_depth, (WriterPool::Overflow)save_overflow, &save_attr) != 0){
+        fprintf(print_file_ptr, "Can't start the writer threads, no frames will be saved\n");
+    }
+    pthread_attr_destroy(&save_attr);
+
+    // bind the cameras, without a bindings file every camera found is used
+    if (cameras.LoadBindings(CAMERA_BINDINGS, settings) <= 0){
+        fprintf(print_file_ptr, "No camera bindings in %s\n", CAMERA_BINDINGS);
+    }
+    if (!use_synthetic_camera){
+        cameras.Discover(settings);
+    }
+    if (cameras.Count() == 0){
+        // nothing found yet, keep looking for whichever camera shows up
+        cameras.AddCamera("", use_synthetic_camera ? SYNTHETIC_ADDRESS : "", settings);
+    }
+
+    // each camera's display exchange holds up to three buffers and each
+    // writer job one, so the pool only runs dry if something leaks
+    int pool_buffers = 3 * cameras.Count() + save_queue_depth + max_save_threads + FRAME_POOL_SPARE;
+    size_t pool_bytes = std::max(FrameExchange::Bytes(NUM_XPIXELS, NUM_YPIXELS),
+                                 (size_t)NUM_XPIXELS * NUM_YPIXELS * sizeof(uint16_t));
+    if (frame_pool.Allocate(pool_buffers, pool_bytes) != 0){
+        fprintf(print_file_ptr, "Only %d of %d frame buffers allocated\n", frame_pool.Count(), pool_buffers);
+    }
+
+    // start one camera handling thread per camera
+    for (int i = 0; i < cameras.Count(); i++){
+        Thread_data tdata = Thread_data();
+        tdata.camera_id = i;
+        start_thread(CameraThread, &tdata, ROLE_CAMERA);
+    }
+    // after the camera threads, so nothing is created from a pinned thread
+    realtime.ApplyToSelf(ROLE_DISPLAY);
 
     glutInit (&argc, argv);
     glutInitDisplayMode (GLUT_DOUBLE | GLUT_DEPTH); //set the display to Double buffer, with depth
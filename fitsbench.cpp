@@ -0,0 +1,175 @@
+#include <iostream>
+#include <algorithm>
+#include <string>
+#include <vector>
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/stat.h>
+
+#include "SyntheticSource.hpp"
+#include "compression.hpp"
+
+#define TIMEOUT 1000 // milliseconds
+
+double elapsedUsec(const timespec &start, const timespec &end)
+{
+    return (end.tv_sec - start.tv_sec) * 1e6 + (end.tv_nsec - start.tv_nsec) / 1e3;
+}
+
+typedef int (*Writer8)(const unsigned char *, const HeaderData &, const std::string &, int, int);
+typedef int (*Writer16)(const uint16_t *, const HeaderData &, const std::string &, int, int);
+
+int direct8(const unsigned char *data, const HeaderData &keys, const std::string &fileName, int width, int height)
+{
+    return writeFITSImage(data, keys, fileName, width, height);
+}
+
+int direct16(const uint16_t *data, const HeaderData &keys, const std::string &fileName, int width, int height)
+{
+    return writeFITSImage(data, keys, fileName, width, height);
+}
+
+/* Writes the same frame files times with one writer, each file removed
+   again, and prints the time per file and the rate in pixel bytes and
+   in bytes on disk
+*/
+void run(const char *name, Writer8 write8, Writer16 write16, const FrameLease &frame,
+         const std::vector<uint16_t> &words, const std::string &directory, int files, bool keep)
+{
+    std::vector<double> samples;
+    double written = 0;
+    int failed = 0;
+    size_t pixelBytes = (size_t)frame.width * frame.height * (frame.format == MONO8 ? 1 : 2);
+    HeaderData keys = HeaderData();
+    keys.captureTime = frame.captureTime;
+    keys.captureTimeMono = frame.captureTimeMono;
+    keys.exposure = 5000;
+    keys.bitDepth = PixelBits(frame.format);
+    keys.coadded = 1;
+    for (int i = 0; i < files; i++)
+    {
+        char fileName[256];
+        snprintf(fileName, sizeof(fileName), "%s/fitsbench_%s_%d.fits", directory.c_str(), name, i);
+        keys.frameCount = i;
+        unlink(fileName);
+
+        timespec start, end;
+        clock_gettime(CLOCK_MONOTONIC, &start);
+        int rc = (frame.format == MONO8) ? write8(frame.data(), keys, fileName, frame.width, frame.height) :
+                                           write16(&words[0], keys, fileName, frame.width, frame.height);
+        clock_gettime(CLOCK_MONOTONIC, &end);
+        if (rc != 0)
+        {
+            failed++;
+            continue;
+        }
+        samples.push_back(elapsedUsec(start, end));
+        struct stat info;
+        if (stat(fileName, &info) == 0)
+        {
+            written += info.st_size;
+        }
+        if (!keep)
+        {
+            unlink(fileName);
+        }
+    }
+    if (samples.empty())
+    {
+        printf("%-8s all %d files failed\n", name, failed);
+        return;
+    }
+    std::sort(samples.begin(), samples.end());
+    double sum = 0;
+    for (size_t i = 0; i < samples.size(); i++)
+    {
+        sum += samples[i];
+    }
+    double seconds = sum / 1e6;
+    printf("%-8s %lu files: mean %8.0f us  p50 %8.0f  p99 %8.0f  max %8.0f  %6.1f MB/s of pixels  %6.1f MB/s to disk (%.0f%%)  %d failed\n",
+           name, (unsigned long)samples.size(), sum / samples.size(), samples[samples.size() / 2],
+           samples[(size_t)(samples.size() * 0.99)], samples.back(),
+           pixelBytes * samples.size() / seconds / 1e6, written / seconds / 1e6,
+           100.0 * written / (pixelBytes * samples.size()), failed);
+}
+
+// time to fill in a primary header from the template, no file written
+void runHeader(const FrameLease &frame, const std::string &directory, int files)
+{
+    HeaderData keys = HeaderData();
+    keys.captureTime = frame.captureTime;
+    keys.captureTimeMono = frame.captureTimeMono;
+    keys.exposure = 5000;
+    keys.bitDepth = PixelBits(frame.format);
+    keys.coadded = 1;
+    std::string fileName = directory + "/fitsbench_header.fits";
+    char header[FITS_HEADER_BYTES];
+    size_t bytes = 0;
+    // enough repeats to be well above the clock resolution
+    int repeats = std::max(files, 1) * 100;
+    timespec start, end;
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    for (int i = 0; i < repeats; i++)
+    {
+        keys.frameCount = i;
+        bytes = formatFITSHeader(keys, fileName, frame.format != MONO8, header);
+    }
+    clock_gettime(CLOCK_MONOTONIC, &end);
+    printf("%-8s %d headers of %lu bytes: mean %8.2f us\n", "header", repeats, (unsigned long)bytes,
+           elapsedUsec(start, end) / repeats);
+}
+
+/* Times the FITS save path and the header fill on a synthetic Sun
+   frame
+*/
+int main(int argc, char* argv[])
+{
+    int files = 50;
+    int bits = 8;
+    std::string directory = "/tmp";
+    bool keep = false;
+    switch(argc) {
+        case 5:
+            keep = atoi(argv[4]);
+        case 4:
+            directory = argv[3];
+        case 3:
+            bits = atoi(argv[2]);
+        case 2:
+            files = atoi(argv[1]);
+        case 1:
+            break;
+        default:
+            std::cout << "Calling sequence: fitsbench [files] [bit depth (8/10/12)] [directory] [keep files (0/1)]\n";
+            return 0;
+    }
+
+    SyntheticSource camera;
+    camera.SetPixelFormat(PixelFormatFor(bits, false));
+    camera.Connect();
+    camera.ConfigureStream();
+    camera.Initialize();
+    camera.StartAcquisition();
+    FrameLease frame;
+    if (camera.Retrieve(frame, TIMEOUT) != 0)
+    {
+        std::cout << "No frame from the synthetic source" << std::endl;
+        return -1;
+    }
+    // saved frames are one word per pixel beyond 8 bits
+    std::vector<uint16_t> words((size_t)frame.width * frame.height);
+    if (frame.format != MONO8)
+    {
+        UnpackPixels(frame.data(), frame.format, &words[0], words.size());
+    }
+
+    printf("%s %dx%d to %s\n", PixelFormatName(frame.format), frame.width, frame.height, directory.c_str());
+    run("direct", direct8, direct16, frame, words, directory, files, keep);
+    runHeader(frame, directory, files);
+
+    frame.release();
+    camera.Stop();
+    return 0;
+}
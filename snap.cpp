@@ -1,9 +1,11 @@
 #include <iostream>
 #include <signal.h>
+#include <string.h>     /* for memset() */
 #include <unistd.h>     /* for sleep()  */
 
 #include "ImperxStream.hpp"
 #include "compression.hpp"
+#include "FrameStats.hpp"
 
 #define TIMEOUT 20000 // milliseconds
 #define SLEEP_CAMERA_CONNECT   1 // waits for errors while connecting to camera
@@ -12,7 +14,7 @@ long localExposure = 1000;
 int16_t localPreampGain = -3;
 uint16_t localAnalogGain = 300;
 
-cv::Mat localFrame;
+FrameLease localFrame;
 HeaderData localHeader;
 
 sig_atomic_t volatile g_running = 1;
@@ -40,7 +42,7 @@ void ImageSave()
         sprintf(filename, "image_%s_%03d.fits", timestamp, (int)(localHeader.captureTime.tv_nsec/1000000l));
 
         printf("Saving image %s: exposure %d us, analog gain %d, preamp gain %d, min %d, max %d\n", filename, localHeader.exposure, localHeader.analogGain, localHeader.preampGain, localHeader.imageMinMax[0], localHeader.imageMinMax[1]);
-        writeFITSImage(localFrame, localHeader, filename);
+        writeFITSImage(localFrame.data(), localHeader, filename, localFrame.width, localFrame.height);
     }
     else
     {
@@ -71,8 +73,6 @@ int main(int argc, char* argv[])
     bool cameraReady;
     ImperxStream camera;
 
-    int width, height;
-
     cameraReady = false;
     while(g_running)
     {
@@ -92,9 +92,6 @@ int main(int argc, char* argv[])
                 camera.SetAnalogGain(localAnalogGain);
                 camera.SetPreAmpGain(localPreampGain);
 
-                width = camera.GetROIWidth();
-                height = camera.GetROIHeight();
-                localFrame.create(height, width, CV_8UC1);
                 if(camera.Initialize() != 0)
                 {
                     std::cerr << "Error initializing camera!\n";
@@ -116,18 +113,18 @@ int main(int argc, char* argv[])
 
                 localHeader.captureTime = now;
 
-                uint8_t localMin, localMax;
-
                 localHeader.exposure = localExposure;
                 localHeader.preampGain = localPreampGain;
                 localHeader.analogGain = localAnalogGain;
+                localHeader.bitDepth = PixelBits(localFrame.format);
+                localHeader.coadded = 1;
 
-                double tempMin, tempMax;
-                cv::minMaxLoc(localFrame, &tempMin, &tempMax);
-                std::cout << "Image max: " << (int)tempMax << std::endl;
+                FrameStats levels;
+                MeasureStats(localFrame.data(), localFrame.width * localFrame.height, levels);
+                std::cout << "Image mean: " << levels.Mean() << ", " << levels.SaturatedFraction() * 100 << "% saturated" << std::endl;
 
-                localHeader.imageMinMax[0] = localMin;
-                localHeader.imageMinMax[1] = localMax;
+                localHeader.imageMinMax[0] = levels.min;
+                localHeader.imageMinMax[1] = levels.max;
 
                 ImageSave();
             }
@@ -141,9 +138,10 @@ int main(int argc, char* argv[])
 
         std::string buffer;
 
-        std::getline(cin, buffer);
+        std::getline(std::cin, buffer);
     }
 
+    localFrame.release();
     camera.Stop();
     camera.Disconnect();
 
@@ -14,6 +14,9 @@
 #include <PvInterface.h>
 #include <PvDevice.h>
 
+#include <time.h>
+#include "BufferCountPolicy.hpp"
+
 //PV_INIT_SIGNAL_HANDLER();
 
 //
@@ -113,9 +116,16 @@ bool AcquireImages()
     PvInt64 lSize = 0;
 	lDeviceParams->GetIntegerValue( "PayloadSize", lSize );
 
-    // Set the Buffer size and the Buffer count
+    // Set the Buffer size and the Buffer count, sized from the payload
+    // and frame rate and adapted to losses while streaming
+    double lRate = 0.0;
+    if ( !lDeviceParams->GetFloatValue( "AcquisitionFrameRate", lRate ).IsOK() || lRate <= 0 )
+    {
+        lRate = 30.0;
+    }
+    BufferCountPolicy lBufferPolicy;
     lPipeline.SetBufferSize( static_cast<PvUInt32>( lSize ) );
-    lPipeline.SetBufferCount( 16 ); // Increase for high frame rate without missing block IDs
+    lPipeline.SetBufferCount( lBufferPolicy.Initial( lSize, lRate ) );
 
     // Have to set the Device IP destination to the Stream
     lDevice.SetStreamDestination( lStream.GetLocalIPAddress(), lStream.GetLocalPort() );
@@ -188,6 +198,21 @@ bool AcquireImages()
                     lFrameRateVal,
                     lBandwidthVal / 1000000.0 ); 
             }
+            // Grow or shrink the pipeline from what this buffer tells us
+            PvUInt32 lMissing = 0;
+            if ( !lOperationResult.IsOK() )
+            {
+                lBuffer->GetMissingPacketIdsCount( lMissing );
+            }
+            timespec lNow;
+            clock_gettime( CLOCK_MONOTONIC, &lNow );
+            int lCount = lBufferPolicy.Update( lNow, lOperationResult.IsOK() ? 0 : 1, (int) lMissing,
+                                               (int) lPipeline.GetOutputQueueSize() );
+            if ( lCount != (int) lPipeline.GetBufferCount() )
+            {
+                lPipeline.SetBufferCount( lCount );
+            }
+
             // We have an image - do some processing (...) and VERY IMPORTANT,
             // release the buffer back to the pipeline
             lPipeline.ReleaseBuffer( lBuffer );